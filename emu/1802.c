@@ -1,13 +1,33 @@
 #include "mwemu.h"
 #include "1802.h"
+#include "disasm.h"
+#include "prof.h"
+#include "cov.h"
+#include "fuse.h"
+#include "aot.h"
+#include "beep.h"
+#include "serial.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <array>
+#include <utility>
 
 uint8_t *mem; /* RAM */
 
+/* Set for each page written; whoever wants to know what changed clears
+   it (see statehash.h) */
+uint8_t mem_dirty[MEM_PAGES];
+
 //uint16_t addr; /* Address Bus */
 uint8_t bus; /* Data Bus */
-cpu_regs r; /* CPU Registers */
+cpu_regs r __attribute__((aligned(64))); /* CPU Registers */
 cpu_io io; /* CPU I/O */
 
+/* Changes whenever the core is rebuilt: anything saved from a run of a
+   different build may not be what this one would do */
+const char cpu_build[] = __DATE__ " " __TIME__;
+
 
 /* General */
 
@@ -26,23 +46,101 @@ void incPC() {
 }
 
 
+/* Instruction fetch, and peeks by debuggers: not seen by instrumentation */
+uint8_t mem_fetch(uint16_t addr) {
+  return mem[addr & MEM_MASK];
+}
+
+
+/* Debugger pokes: may patch the ROM */
+void mem_poke(uint16_t addr, uint8_t data) {
+  mem[addr & MEM_MASK] = data;
+  mem_dirty[(addr & MEM_MASK) >> MEM_PAGE_SHIFT] = 1;
+  if ((addr & MEM_MASK) < ROM_BYTES) {
+    if (cpu_fuse) fuse_scan();
+    /* The translation is of the ROM as it was */
+    if (cpu_aot) aot_stop();
+  }
+}
+
+
+/* All emulated data traffic goes through these two. */
+uint8_t mem_read(uint16_t addr) {
+  if (cpu_hooks & HOOK_COVER) COV_MARK(addr & MEM_MASK, COV_READ);
+  return mem[addr & MEM_MASK];
+}
+
+
+void mem_write(uint16_t addr, uint8_t data) {
+  addr &= MEM_MASK;
+  if (cpu_hooks & HOOK_COVER) COV_MARK(addr, COV_WRITE);
+  /* The ROM ignores writes; count them, they are always bugs */
+  if (addr < ROM_BYTES) {
+    rom_writes++;
+    return;
+  }
+  mem[addr] = data;
+  mem_dirty[addr >> MEM_PAGE_SHIFT] = 1;
+}
+
+
+/* After something has changed memory wholesale */
+void mem_touch_all() {
+  memset(mem_dirty, 1, sizeof(mem_dirty));
+}
+
+
 void memPcIn(uint8_t data) {
-  mem[(PC() & MEM_MASK)] = data;
+  mem_write(PC(), data);
 }
 
 
 uint8_t memPcOut() {
-  return mem[(PC() & MEM_MASK)];
+  return mem_fetch(PC());
 }
 
 
+/*
+  The opcode handlers are templates over a memory model and a trace
+  policy (and core<>, by cpu_cycle(), adds timing), so that each way the
+  core is used gets its own copy with nothing left to decide at run time.
+
+  Memory models: mem_hooked goes through mem_read() and mem_write(),
+  which the coverage hook watches; mem_plain does the same thing without
+  looking at cpu_hooks, for when they are all off.
+*/
+struct mem_hooked {
+  static uint8_t read(uint16_t addr) { return mem_read(addr); }
+  static void write(uint16_t addr, uint8_t data) { mem_write(addr, data); }
+};
+
+struct mem_plain {
+  static uint8_t read(uint16_t addr) { return mem[addr & MEM_MASK]; }
+  static void write(uint16_t addr, uint8_t data) {
+    addr &= MEM_MASK;
+    if (addr < ROM_BYTES) {
+      rom_writes++;
+      return;
+    }
+    mem[addr] = data;
+    mem_dirty[addr >> MEM_PAGE_SHIFT] = 1;
+  }
+};
+
+/* Trace policies: whether trace and cpu_hooks are looked at at all */
+struct traced { static const int on = 1; };
+struct untraced { static const int on = 0; };
+
+
+template <class M>
 void memXregIn(uint8_t data) {
-  mem[(r.R[r.X]) & MEM_MASK] = data;
+  M::write(r.R[r.X], data);
 }
 
 
+template <class M>
 uint8_t memXregOut() {
-  return mem[(r.R[r.X]) & MEM_MASK];
+  return M::read(r.R[r.X]);
 }
 
 
@@ -50,44 +148,37 @@ uint8_t memXregOut() {
 
 /* INC r   Increment Register                      1r */
 void inc(uint8_t k) {
-  printf("\tINC %x\n", k);
   r.R[k]++;
 }
 
 /* DEC r   Decrement Register                      2r */
 void dec(uint8_t k) {
-  printf("\tDEC %x\n", k);
   r.R[k]--;
 }
 
 /* IRX     Increment R(X)                          60 */
 void irx() {
-  printf("\tIRX\n");
   r.R[r.X]++;
 }
 
 /* GLO r   Get Low byte of Register                8r */
 void glo(uint8_t k) {
-  printf("\tGLO %x\n", k);
   r.D = r.R[k] & 0xFF;
 }
 
 /* GHI r   Get High byte of Register               9r */
 void ghi(uint8_t k) {
-  printf("\tGHI %x\n", k);
   r.D = (r.R[k] & 0xFF00) >> 8;
 }
 
 /* PLO r   Put D in Low byte of register           Ar */
 void plo(uint8_t k) {
-  printf("\tPLO %x\n", k);
   r.R[k] &= 0xFF00;
   r.R[k] |= r.D;
 }
 
 /* PHI r   Put D in High byte of register          Br */
 void phi(uint8_t k) {
-  printf("\tPHI %x\n", k);
   r.R[k] = (r.D * 256) | (r.R[k] & 0x00FF);
 }
 
@@ -95,50 +186,49 @@ void phi(uint8_t k) {
 /* Memory References */
 
 /* LDN r   Load D via N (for r = 1 to F)           0r */
+template <class M>
 void ldn(uint8_t k) {
-  printf("\tLDN %x\n", k);
-  r.D = mem[(r.R[k]) & MEM_MASK];
+  r.D = M::read(r.R[k]);
   //printf("R[k] = %.4x\n", r.R[k]);
   //printf("D = %.2x\n", r.D);
 }
 
 /* LDA r   Load D and Advance                      4r */
+template <class M>
 void lda(uint8_t k) {
-  printf("\tLDA %x\n", k);
-  r.D = mem[(r.R[k]) & MEM_MASK];
+  r.D = M::read(r.R[k]);
   r.R[k]++;
 }
 
 /* LDX     Load D via R(X)                         F0 */
+template <class M>
 void ldx() {
-  printf("\tLDX\n");
-  r.D = memXregOut();
+  r.D = memXregOut<M>();
 }
 
 /* LDXA    Load D via R(X) and Advance             72 */
+template <class M>
 void ldxa() {
-  printf("\tLDXA\n");
-  r.D = memXregOut();
+  r.D = memXregOut<M>();
   r.R[r.X]++;
 }
 
 /* LDI b   Load D Immediate                        F8 bb */
 void ldi() {
   r.D = memPcOut();
-  printf("\tLDI %x\n", r.D);
   incPC();
 }
 
 /* STR r   Store D into memory                     5r */
+template <class M>
 void str(uint8_t k) {
-  printf("\tSTR %x\n", k);
-  mem[(r.R[k]) & MEM_MASK] = r.D;
+  M::write(r.R[k], r.D);
 }
 
 /* STXD    Store D via R(X) and Decrement          73 */
+template <class M>
 void stxd() {
-  printf("\tSTXD\n");
-  memXregIn(r.D);
+  memXregIn<M>(r.D);
   r.R[r.X]--;
 }
 
@@ -146,47 +236,43 @@ void stxd() {
 /* Logic Ops */
 
 /* OR      Logical OR                              F1 */
+template <class M>
 void _or() {
-  printf("\tOR\n");
-  r.D |= memXregOut();
+  r.D |= memXregOut<M>();
 }
 
 /* ORI b   OR Immediate                            F9 bb */
 void ori() {
-  printf("\tORI\n");
-  r.D |= memXregOut();
+  r.D |= memPcOut();
   incPC();
 }
 
 /* XOR     Exclusive OR                            F3 */
+template <class M>
 void _xor() {
-  printf("\tXOR\n");
-  r.D ^= memXregOut();
+  r.D ^= memXregOut<M>();
 }
 
 /* XRI b   Exclusive OR, Immediate                 FB bb */
 void xri() {
-  printf("\tXRI\n");
-  r.D ^= memXregOut();
+  r.D ^= memPcOut();
   incPC();
 }
 
 /* AND     Logical AND                             F2 */
+template <class M>
 void _and() {
-  printf("\tAND\n");
-  r.D &= memXregOut();
+  r.D &= memXregOut<M>();
 }
 
 /* ANI b   AND Immediate                           FA bb */
 void ani() {
-  printf("\tANI\n");
-  r.D &= memXregOut();
+  r.D &= memPcOut();
   incPC();
 }
 
 /* SHR     Shift D Right                           F6 */
 void shr() {
-  printf("\tSHR\n");
   if (r.D & 1) {
     r.DF = 1;
   } else {
@@ -198,7 +284,6 @@ void shr() {
 
 /* SHRC    Shift D Right with Carry                76 */
 void rshr() {
-  printf("\tRSHR\n");
   int f = r.DF;
   if (r.D & 1) {
     r.DF = 1;
@@ -212,7 +297,6 @@ void rshr() {
 
 /* SHL     Shift D Left                            FE */
 void shl() {
-  printf("\tSHL\n");
   if (r.D & 0x80) {
     r.DF = 1;
   } else {
@@ -224,7 +308,6 @@ void shl() {
 
 /* SHLC    Shift D Left with Carry                 7E */
 void rshl() {
-  printf("\tRSHL\n");
   int f = r.DF;
   if (r.D & 0x80) {
     r.DF = 1;
@@ -240,10 +323,10 @@ void rshl() {
 /* Arithmetic Ops */
 
 /* ADD     Add                                     F4 */
+template <class M>
 void add() {
-  printf("\tADD\n");
   uint16_t tD = r.D;
-  tD += memXregOut();
+  tD += memXregOut<M>();
   if (tD > 0xFF) {
     r.DF = 1;
   } else {
@@ -254,7 +337,6 @@ void add() {
 
 /* ADI b   Add Immediate                           FC bb */
 void adi() {
-  printf("\tADI\n");
   uint16_t tD = r.D;
   tD += memPcOut();
   if (tD > 0xFF) {
@@ -267,10 +349,10 @@ void adi() {
 }
 
 /* ADC     Add with Carry                          74 */
+template <class M>
 void adc() {
-  printf("\tADC\n");
   uint16_t tD = r.D;
-  tD += memXregOut();
+  tD += memXregOut<M>();
   tD += r.DF;
   if (tD > 0xFF) {
     r.DF = 1;
@@ -282,7 +364,6 @@ void adc() {
 
 /* ADCI b  Add with Carry Immediate                7C bb */
 void adci() {
-  printf("\tADCI\n");
   uint16_t tD = r.D;
   tD += memPcOut();
   tD += r.DF;
@@ -296,10 +377,10 @@ void adci() {
 }
 
 /* SD      Subtract D from memory                  F5 */
+template <class M>
 void sd() {
-  printf("\tSD\n");
   uint16_t tD;
-  tD = memXregOut() + 0xFF - r.D + 1;
+  tD = memXregOut<M>() + 0xFF - r.D + 1;
   if (tD > 0xFF) {
     r.DF = 1;
   } else {
@@ -310,7 +391,6 @@ void sd() {
 
 /* SDI b   Subtract D from memory Immediate byte   FD bb */
 void sdi() {
-  printf("\tSDI\n");
   uint16_t tD;
   tD = memPcOut() + 0xFF - r.D + 1;
   if (tD > 0xFF) {
@@ -323,11 +403,10 @@ void sdi() {
 }
 
 /* SDB     Subtract D from memory with Borrow      75 */
+template <class M>
 void sdb() {
-  printf("\tSDB\n");
   uint16_t tD;
-  tD = memXregOut() + 0xFF - r.D;
-  tD += (0xFF - memXregOut());
+  tD = memXregOut<M>() + 0xFF - r.D;
   if (r.DF) tD++;
   if (tD > 0xFF) {
     r.DF = 1;
@@ -339,7 +418,6 @@ void sdb() {
 
 /* SDBI b  Subtract D with Borrow, Immediate       7D bb */
 void sdbi() {
-  printf("\tSDBI\n");
   uint16_t tD;
   tD = memPcOut() + 0xFF - r.D;
   if (r.DF) tD++;
@@ -353,10 +431,10 @@ void sdbi() {
 }
 
 /* SM      Subtract Memory from D                  F7 */
+template <class M>
 void sm() {
-  printf("\tSM\n");
   uint16_t tD;
-  tD = r.D + 0xFF - memXregOut() + 1;
+  tD = r.D + 0xFF - memXregOut<M>() + 1;
   if (tD > 0xFF) {
     r.DF = 1;
   } else {
@@ -367,7 +445,6 @@ void sm() {
 
 /* SMI b   Subtract Memory from D, Immediate       FF bb */
 void smi() {
-  printf("\tSMI\n");
   uint16_t tD;
   tD = r.D + 0xFF - memPcOut() + 1;
   if (tD > 0xFF) {
@@ -380,10 +457,10 @@ void smi() {
 }
 
 /* SMB     Subtract Memory from D with Borrow      77 */
+template <class M>
 void smb() {
-  printf("\tSMB\n");
   uint16_t tD;
-  tD = r.D + 0xFF - memXregOut();
+  tD = r.D + 0xFF - memXregOut<M>();
   if (r.DF) tD++;
   if (tD > 0xFF) {
     r.DF = 1;
@@ -395,7 +472,6 @@ void smb() {
 
 /* SMBI b  Subtract Memory with Borrow, Immediate  7F bb */
 void smbi() {
-  printf("\tSMBI\n");
   uint16_t tD;
   tD = r.D + 0xFF - memPcOut();
   if (r.DF) tD++;
@@ -413,7 +489,6 @@ void smbi() {
 
 /* BR a    Branch unconditionally                  30 aa */
 void br() {
-  printf("\tBR\n");
   //addr = (PC() & 0xFF00);
   //addr = (PC() & 0xFF00) | memPcOut();
   
@@ -428,7 +503,6 @@ void br() {
 
 /* BZ a    Branch on Zero                          32 aa */
 void bz() {
-  printf("\tBZ\n");
   if (r.D == 0) {
     br();
   } else {
@@ -438,7 +512,6 @@ void bz() {
 
 /* BNZ a   Branch on Not Zero                      3A aa */
 void bnz() {
-  printf("\tBNZ\n");
   if (r.D != 0) {
     br();
   } else {
@@ -448,7 +521,6 @@ void bnz() {
 
 /* BDF a   Branch if DF is 1                       33 aa */
 void bdf() {
-  printf("\tBDF\n");
   if (r.DF) {
     br();
   } else {
@@ -458,7 +530,6 @@ void bdf() {
 
 /* BNF a   Branch if DF is 0                       3B aa */
 void bnf() {
-  printf("\tBNF\n");
   if (!(r.DF)) {
     br();
   } else {
@@ -468,7 +539,6 @@ void bnf() {
 
 /* BQ a    Branch if Q is on                       31 aa */
 void bq() {
-  printf("\tBQ\n");
   if (r.Q) {
     br();
   } else {
@@ -478,7 +548,6 @@ void bq() {
 
 /* BNQ a   Branch if Q is off                      39 aa */
 void bnq() {
-  printf("\tBNQ\n");
   if (!(r.Q)) {
     br();
   } else {
@@ -488,7 +557,6 @@ void bnq() {
 
 /* B1 a    Branch on External Flag 1               34 aa */
 void b1() {
-  printf("\tB1\n");
   if (io.EF1) {
     br();
   } else {
@@ -498,7 +566,6 @@ void b1() {
 
 /* BN1 a   Branch on Not External Flag 1           3C aa */
 void bn1() {
-  printf("\tBN1\n");
   if (!(io.EF1)) {
     br();
   } else {
@@ -508,7 +575,6 @@ void bn1() {
 
 /* B2 a    Branch on External Flag 2               35 aa */
 void b2() {
-  printf("\tB2\n");
   if (io.EF2) {
     br();
   } else {
@@ -518,7 +584,6 @@ void b2() {
 
 /* BN2 a   Branch on Not External Flag 2           3D aa */
 void bn2() {
-  printf("\tBN2\n");
   if (!(io.EF2)) {
     br();
   } else {
@@ -528,7 +593,6 @@ void bn2() {
 
 /* B3 a    Branch on External Flag 3               36 aa */
 void b3() {
-  printf("\tB3\n");
   if (io.EF3) {
     br();
   } else {
@@ -538,7 +602,6 @@ void b3() {
 
 /* BN3 a   Branch on Not External Flag 3           3E aa */
 void bn3() {
-  printf("\tBN3\n");
   if (!(io.EF3)) {
     br();
   } else {
@@ -548,7 +611,6 @@ void bn3() {
 
 /* B4 a    Branch on External Flag 4               37 aa */
 void b4() {
-  printf("\tB4\n");
   if (io.EF4) {
     br();
   } else {
@@ -558,7 +620,6 @@ void b4() {
 
 /* BN4 a   Branch on Not External Flag 4           3F aa */
 void bn4() {
-  printf("\tBN4\n");
   if (!(io.EF4)) {
     br();
   } else {
@@ -569,7 +630,6 @@ void bn4() {
 /* LBR aa  Long Branch unconditionally             C0 aaaa */
 void lbr() {
   uint16_t addr;
-  printf("\tLBR\n");
   addr = 256 * memPcOut();
   incPC();
 
@@ -581,7 +641,6 @@ void lbr() {
 
 /* LBZ aa  Long Branch if Zero                     C2 aaaa */
 void lbz() {
-  printf("\tLBZ\n");
   if (r.D == 0) {
     lbr();
   } else {
@@ -592,7 +651,6 @@ void lbz() {
 
 /* LBNZ aa Long Branch if Not Zero                 CA aaaa */
 void lbnz() {
-  printf("\tLBNZ\n");
   if (r.D != 0) {
     lbr();
   } else {
@@ -603,7 +661,6 @@ void lbnz() {
 
 /* LBDF aa Long Branch if DF is 1                  C3 aaaa */
 void lbdf() {
-  printf("\tLBDF\n");
   if (r.DF) {
     lbr();
   } else {
@@ -614,7 +671,6 @@ void lbdf() {
 
 /* LBNF aa Long Branch if DF is 0                  CB aaaa */
 void lbnf() {
-  printf("\tLBNF\n");
   if (!(r.DF)) {
     lbr();
   } else {
@@ -625,7 +681,6 @@ void lbnf() {
 
 /* LBQ aa  Long Branch if Q is on                  C1 aaaa */
 void lbq() {
-  printf("\tLBQ\n");
   if (r.Q) {
     lbr();
   } else {
@@ -636,7 +691,6 @@ void lbq() {
 
 /* LBNQ aa Long Branch if Q is off                 C9 aaaa */
 void lbnq() {
-  printf("\tLBNQ\n");
   if (!(r.Q)) {
     lbr();
   } else {
@@ -650,7 +704,6 @@ void lbnq() {
 
 /* LSZ     Long Skip if Zero                       CE */
 void lsz() {
-  printf("\tLSZ\n");
   if (r.D == 0) {
     incPC();
     incPC();
@@ -659,7 +712,6 @@ void lsz() {
 
 /* LSNZ    Long Skip if Not Zero                   C6 */
 void lsnz() {
-  printf("\tLSNZ\n");
   if (r.D != 0) {
     incPC();
     incPC();
@@ -668,7 +720,6 @@ void lsnz() {
 
 /* LSDF    Long Skip if DF is 1                    CF */
 void lsdf() {
-  printf("\tLSDF\n");
   if (r.DF) {
     incPC();
     incPC();
@@ -677,7 +728,6 @@ void lsdf() {
 
 /* LSNF    Long Skip if DF is 0                    C7 */
 void lsnf() {
-  printf("\tLSNF\n");
   if (!(r.DF)) {
     incPC();
     incPC();
@@ -686,7 +736,6 @@ void lsnf() {
 
 /* LSQ     Long Skip if Q is on                    CD */
 void lsq() {
-  printf("\tLSQ\n");
   if (r.Q) {
     incPC();
     incPC();
@@ -695,7 +744,6 @@ void lsq() {
 
 /* LSNQ    Long Skip if Q is off                   C5 */
 void lsnq() {
-  printf("\tLSNQ\n");
   if (!(r.Q)) {
     incPC();
     incPC();
@@ -704,7 +752,6 @@ void lsnq() {
 
 /* LSIE    Long Skip if Interrupts Enabled         CC */
 void lsie() {
-  printf("\tLSIE\n");
   if (r.IE) {
     incPC();
     incPC();
@@ -716,14 +763,12 @@ void lsie() {
 
 /* SEP r   Set P                                   Dr */
 void sep(uint8_t k) {
-  printf("\tSEP %x\n", k);
   r.N = k;
   r.P = r.N;
 }
 
 /* SEX r   Set X                                   Er */
 void sex(uint8_t k) {
-  printf("\tSEX %x\n", k);
   r.N = k;
   r.X = r.N;
 }
@@ -732,30 +777,42 @@ void sex(uint8_t k) {
 /* Input/Output Byte Transfer */
 
 /* OUT p   Output from memory (for p = 1 to 7)     6p */
+template <class M, class T>
 void out(uint8_t k) {
-  bus = memXregOut();
-  /* TODO: Do Stuff! */
-  printf("OUT[%d]: BUS=%x\n", k, bus);
-  /* TODO: Do Stuff! */
+  bus = memXregOut<M>();
+  if (T::on && trace) printf("OUT[%d]: BUS=%x\n", k, bus);
+  switch (k) {
+  case LCD_CMD:
+  case LCD_DATA: lcd_out(k, bus); break;
+  case SERIAL_PORT: serial_out(bus); break;
+  }
+  totals.io_events++;
   r.R[r.X]++;
 }
 
 /* INP p   Input to memory and D (for p = 9 to F)  6p */
+template <class M, class T>
 void inp(uint8_t k) {
-  memXregIn(bus);
-  bus = r.D;
-  /* TODO: Do Stuff! */
-  printf("IN[%d]: BUS=%x\n", k, bus);
-  /* TODO: Do Stuff! */
+  bus = io.IN[k & 7];
+  memXregIn<M>(bus);
+  r.D = bus;
+  if (T::on && trace) printf("IN[%d]: BUS=%x\n", k, bus);
+  totals.io_events++;
 }
 
 
 /* Other */
 
+/* SEQ, REQ: Q drives the beeper, which hears of every change */
+void q_out(uint8_t q) {
+  if (q != r.Q && beep_on) beep_q(q, totals.cycles);
+  r.Q = q;
+}
+
 /* RET     Return                                  70 */
+template <class M>
 void ret() {
-  printf("\tRET\n");
-  uint8_t tD = memXregOut();
+  uint8_t tD = memXregOut<M>();
   r.R[r.X]++;
   r.P = tD & 0x0F;
   r.X = tD >> 4;
@@ -763,9 +820,9 @@ void ret() {
 }
 
 /* DIS     Return and Disable Interrupts           71 */
+template <class M>
 void dis() {
-  printf("\tDIS\n");
-  uint8_t tD = memXregOut();
+  uint8_t tD = memXregOut<M>();
   r.R[r.X]++;
   r.P = tD & 0x0F;
   r.X = tD >> 4;
@@ -773,345 +830,260 @@ void dis() {
 }
 
 /* SAV     Save T                                  78 */
+template <class M>
 void sav() {
-  printf("\tSAV\n");
-  exit(1);
+  memXregIn<M>(r.T);
 }
 
 /* MARK    Save X and P in T                       79 */
+template <class M>
 void mark() {
-  printf("\tMARK\n");
-  exit(1);
+  r.T = (r.X << 4) | r.P;
+  M::write(r.R[2], r.T);
+  r.X = r.P;
+  r.R[2]--;
+}
+
+
+/* Interrupt response: T <- X,P; P <- 1; X <- 2; IE <- 0 */
+void cpu_interrupt() {
+  r.T = (r.X << 4) | r.P;
+  r.P = 1;
+  r.X = 2;
+  r.IE = 0;
+  r.IDLE = 0;
+  cpu_interrupts++;
+  totals.interrupts++;
 }
 
 
 /* Op not implemented */
-void badop(char *s) {
-  printf("Opcode not implemented: '%s'.\n", s);
-}
-
-
-
-/* IDL     Idle                                    00  */
-void i00() { printf("\tIDL\n"); incPC(); }
-
-void i01() { incPC(); ldn(1); }
-void i02() { incPC(); ldn(2); }
-void i03() { incPC(); ldn(3); }
-void i04() { incPC(); ldn(4); }
-void i05() { incPC(); ldn(5); }
-void i06() { incPC(); ldn(6); }
-void i07() { incPC(); ldn(7); }
-void i08() { incPC(); ldn(8); }
-void i09() { incPC(); ldn(9); }
-void i0a() { incPC(); ldn(10); }
-void i0b() { incPC(); ldn(11); }
-void i0c() { incPC(); ldn(12); }
-void i0d() { incPC(); ldn(13); }
-void i0e() { incPC(); ldn(14); }
-void i0f() { incPC(); ldn(15); }
-
-void i10() { incPC(); inc(0); }
-void i11() { incPC(); inc(1); }
-void i12() { incPC(); inc(2); }
-void i13() { incPC(); inc(3); }
-void i14() { incPC(); inc(4); }
-void i15() { incPC(); inc(5); }
-void i16() { incPC(); inc(6); }
-void i17() { incPC(); inc(7); }
-void i18() { incPC(); inc(8); }
-void i19() { incPC(); inc(9); }
-void i1a() { incPC(); inc(10); }
-void i1b() { incPC(); inc(11); }
-void i1c() { incPC(); inc(12); }
-void i1d() { incPC(); inc(13); }
-void i1e() { incPC(); inc(14); }
-void i1f() { incPC(); inc(15); }
-
-void i20() { incPC(); dec(0); }
-void i21() { incPC(); dec(1); }
-void i22() { incPC(); dec(2); }
-void i23() { incPC(); dec(3); }
-void i24() { incPC(); dec(4); }
-void i25() { incPC(); dec(5); }
-void i26() { incPC(); dec(6); }
-void i27() { incPC(); dec(7); }
-void i28() { incPC(); dec(8); }
-void i29() { incPC(); dec(9); }
-void i2a() { incPC(); dec(10); }
-void i2b() { incPC(); dec(11); }
-void i2c() { incPC(); dec(12); }
-void i2d() { incPC(); dec(13); }
-void i2e() { incPC(); dec(14); }
-void i2f() { incPC(); dec(15); }
-
-void i30() { incPC(); br(); }
-void i31() { incPC(); bq(); }
-void i32() { incPC(); bz(); }
-void i33() { incPC(); bdf(); }
-void i34() { incPC(); b1(); }
-void i35() { incPC(); b2(); }
-void i36() { incPC(); b3(); }
-void i37() { incPC(); b4(); }
-void i38() { incPC(); incPC(); } /* SKP     Skip one byte   38 */
-void i39() { incPC(); bnq(); }
-void i3a() { incPC(); bnz(); }
-void i3b() { incPC(); bnf(); }
-void i3c() { incPC(); bn1(); }
-void i3d() { incPC(); bn2(); }
-void i3e() { incPC(); bn3(); }
-void i3f() { incPC(); bn4(); }
-
-void i40() { incPC(); lda(0); }
-void i41() { incPC(); lda(1); }
-void i42() { incPC(); lda(2); }
-void i43() { incPC(); lda(3); }
-void i44() { incPC(); lda(4); }
-void i45() { incPC(); lda(5); }
-void i46() { incPC(); lda(6); }
-void i47() { incPC(); lda(7); }
-void i48() { incPC(); lda(8); }
-void i49() { incPC(); lda(9); }
-void i4a() { incPC(); lda(10); }
-void i4b() { incPC(); lda(11); }
-void i4c() { incPC(); lda(12); }
-void i4d() { incPC(); lda(13); }
-void i4e() { incPC(); lda(14); }
-void i4f() { incPC(); lda(15); }
-
-void i50() { incPC(); str(0); }
-void i51() { incPC(); str(1); }
-void i52() { incPC(); str(2); }
-void i53() { incPC(); str(3); }
-void i54() { incPC(); str(4); }
-void i55() { incPC(); str(5); }
-void i56() { incPC(); str(6); }
-void i57() { incPC(); str(7); }
-void i58() { incPC(); str(8); }
-void i59() { incPC(); str(9); }
-void i5a() { incPC(); str(10); }
-void i5b() { incPC(); str(11); }
-void i5c() { incPC(); str(12); }
-void i5d() { incPC(); str(13); }
-void i5e() { incPC(); str(14); }
-void i5f() { incPC(); str(15); }
-
-void i60() { incPC(); irx(); }
-void i61() { incPC(); out(1); }
-void i62() { incPC(); out(2); }
-void i63() { incPC(); out(3); }
-void i64() { incPC(); out(4); }
-void i65() { incPC(); out(5); }
-void i66() { incPC(); out(6); }
-void i67() { incPC(); out(7); }
-void i68() { incPC(); badop("0x68"); }
-void i69() { incPC(); inp(9); }
-void i6a() { incPC(); inp(10); }
-void i6b() { incPC(); inp(11); }
-void i6c() { incPC(); inp(12); }
-void i6d() { incPC(); inp(13); }
-void i6e() { incPC(); inp(14); }
-void i6f() { incPC(); inp(15); }
-
-void i70() { incPC(); ret(); }
-void i71() { incPC(); dis(); }
-void i72() { incPC(); ldxa(); }
-void i73() { incPC(); stxd(); }
-void i74() { incPC(); adc(); }
-void i75() { incPC(); sdb(); }
-void i76() { incPC(); rshr(); }
-void i77() { incPC(); smb(); }
-void i78() { incPC(); sav(); }
-void i79() { incPC(); mark(); }
-void i7a() { incPC(); r.Q = 0; } /* REQ     Reset Q  7A */
-void i7b() { printf("\tSEQ\n"); incPC(); r.Q = 1; } /* SEQ     Set Q   7B */
-void i7c() { incPC(); adci(); }
-void i7d() { incPC(); sdbi(); }
-void i7e() { incPC(); rshl(); }
-void i7f() { incPC(); smbi(); }
-
-void i80() { incPC(); glo(0); }
-void i81() { incPC(); glo(1); }
-void i82() { incPC(); glo(2); }
-void i83() { incPC(); glo(3); }
-void i84() { incPC(); glo(4); }
-void i85() { incPC(); glo(5); }
-void i86() { incPC(); glo(6); }
-void i87() { incPC(); glo(7); }
-void i88() { incPC(); glo(8); }
-void i89() { incPC(); glo(9); }
-void i8a() { incPC(); glo(10); }
-void i8b() { incPC(); glo(11); }
-void i8c() { incPC(); glo(12); }
-void i8d() { incPC(); glo(13); }
-void i8e() { incPC(); glo(14); }
-void i8f() { incPC(); glo(15); }
-
-void i90() { incPC(); ghi(0); }
-void i91() { incPC(); ghi(1); }
-void i92() { incPC(); ghi(2); }
-void i93() { incPC(); ghi(3); }
-void i94() { incPC(); ghi(4); }
-void i95() { incPC(); ghi(5); }
-void i96() { incPC(); ghi(6); }
-void i97() { incPC(); ghi(7); }
-void i98() { incPC(); ghi(8); }
-void i99() { incPC(); ghi(9); }
-void i9a() { incPC(); ghi(10); }
-void i9b() { incPC(); ghi(11); }
-void i9c() { incPC(); ghi(12); }
-void i9d() { incPC(); ghi(13); }
-void i9e() { incPC(); ghi(14); }
-void i9f() { incPC(); ghi(15); }
-
-void ia0() { incPC(); plo(0); }
-void ia1() { incPC(); plo(1); }
-void ia2() { incPC(); plo(2); }
-void ia3() { incPC(); plo(3); }
-void ia4() { incPC(); plo(4); }
-void ia5() { incPC(); plo(5); }
-void ia6() { incPC(); plo(6); }
-void ia7() { incPC(); plo(7); }
-void ia8() { incPC(); plo(8); }
-void ia9() { incPC(); plo(9); }
-void iaa() { incPC(); plo(10); }
-void iab() { incPC(); plo(11); }
-void iac() { incPC(); plo(12); }
-void iad() { incPC(); plo(13); }
-void iae() { incPC(); plo(14); }
-void iaf() { incPC(); plo(15); }
-
-void ib0() { incPC(); phi(0); }
-void ib1() { incPC(); phi(1); }
-void ib2() { incPC(); phi(2); }
-void ib3() { incPC(); phi(3); }
-void ib4() { incPC(); phi(4); }
-void ib5() { incPC(); phi(5); }
-void ib6() { incPC(); phi(6); }
-void ib7() { incPC(); phi(7); }
-void ib8() { incPC(); phi(8); }
-void ib9() { incPC(); phi(9); }
-void iba() { incPC(); phi(10); }
-void ibb() { incPC(); phi(11); }
-void ibc() { incPC(); phi(12); }
-void ibd() { incPC(); phi(13); }
-void ibe() { incPC(); phi(14); }
-void ibf() { incPC(); phi(15); }
-
-void ic0() { incPC(); lbr(); }
-void ic1() { incPC(); lbq(); }
-void ic2() { incPC(); lbz(); }
-void ic3() { incPC(); lbdf(); }
-void ic4() { incPC(); } /* NOP     No Operation   C4 */
-void ic5() { incPC(); lsnq(); }
-void ic6() { incPC(); lsnz(); }
-void ic7() { incPC(); lsnf(); }
-void ic8() { printf("\tLSKP\n"); incPC(); incPC(); incPC(); } /* LSKP    Long Skip C8 */
-void ic9() { incPC(); lbnq(); }
-void ica() { incPC(); lbnz(); }
-void icb() { incPC(); lbnf(); }
-void icc() { incPC(); lsie(); }
-void icd() { incPC(); lsq(); }
-void ice() { incPC(); lsz(); }
-void icf() { incPC(); lsdf(); }
-
-void id0() { incPC(); sep(0); }
-void id1() { incPC(); sep(1); }
-void id2() { incPC(); sep(2); }
-void id3() { incPC(); sep(3); }
-void id4() { incPC(); sep(4); }
-void id5() { incPC(); sep(5); }
-void id6() { incPC(); sep(6); }
-void id7() { incPC(); sep(7); }
-void id8() { incPC(); sep(8); }
-void id9() { incPC(); sep(9); }
-void ida() { incPC(); sep(10); }
-void idb() { incPC(); sep(11); }
-void idc() { incPC(); sep(12); }
-void idd() { incPC(); sep(13); }
-void ide() { incPC(); sep(14); }
-void idf() { incPC(); sep(15); }
-
-void ie0() { incPC(); sex(0); }
-void ie1() { incPC(); sex(1); }
-void ie2() { incPC(); sex(2); }
-void ie3() { incPC(); sex(3); }
-void ie4() { incPC(); sex(4); }
-void ie5() { incPC(); sex(5); }
-void ie6() { incPC(); sex(6); }
-void ie7() { incPC(); sex(7); }
-void ie8() { incPC(); sex(8); }
-void ie9() { incPC(); sex(9); }
-void iea() { incPC(); sex(10); }
-void ieb() { incPC(); sex(11); }
-void iec() { incPC(); sex(12); }
-void ied() { incPC(); sex(13); }
-void iee() { incPC(); sex(14); }
-void ief() { incPC(); sex(15); }
-
-void if0() { incPC(); ldx(); }
-void if1() { incPC(); _or(); }
-void if2() { incPC(); _and(); }
-void if3() { incPC(); _xor(); }
-void if4() { incPC(); add(); }
-void if5() { incPC(); sd(); }
-void if6() { incPC(); shr(); }
-void if7() { incPC(); sm(); }
-void if8() { incPC(); ldi(); }
-void if9() { incPC(); ori(); }
-void ifa() { incPC(); ani(); }
-void ifb() { incPC(); xri(); }
-void ifc() { incPC(); adi(); }
-void ifd() { incPC(); sdi(); }
-void ife() { incPC(); shl(); }
-void iff() { incPC(); smi(); }
-
-
-typedef void (*fun)();
-fun Tabula[] =
-  {i00, i01, i02, i03, i04, i05, i06, i07,
-   i08, i09, i0a, i0b, i0c, i0d, i0e, i0f,
-   i10, i11, i12, i13, i14, i15, i16, i17,
-   i18, i19, i1a, i1b, i1c, i1d, i1e, i1f,
-   i20, i21, i22, i23, i24, i25, i26, i27,
-   i28, i29, i2a, i2b, i2c, i2d, i2e, i2f,
-   i30, i31, i32, i33, i34, i35, i36, i37,
-   i38, i39, i3a, i3b, i3c, i3d, i3e, i3f,
-   i40, i41, i42, i43, i44, i45, i46, i47,
-   i48, i49, i4a, i4b, i4c, i4d, i4e, i4f,
-   i50, i51, i52, i53, i54, i55, i56, i57,
-   i58, i59, i5a, i5b, i5c, i5d, i5e, i5f,
-   i60, i61, i62, i63, i64, i65, i66, i67,
-   i68, i69, i6a, i6b, i6c, i6d, i6e, i6f,
-   i70, i71, i72, i73, i74, i75, i76, i77,
-   i78, i79, i7a, i7b, i7c, i7d, i7e, i7f,
-   i80, i81, i82, i83, i84, i85, i86, i87,
-   i88, i89, i8a, i8b, i8c, i8d, i8e, i8f,
-   i90, i91, i92, i93, i94, i95, i96, i97,
-   i98, i99, i9a, i9b, i9c, i9d, i9e, i9f,
-   ia0, ia1, ia2, ia3, ia4, ia5, ia6, ia7,
-   ia8, ia9, iaa, iab, iac, iad, iae, iaf,
-   ib0, ib1, ib2, ib3, ib4, ib5, ib6, ib7,
-   ib8, ib9, iba, ibb, ibc, ibd, ibe, ibf,
-   ic0, ic1, ic2, ic3, ic4, ic5, ic6, ic7,
-   ic8, ic9, ica, icb, icc, icd, ice, icf,
-   id0, id1, id2, id3, id4, id5, id6, id7,
-   id8, id9, ida, idb, idc, idd, ide, idf,
-   ie0, ie1, ie2, ie3, ie4, ie5, ie6, ie7,
-   ie8, ie9, iea, ieb, iec, ied, iee, ief,
-   if0, if1, if2, if3, if4, if5, if6, if7,
-   if8, if9, ifa, ifb, ifc, ifd, ife, iff};
+void badop(const char *s) {
+  if (!cpu_quiet) printf("Opcode not implemented: '%s'.\n", s);
+}
 
 
-void cpu_cycle() {
+
+/* Opcode OP, with its register or port number known at compile time.
+   M is the memory model and T the trace policy (see above); the
+   defaults are what Tabula uses, which is right whatever is switched
+   on. */
+template <uint8_t OP, class M = mem_hooked, class T = traced>
+void op() {
+  const uint8_t k = OP & 0x0F;
+
+  incPC();
+  switch (OP >> 4) {
+  case 0x0:
+    if (k) ldn<M>(k);
+    else r.IDLE = 1;                    /* IDL */
+    break;
+  case 0x1: inc(k); break;
+  case 0x2: dec(k); break;
+  case 0x3:
+    switch (OP) {
+    case 0x30: br(); break;
+    case 0x31: bq(); break;
+    case 0x32: bz(); break;
+    case 0x33: bdf(); break;
+    case 0x34: b1(); break;
+    case 0x35: b2(); break;
+    case 0x36: b3(); break;
+    case 0x37: b4(); break;
+    case 0x38: incPC(); break;          /* SKP     Skip one byte   38 */
+    case 0x39: bnq(); break;
+    case 0x3A: bnz(); break;
+    case 0x3B: bnf(); break;
+    case 0x3C: bn1(); break;
+    case 0x3D: bn2(); break;
+    case 0x3E: bn3(); break;
+    case 0x3F: bn4(); break;
+    }
+    break;
+  case 0x4: lda<M>(k); break;
+  case 0x5: str<M>(k); break;
+  case 0x6:
+    if (k == 0) irx();
+    else if (k < 8) out<M, T>(k);
+    else if (k == 8) badop("0x68");
+    else inp<M, T>(k);
+    break;
+  case 0x7:
+    switch (OP) {
+    case 0x70: ret<M>(); break;
+    case 0x71: dis<M>(); break;
+    case 0x72: ldxa<M>(); break;
+    case 0x73: stxd<M>(); break;
+    case 0x74: adc<M>(); break;
+    case 0x75: sdb<M>(); break;
+    case 0x76: rshr(); break;
+    case 0x77: smb<M>(); break;
+    case 0x78: sav<M>(); break;
+    case 0x79: mark<M>(); break;
+    case 0x7A: q_out(0); break;         /* REQ     Reset Q  7A */
+    case 0x7B: q_out(1); break;         /* SEQ     Set Q   7B */
+    case 0x7C: adci(); break;
+    case 0x7D: sdbi(); break;
+    case 0x7E: rshl(); break;
+    case 0x7F: smbi(); break;
+    }
+    break;
+  case 0x8: glo(k); break;
+  case 0x9: ghi(k); break;
+  case 0xA: plo(k); break;
+  case 0xB: phi(k); break;
+  case 0xC:
+    switch (OP) {
+    case 0xC0: lbr(); break;
+    case 0xC1: lbq(); break;
+    case 0xC2: lbz(); break;
+    case 0xC3: lbdf(); break;
+    case 0xC4: break;                   /* NOP     No Operation   C4 */
+    case 0xC5: lsnq(); break;
+    case 0xC6: lsnz(); break;
+    case 0xC7: lsnf(); break;
+    case 0xC8: incPC(); incPC(); break; /* LSKP    Long Skip C8 */
+    case 0xC9: lbnq(); break;
+    case 0xCA: lbnz(); break;
+    case 0xCB: lbnf(); break;
+    case 0xCC: lsie(); break;
+    case 0xCD: lsq(); break;
+    case 0xCE: lsz(); break;
+    case 0xCF: lsdf(); break;
+    }
+    break;
+  case 0xD: sep(k); break;
+  case 0xE: sex(k); break;
+  case 0xF:
+    switch (OP) {
+    case 0xF0: ldx<M>(); break;
+    case 0xF1: _or<M>(); break;
+    case 0xF2: _and<M>(); break;
+    case 0xF3: _xor<M>(); break;
+    case 0xF4: add<M>(); break;
+    case 0xF5: sd<M>(); break;
+    case 0xF6: shr(); break;
+    case 0xF7: sm<M>(); break;
+    case 0xF8: ldi(); break;
+    case 0xF9: ori(); break;
+    case 0xFA: ani(); break;
+    case 0xFB: xri(); break;
+    case 0xFC: adi(); break;
+    case 0xFD: sdi(); break;
+    case 0xFE: shl(); break;
+    case 0xFF: smi(); break;
+    }
+    break;
+  }
+}
+
+
+cpu_op Tabula[] =
+  {{op<0x00>, "IDL", OPF_NONE}, {op<0x01>, "LDN", OPF_REG}, {op<0x02>, "LDN", OPF_REG}, {op<0x03>, "LDN", OPF_REG},
+   {op<0x04>, "LDN", OPF_REG}, {op<0x05>, "LDN", OPF_REG}, {op<0x06>, "LDN", OPF_REG}, {op<0x07>, "LDN", OPF_REG},
+   {op<0x08>, "LDN", OPF_REG}, {op<0x09>, "LDN", OPF_REG}, {op<0x0A>, "LDN", OPF_REG}, {op<0x0B>, "LDN", OPF_REG},
+   {op<0x0C>, "LDN", OPF_REG}, {op<0x0D>, "LDN", OPF_REG}, {op<0x0E>, "LDN", OPF_REG}, {op<0x0F>, "LDN", OPF_REG},
+   {op<0x10>, "INC", OPF_REG}, {op<0x11>, "INC", OPF_REG}, {op<0x12>, "INC", OPF_REG}, {op<0x13>, "INC", OPF_REG},
+   {op<0x14>, "INC", OPF_REG}, {op<0x15>, "INC", OPF_REG}, {op<0x16>, "INC", OPF_REG}, {op<0x17>, "INC", OPF_REG},
+   {op<0x18>, "INC", OPF_REG}, {op<0x19>, "INC", OPF_REG}, {op<0x1A>, "INC", OPF_REG}, {op<0x1B>, "INC", OPF_REG},
+   {op<0x1C>, "INC", OPF_REG}, {op<0x1D>, "INC", OPF_REG}, {op<0x1E>, "INC", OPF_REG}, {op<0x1F>, "INC", OPF_REG},
+   {op<0x20>, "DEC", OPF_REG}, {op<0x21>, "DEC", OPF_REG}, {op<0x22>, "DEC", OPF_REG}, {op<0x23>, "DEC", OPF_REG},
+   {op<0x24>, "DEC", OPF_REG}, {op<0x25>, "DEC", OPF_REG}, {op<0x26>, "DEC", OPF_REG}, {op<0x27>, "DEC", OPF_REG},
+   {op<0x28>, "DEC", OPF_REG}, {op<0x29>, "DEC", OPF_REG}, {op<0x2A>, "DEC", OPF_REG}, {op<0x2B>, "DEC", OPF_REG},
+   {op<0x2C>, "DEC", OPF_REG}, {op<0x2D>, "DEC", OPF_REG}, {op<0x2E>, "DEC", OPF_REG}, {op<0x2F>, "DEC", OPF_REG},
+   {op<0x30>, "BR", OPF_SHORT}, {op<0x31>, "BQ", OPF_SHORT}, {op<0x32>, "BZ", OPF_SHORT}, {op<0x33>, "BDF", OPF_SHORT},
+   {op<0x34>, "B1", OPF_SHORT}, {op<0x35>, "B2", OPF_SHORT}, {op<0x36>, "B3", OPF_SHORT}, {op<0x37>, "B4", OPF_SHORT},
+   {op<0x38>, "SKP", OPF_NONE}, {op<0x39>, "BNQ", OPF_SHORT}, {op<0x3A>, "BNZ", OPF_SHORT}, {op<0x3B>, "BNF", OPF_SHORT},
+   {op<0x3C>, "BN1", OPF_SHORT}, {op<0x3D>, "BN2", OPF_SHORT}, {op<0x3E>, "BN3", OPF_SHORT}, {op<0x3F>, "BN4", OPF_SHORT},
+   {op<0x40>, "LDA", OPF_REG}, {op<0x41>, "LDA", OPF_REG}, {op<0x42>, "LDA", OPF_REG}, {op<0x43>, "LDA", OPF_REG},
+   {op<0x44>, "LDA", OPF_REG}, {op<0x45>, "LDA", OPF_REG}, {op<0x46>, "LDA", OPF_REG}, {op<0x47>, "LDA", OPF_REG},
+   {op<0x48>, "LDA", OPF_REG}, {op<0x49>, "LDA", OPF_REG}, {op<0x4A>, "LDA", OPF_REG}, {op<0x4B>, "LDA", OPF_REG},
+   {op<0x4C>, "LDA", OPF_REG}, {op<0x4D>, "LDA", OPF_REG}, {op<0x4E>, "LDA", OPF_REG}, {op<0x4F>, "LDA", OPF_REG},
+   {op<0x50>, "STR", OPF_REG}, {op<0x51>, "STR", OPF_REG}, {op<0x52>, "STR", OPF_REG}, {op<0x53>, "STR", OPF_REG},
+   {op<0x54>, "STR", OPF_REG}, {op<0x55>, "STR", OPF_REG}, {op<0x56>, "STR", OPF_REG}, {op<0x57>, "STR", OPF_REG},
+   {op<0x58>, "STR", OPF_REG}, {op<0x59>, "STR", OPF_REG}, {op<0x5A>, "STR", OPF_REG}, {op<0x5B>, "STR", OPF_REG},
+   {op<0x5C>, "STR", OPF_REG}, {op<0x5D>, "STR", OPF_REG}, {op<0x5E>, "STR", OPF_REG}, {op<0x5F>, "STR", OPF_REG},
+   {op<0x60>, "IRX", OPF_NONE}, {op<0x61>, "OUT", OPF_PORT}, {op<0x62>, "OUT", OPF_PORT}, {op<0x63>, "OUT", OPF_PORT},
+   {op<0x64>, "OUT", OPF_PORT}, {op<0x65>, "OUT", OPF_PORT}, {op<0x66>, "OUT", OPF_PORT}, {op<0x67>, "OUT", OPF_PORT},
+   {op<0x68>, "???", OPF_NONE}, {op<0x69>, "INP", OPF_PORT}, {op<0x6A>, "INP", OPF_PORT}, {op<0x6B>, "INP", OPF_PORT},
+   {op<0x6C>, "INP", OPF_PORT}, {op<0x6D>, "INP", OPF_PORT}, {op<0x6E>, "INP", OPF_PORT}, {op<0x6F>, "INP", OPF_PORT},
+   {op<0x70>, "RET", OPF_NONE}, {op<0x71>, "DIS", OPF_NONE}, {op<0x72>, "LDXA", OPF_NONE}, {op<0x73>, "STXD", OPF_NONE},
+   {op<0x74>, "ADC", OPF_NONE}, {op<0x75>, "SDB", OPF_NONE}, {op<0x76>, "SHRC", OPF_NONE}, {op<0x77>, "SMB", OPF_NONE},
+   {op<0x78>, "SAV", OPF_NONE}, {op<0x79>, "MARK", OPF_NONE}, {op<0x7A>, "REQ", OPF_NONE}, {op<0x7B>, "SEQ", OPF_NONE},
+   {op<0x7C>, "ADCI", OPF_IMM}, {op<0x7D>, "SDBI", OPF_IMM}, {op<0x7E>, "SHLC", OPF_NONE}, {op<0x7F>, "SMBI", OPF_IMM},
+   {op<0x80>, "GLO", OPF_REG}, {op<0x81>, "GLO", OPF_REG}, {op<0x82>, "GLO", OPF_REG}, {op<0x83>, "GLO", OPF_REG},
+   {op<0x84>, "GLO", OPF_REG}, {op<0x85>, "GLO", OPF_REG}, {op<0x86>, "GLO", OPF_REG}, {op<0x87>, "GLO", OPF_REG},
+   {op<0x88>, "GLO", OPF_REG}, {op<0x89>, "GLO", OPF_REG}, {op<0x8A>, "GLO", OPF_REG}, {op<0x8B>, "GLO", OPF_REG},
+   {op<0x8C>, "GLO", OPF_REG}, {op<0x8D>, "GLO", OPF_REG}, {op<0x8E>, "GLO", OPF_REG}, {op<0x8F>, "GLO", OPF_REG},
+   {op<0x90>, "GHI", OPF_REG}, {op<0x91>, "GHI", OPF_REG}, {op<0x92>, "GHI", OPF_REG}, {op<0x93>, "GHI", OPF_REG},
+   {op<0x94>, "GHI", OPF_REG}, {op<0x95>, "GHI", OPF_REG}, {op<0x96>, "GHI", OPF_REG}, {op<0x97>, "GHI", OPF_REG},
+   {op<0x98>, "GHI", OPF_REG}, {op<0x99>, "GHI", OPF_REG}, {op<0x9A>, "GHI", OPF_REG}, {op<0x9B>, "GHI", OPF_REG},
+   {op<0x9C>, "GHI", OPF_REG}, {op<0x9D>, "GHI", OPF_REG}, {op<0x9E>, "GHI", OPF_REG}, {op<0x9F>, "GHI", OPF_REG},
+   {op<0xA0>, "PLO", OPF_REG}, {op<0xA1>, "PLO", OPF_REG}, {op<0xA2>, "PLO", OPF_REG}, {op<0xA3>, "PLO", OPF_REG},
+   {op<0xA4>, "PLO", OPF_REG}, {op<0xA5>, "PLO", OPF_REG}, {op<0xA6>, "PLO", OPF_REG}, {op<0xA7>, "PLO", OPF_REG},
+   {op<0xA8>, "PLO", OPF_REG}, {op<0xA9>, "PLO", OPF_REG}, {op<0xAA>, "PLO", OPF_REG}, {op<0xAB>, "PLO", OPF_REG},
+   {op<0xAC>, "PLO", OPF_REG}, {op<0xAD>, "PLO", OPF_REG}, {op<0xAE>, "PLO", OPF_REG}, {op<0xAF>, "PLO", OPF_REG},
+   {op<0xB0>, "PHI", OPF_REG}, {op<0xB1>, "PHI", OPF_REG}, {op<0xB2>, "PHI", OPF_REG}, {op<0xB3>, "PHI", OPF_REG},
+   {op<0xB4>, "PHI", OPF_REG}, {op<0xB5>, "PHI", OPF_REG}, {op<0xB6>, "PHI", OPF_REG}, {op<0xB7>, "PHI", OPF_REG},
+   {op<0xB8>, "PHI", OPF_REG}, {op<0xB9>, "PHI", OPF_REG}, {op<0xBA>, "PHI", OPF_REG}, {op<0xBB>, "PHI", OPF_REG},
+   {op<0xBC>, "PHI", OPF_REG}, {op<0xBD>, "PHI", OPF_REG}, {op<0xBE>, "PHI", OPF_REG}, {op<0xBF>, "PHI", OPF_REG},
+   {op<0xC0>, "LBR", OPF_LONG}, {op<0xC1>, "LBQ", OPF_LONG}, {op<0xC2>, "LBZ", OPF_LONG}, {op<0xC3>, "LBDF", OPF_LONG},
+   {op<0xC4>, "NOP", OPF_NONE}, {op<0xC5>, "LSNQ", OPF_NONE}, {op<0xC6>, "LSNZ", OPF_NONE}, {op<0xC7>, "LSNF", OPF_NONE},
+   {op<0xC8>, "LSKP", OPF_NONE}, {op<0xC9>, "LBNQ", OPF_LONG}, {op<0xCA>, "LBNZ", OPF_LONG}, {op<0xCB>, "LBNF", OPF_LONG},
+   {op<0xCC>, "LSIE", OPF_NONE}, {op<0xCD>, "LSQ", OPF_NONE}, {op<0xCE>, "LSZ", OPF_NONE}, {op<0xCF>, "LSDF", OPF_NONE},
+   {op<0xD0>, "SEP", OPF_REG}, {op<0xD1>, "SEP", OPF_REG}, {op<0xD2>, "SEP", OPF_REG}, {op<0xD3>, "SEP", OPF_REG},
+   {op<0xD4>, "SEP", OPF_REG}, {op<0xD5>, "SEP", OPF_REG}, {op<0xD6>, "SEP", OPF_REG}, {op<0xD7>, "SEP", OPF_REG},
+   {op<0xD8>, "SEP", OPF_REG}, {op<0xD9>, "SEP", OPF_REG}, {op<0xDA>, "SEP", OPF_REG}, {op<0xDB>, "SEP", OPF_REG},
+   {op<0xDC>, "SEP", OPF_REG}, {op<0xDD>, "SEP", OPF_REG}, {op<0xDE>, "SEP", OPF_REG}, {op<0xDF>, "SEP", OPF_REG},
+   {op<0xE0>, "SEX", OPF_REG}, {op<0xE1>, "SEX", OPF_REG}, {op<0xE2>, "SEX", OPF_REG}, {op<0xE3>, "SEX", OPF_REG},
+   {op<0xE4>, "SEX", OPF_REG}, {op<0xE5>, "SEX", OPF_REG}, {op<0xE6>, "SEX", OPF_REG}, {op<0xE7>, "SEX", OPF_REG},
+   {op<0xE8>, "SEX", OPF_REG}, {op<0xE9>, "SEX", OPF_REG}, {op<0xEA>, "SEX", OPF_REG}, {op<0xEB>, "SEX", OPF_REG},
+   {op<0xEC>, "SEX", OPF_REG}, {op<0xED>, "SEX", OPF_REG}, {op<0xEE>, "SEX", OPF_REG}, {op<0xEF>, "SEX", OPF_REG},
+   {op<0xF0>, "LDX", OPF_NONE}, {op<0xF1>, "OR", OPF_NONE}, {op<0xF2>, "AND", OPF_NONE}, {op<0xF3>, "XOR", OPF_NONE},
+   {op<0xF4>, "ADD", OPF_NONE}, {op<0xF5>, "SD", OPF_NONE}, {op<0xF6>, "SHR", OPF_NONE}, {op<0xF7>, "SM", OPF_NONE},
+   {op<0xF8>, "LDI", OPF_IMM}, {op<0xF9>, "ORI", OPF_IMM}, {op<0xFA>, "ANI", OPF_IMM}, {op<0xFB>, "XRI", OPF_IMM},
+   {op<0xFC>, "ADI", OPF_IMM}, {op<0xFD>, "SDI", OPF_IMM}, {op<0xFE>, "SHL", OPF_NONE}, {op<0xFF>, "SMI", OPF_IMM}};
+
+
+/* Trace level: 0 = silent, 1 = disassembly, 2 = disassembly + registers */
+int trace = 0;
+
+/* Instrumentation switched on at run time (HOOK_*) */
+unsigned int cpu_hooks = 0;
+
+/* Run the idioms in fuse.h as single operations */
+int cpu_fuse = 0;
+
+/* Run the ROM's ahead-of-time translation (aot.h) where there is one */
+int cpu_aot = 0;
+
+/* Say nothing about the program, for embedders that own stdout (cyemu.h) */
+int cpu_quiet = 0;
+
+/* Machine cycles since reset */
+uint64_t cpu_cycles = 0;
+
+/* Interrupts taken since reset */
+uint64_t cpu_interrupts = 0;
+
+/* Writes the ROM ignored since reset */
+uint64_t rom_writes = 0;
+
+/* Since the program started */
+cpu_stats totals;
+
+
+void trace_insn() {
+  char line[DIS_MAX];
+  const char *label = dis_label(PC());
+  if (label) printf("%s:\n", label);
+  dis_insn(PC(), line);
+  printf("%s\n", line);
+}
+
+
+void trace_regs() {
   int i;
-  uint8_t code;
-  code = memPcOut();
-  //printf("Single Step:\n\n");
-  printf("%.4x:  %.2x  ", PC(), code);
-  Tabula[code]();
-//#ifdef moo
-  printf("\n");
   printf("Halt Address = %.4xh (%d)\n", PC(), PC());
   printf("D = %.2xh (%d)\n", r.D, r.D);
   printf("DF/Carry = %d\n", r.DF);
@@ -1125,15 +1097,80 @@ void cpu_cycle() {
   }
 
   printf("\n");
-//#endif  
-/*
-  printf("-----------------------------------------------------------------------------------------------------\n");
-  printf("CYCLE: PC=%.4x CODE=%x D=%x DF=%d B=%x P=%d X=%d I=%x N=%x T=%x IE=%d Q=%d \n",
-	 PC(), code, r.D, r.DF, r.B, r.P, r.X, r.I, r.N, r.T, r.IE, r.Q);
-  printf("R0=%x R1=%x R2=%x R3=%x R4=%x R5=%x R6=%x R7=%x\nR8=%x R9=%x RA=%x RB=%x RC=%x RD=%x RE=%x RF=%x\n",
-	 r.R[0], r.R[1], r.R[2], r.R[3], r.R[4], r.R[5], r.R[6], r.R[7],
-	 r.R[8], r.R[9], r.R[10], r.R[11], r.R[12], r.R[13], r.R[14], r.R[15]);
-  */
+}
+
+
+/* Timing: the 1802's two or three machine cycles per instruction */
+struct cycles_1802 {
+  static void insn(int cycles) {
+    cpu_cycles += cycles;
+    totals.insns++;
+    totals.cycles += cycles;
+  }
+};
+
+
+/* A configuration of the core: trace policy, memory model and timing */
+template <class T, class M, class C>
+struct core {
+  typedef T trace;
+  typedef M memory;
+  typedef C timing;
+};
+
+/* For when trace or cpu_hooks are on, and for when they are all off */
+typedef core<traced, mem_hooked, cycles_1802> core_checked;
+typedef core<untraced, mem_plain, cycles_1802> core_fast;
+
+
+/* Opcode OP and its timing, for core K */
+template <uint8_t OP, class K>
+void exec() {
+  op<OP, typename K::memory, typename K::trace>();
+  K::timing::insn(OP_CYCLES(OP));
+}
+
+
+template <class K, size_t... OP>
+constexpr std::array<void (*)(), 256> exec_table(std::index_sequence<OP...>) {
+  return {{exec<OP, K>...}};
+}
+
+/* The 256 handlers of core K, generated at compile time */
+template <class K>
+constexpr std::array<void (*)(), 256> handlers = exec_table<K>(std::make_index_sequence<256>());
+
+
+template <class K>
+static void step(uint16_t pc) {
+  uint8_t code = mem_fetch(pc);
+  if (K::trace::on && trace) trace_insn();
+  handlers<K>[code]();
+  if (K::trace::on && cpu_hooks) {
+    if (cpu_hooks & HOOK_PROFILE) prof_insn(pc, code);
+    if (cpu_hooks & HOOK_COVER) cov_exec(pc, code);
+    if (cpu_hooks & HOOK_NGRAM) prof_ngram(pc, code);
+  }
+  if (io.INT && r.IE) cpu_interrupt();
+  if (K::trace::on && trace > 1) trace_regs();
+}
+
+
+void cpu_cycle() {
+  uint16_t pc;
+  if (r.IDLE) {
+    /* IDL repeats its execute cycle until an interrupt arrives */
+    cpu_cycles++;
+    totals.cycles++;
+    totals.idle_cycles++;
+    if (io.INT && r.IE) cpu_interrupt();
+    return;
+  }
+  pc = PC();
+  if (cpu_aot && aot_cycle(pc)) return;
+  if (cpu_fuse && fuse_cycle(pc)) return;
+  if (trace || cpu_hooks) step<core_checked>(pc);
+  else step<core_fast>(pc);
 }
 
 
@@ -1142,26 +1179,102 @@ void cpu_reset() {
   r.N = 0;
   r.Q = 0;
   r.IE = 1; /* Enable interrupts */
+  r.IDLE = 0;
   bus = 0;
   r.X = 0;
   r.P = 0;
   r.R[0] = 0;
-}
-
-
+  cpu_cycles = 0;
+  cpu_interrupts = 0;
+  rom_writes = 0;
+  lcd_reset();
+}
+
+
+void cpu_pack(const cpu_regs *from, cpu_regs_packed *to) {
+  memcpy(to->R, from->R, sizeof(to->R));
+  to->D = from->D;
+  to->B = from->B;
+  to->T = from->T;
+  to->DF = from->DF;
+  to->IE = from->IE;
+  to->Q = from->Q;
+  to->IDLE = from->IDLE;
+  to->P = from->P;
+  to->X = from->X;
+  to->N = from->N;
+  to->I = from->I;
+}
+
+
+void cpu_unpack(const cpu_regs_packed *from, cpu_regs *to) {
+  memcpy(to->R, from->R, sizeof(to->R));
+  to->D = from->D;
+  to->B = from->B;
+  to->T = from->T;
+  to->DF = from->DF;
+  to->IE = from->IE;
+  to->Q = from->Q;
+  to->IDLE = from->IDLE;
+  to->P = from->P;
+  to->X = from->X;
+  to->N = from->N;
+  to->I = from->I;
+}
+
+
+void cpu_save(cpu_snapshot *s) {
+  cpu_pack(&r, &s->r);
+  s->io = io;
+  s->bus = bus;
+  totals.snapshots++;
+  s->cycles = cpu_cycles;
+  s->interrupts = cpu_interrupts;
+  s->lcd = lcd;
+  memcpy(s->mem, mem, MEM_BYTES);
+}
+
+
+void cpu_restore(const cpu_snapshot *s) {
+  cpu_unpack(&s->r, &r);
+  io = s->io;
+  bus = s->bus;
+  totals.snapshots++;
+  cpu_cycles = s->cycles;
+  cpu_interrupts = s->interrupts;
+  rom_writes = 0;
+  lcd = s->lcd;
+  memcpy(mem, s->mem, MEM_BYTES);
+  mem_touch_all();
+}
+
+
+/* Mapped rather than malloc'ed, so that nvram_open() can put a file
+   under the RAM pages; the pages start out cleared */
 void ram_init() {
-  int i;
-  mem = (uint8_t *)malloc(MEM_BYTES);
-  if (!mem) {
+  mem = (uint8_t *)mmap(NULL, MEM_BYTES, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
     fprintf(stderr, "Couldn't allocate memory!\n");
     exit(EXIT_FAILURE);
   }
-  for (i = 0; i < MEM_BYTES; i++) mem[i] = 0;
+  mem_touch_all();
+}
+
+
+/* Where nothing is decoded the data bus floats high. The firmware
+   counts on that: a byte other than FF at FFFF is an extension ROM,
+   whose table it then takes commands from (0D63). Writes there aren't
+   checked for; the firmware makes none. */
+void mem_unmapped() {
+  memset(mem + ROM_BYTES, 0xFF, RAM_START - ROM_BYTES);
+  memset(mem + RAM_END, 0xFF, MEM_BYTES - RAM_END);
+  mem_touch_all();
 }
 
 
 void ram_free() {
-  free(mem);
+  munmap(mem, MEM_BYTES);
 }
 
 
@@ -1184,6 +1297,7 @@ void load_rom(char *filename) {
       exit(1);
     }
     fclose(f);
+    mem_unmapped();
     printf("Loaded ROM image \"%s\" (%d bytes.)\n", filename, result);
   }
 }
@@ -5,61 +5,170 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include "lcd.h"
+
 
 typedef struct _io {
   unsigned int EF1 : 1;
   unsigned int EF2 : 1;
   unsigned int EF3 : 1;
   unsigned int EF4 : 1;
+
+  /* Interrupt request line */
+  unsigned int INT : 1;
+
+  /* Input port latches, read by INP 1..7 */
+  uint8_t IN[8];
 } cpu_io;
 
 
+/* The registers as the interpreter keeps them: a whole byte per field,
+   so that SEP, SEX and flag updates are plain stores, and the 16 bit
+   registers first so that PC() is a single indexed load. The lot fits
+   in one cache line, and r is aligned to one. */
 typedef struct _cpu_regs {
+  /* 1..16 Scratchpad Registers */
+  uint16_t R[16];
+
   /* Data Register (Accumulator) */
   uint8_t D;
 
-  /* Data Flag (ALU Carry) */
-  unsigned int DF : 1;
-  //uint8_t DF;
+  /* Data Flag (ALU Carry), 0 or 1 */
+  uint8_t DF;
 
   /* Auxiliary Holding Register */
   uint8_t B;
 
-  /* 1..16 Scratchpad Registers */
-  uint16_t R[16];
-
-  /* Designates which register is Program Counter */
-  unsigned int P : 4;
-  //uint8_t P;
+  /* Designates which register is Program Counter, 0..15 */
+  uint8_t P;
 
-  /* Designates which register is Data Pointer */
-  unsigned int X : 4;
-  //uint8_t X;
+  /* Designates which register is Data Pointer, 0..15 */
+  uint8_t X;
 
   /* Holds Low-Order Instruction Digit */
-  unsigned int N : 4;
-  //uint8_t N;
+  uint8_t N;
 
   /* Holds High-Order Instruction Digit */
-  unsigned int I : 4;
-  //uint8_t I;
+  uint8_t I;
 
   /* Holds old X, P after Interrupt (X is high nibble) */
   uint8_t T;
 
-  /* Interrupt Enable */
-  unsigned int IE : 1;
-  //uint8_t IE;
+  /* Interrupt Enable, 0 or 1 */
+  uint8_t IE;
 
-  /* Output Flip-Flop */
-  unsigned int Q : 1;
-  //uint8_t Q;
+  /* Output Flip-Flop, 0 or 1 */
+  uint8_t Q;
+
+  /* Stopped by IDL, waiting for an interrupt */
+  uint8_t IDLE;
 } cpu_regs;
 
 
+/* The same registers packed down, for snapshots */
+typedef struct _cpu_regs_packed {
+  uint16_t R[16];
+  uint8_t D;
+  uint8_t B;
+  uint8_t T;
+  unsigned int DF : 1;
+  unsigned int IE : 1;
+  unsigned int Q : 1;
+  unsigned int IDLE : 1;
+  unsigned int P : 4;
+  unsigned int X : 4;
+  unsigned int N : 4;
+  unsigned int I : 4;
+} cpu_regs_packed;
+
+
+/* Operand formats, as seen by the disassembler */
+#define OPF_NONE        0 /* No operand */
+#define OPF_REG         1 /* Register number in N */
+#define OPF_PORT        2 /* I/O port number in N */
+#define OPF_IMM         3 /* One immediate byte */
+#define OPF_SHORT       4 /* Short branch: low byte of target in same page */
+#define OPF_LONG        5 /* Long branch: 16-bit target */
+
+/* One opcode: its handler, and what the disassembler needs to know */
+typedef struct _cpu_op {
+  void (*fn)();
+  const char *name;
+  uint8_t fmt;
+} cpu_op;
+
+
+/* Memory is tracked for changes in pages of this many bytes */
+#define MEM_PAGE_SHIFT          8
+#define MEM_PAGES               (MEM_BYTES >> MEM_PAGE_SHIFT)
+
+/* Machine cycles per opcode: long branches, long skips and NOP take three */
+#define OP_CYCLES(code)         ((((code) & 0xF0) == 0xC0) ? 3 : 2)
+
+/* Per-instruction instrumentation, enabled by bits in cpu_hooks */
+#define HOOK_PROFILE            0x01
+#define HOOK_COVER              0x02
+#define HOOK_NGRAM              0x04
+
+
+/* Everything needed to put the machine back exactly as it was */
+typedef struct _cpu_snapshot {
+  cpu_regs_packed r;
+  cpu_io io;
+  uint8_t bus;
+  uint64_t cycles;
+  uint64_t interrupts;
+  lcd_state lcd;
+  uint8_t mem[MEM_BYTES];
+} cpu_snapshot;
+
+
+/* Running totals for monitoring. Unlike cpu_cycles these are never reset
+   or restored from a snapshot, so they only ever go up. */
+typedef struct _cpu_stats {
+  uint64_t insns;
+  uint64_t cycles;
+  uint64_t idle_cycles;
+  uint64_t interrupts;
+  uint64_t io_events;
+  uint64_t snapshots;
+} cpu_stats;
+
+
+extern cpu_op Tabula[];
+extern const char cpu_build[];
+extern int trace;
+extern unsigned int cpu_hooks;
+extern int cpu_fuse;
+extern int cpu_aot;
+extern int cpu_quiet;
+extern uint64_t cpu_cycles;
+extern uint64_t cpu_interrupts;
+extern uint64_t rom_writes;
+extern cpu_stats totals;
+extern uint8_t *mem;
+extern uint8_t mem_dirty[MEM_PAGES];
+extern uint8_t bus;
+extern cpu_regs r;
+extern cpu_io io;
+
+uint16_t PC();
+void setPC(uint16_t data);
+uint8_t mem_fetch(uint16_t addr);
+void mem_poke(uint16_t addr, uint8_t data);
+uint8_t mem_read(uint16_t addr);
+void mem_write(uint16_t addr, uint8_t data);
+void mem_touch_all();
+
 void cpu_reset();
 void cpu_cycle();
+void cpu_interrupt();
+void cpu_pack(const cpu_regs *from, cpu_regs_packed *to);
+void cpu_unpack(const cpu_regs_packed *from, cpu_regs *to);
+void cpu_save(cpu_snapshot *s);
+void cpu_restore(const cpu_snapshot *s);
 void ram_init();
+void mem_unmapped();
 void ram_free();
 void load_rom(char *filename);
 
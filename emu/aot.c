@@ -0,0 +1,46 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "aot.h"
+
+#include <string.h>
+
+const aot_image *aot_rom = NULL;
+uint64_t aot_insns;
+
+
+int aot_register(const aot_image *image) {
+  aot_rom = image;
+  return 1;
+}
+
+
+int aot_start() {
+  if (aot_rom == NULL || memcmp(mem, aot_rom->rom, ROM_BYTES)) return 0;
+  aot_insns = 0;
+  cpu_aot = 1;
+  return 1;
+}
+
+
+void aot_stop() {
+  cpu_aot = 0;
+}
+
+
+int aot_cycle(uint16_t pc) {
+  aot_run run;
+  uint32_t result;
+
+  if (pc >= ROM_BYTES || (run = aot_rom->run[pc]) == NULL) return 0;
+  /* Translated code only checks for interrupts at its end */
+  if (trace || cpu_hooks || (io.INT && r.IE)) return 0;
+
+  result = run(pc);
+  aot_insns += result >> 16;
+  cpu_cycles += result & 0xFFFF;
+  totals.insns += result >> 16;
+  totals.cycles += result & 0xFFFF;
+  /* RET may have just enabled interrupts */
+  if (io.INT && r.IE) cpu_interrupt();
+  return 1;
+}
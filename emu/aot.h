@@ -0,0 +1,54 @@
+#ifndef _aot_h_
+#define _aot_h_
+
+#include "mwemu.h"
+
+/*
+  Ahead-of-time translation of the ROM into C.
+
+  mwaot follows the ROM's control flow from the reset address, branch
+  and skip targets, the return points of SEP calls (including SCRT
+  calls with their inline target) and 16 bit constants that point into
+  the ROM. Each straight-line run of the instructions it reaches
+  becomes a C function with an entry label per instruction, ending at
+  the next branch, skip, SEP, IDL or RET/DIS. "make aot" compiles that
+  into mwemu-aot and mwbench-aot, where it registers itself with
+  aot_register() when the program starts.
+
+  With aot_start(), cpu_cycle() runs a whole run from the current PC,
+  with the same results as interpreting it. It leaves the interpreter
+  to it where it can't be sure of that: code the translator didn't
+  reach, trace or cpu_hooks being on, a pending interrupt, and after
+  an instruction that changes the program counter's register when the
+  translation assumed it would not (INC R3 while P is 3, for example).
+  As with fusion, a step may run several instructions.
+*/
+
+/* A translated run: enter at pc, return AOT_RESULT(instructions, cycles) */
+typedef uint32_t (*aot_run)(uint16_t pc);
+
+#define AOT_RESULT(insns, cycles)  ((uint32_t)(insns) << 16 | (cycles))
+
+typedef struct _aot_image {
+  /* The ROM it was translated from, and the run each address is in */
+  const uint8_t *rom;
+  aot_run run[ROM_BYTES];
+} aot_image;
+
+/* The translation linked into this program, or NULL */
+extern const aot_image *aot_rom;
+
+/* Instructions run translated since aot_start() */
+extern uint64_t aot_insns;
+
+int aot_register(const aot_image *image);
+
+/* Returns 0 if there is no translation, or it is of a different ROM */
+int aot_start();
+void aot_stop();
+
+/* Called by cpu_cycle() while translating: runs translated code at pc
+   if there is some, returning 1, else 0 */
+int aot_cycle(uint16_t pc);
+
+#endif
@@ -0,0 +1,219 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "beep.h"
+
+#include <string.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+
+/* Band-limited step: half its width in samples, and table steps per
+   sample */
+#define HALF_WIDTH              8
+#define OVERSAMPLE              64
+#define STEP_POINTS             (2 * HALF_WIDTH * OVERSAMPLE + 1)
+
+/* Samples in flight: at least the step's width, a power of two */
+#define SLOTS                   32
+
+#define AMPLITUDE               0.25
+#define HIGH_PASS               0.995
+
+/* Real time: how far behind emulation to play, and how far it may get
+   ahead before skipping, in samples */
+#define TARGET_LAG              (BEEP_RATE / 20)
+#define MAX_LAG                 (BEEP_RATE / 5)
+
+typedef struct _beep_event {
+  uint64_t at;
+  uint8_t q;
+} beep_event;
+
+int beep_on;
+uint64_t beep_dropped;
+
+/* Shared: the producer writes head and clock, the consumer tail */
+static beep_event ring[BEEP_RING];
+static unsigned int head, tail;
+static uint64_t clock_cycles;
+
+/* Consumer only */
+static float step[STEP_POINTS];
+static const double cycles_per_sample = (double)BEEP_CYCLES_HZ / BEEP_RATE;
+static double origin;           /* Cycle at sample 0 */
+static uint64_t pos;            /* Next sample out */
+static double level, target;    /* Output before filtering, and after
+                                   the last change placed so far */
+static double naive[SLOTS];     /* Steps to level, by sample */
+static double residual[SLOTS];  /* Band-limited minus naive steps */
+static double hp_in, hp_out;
+
+static FILE *out;
+static pthread_t writer;
+static volatile int stopping;
+
+
+/* The integral of a Blackman-windowed sinc, cut off a little below
+   Nyquist, from -HALF_WIDTH to HALF_WIDTH samples */
+static void make_step() {
+  double sum = 0, x, h, w;
+  int i;
+  for (i = 0; i < STEP_POINTS; i++) {
+    x = (double)(i - STEP_POINTS / 2) / OVERSAMPLE;
+    w = 0.42 + 0.5 * cos(M_PI * x / HALF_WIDTH) + 0.08 * cos(2 * M_PI * x / HALF_WIDTH);
+    h = x == 0 ? 0.9 : sin(0.9 * M_PI * x) / (M_PI * x);
+    sum += h * w;
+    step[i] = sum;
+  }
+  for (i = 0; i < STEP_POINTS; i++) step[i] /= sum;
+}
+
+
+/* The step at x samples from its centre, less the naive one */
+static double step_residual(double x) {
+  double p = (x + HALF_WIDTH) * OVERSAMPLE;
+  int i = (int)p;
+  double s;
+  if (i < 0) return 0;
+  if (i >= STEP_POINTS - 1) return 0;
+  s = step[i] + (step[i + 1] - step[i]) * (p - i);
+  return x >= 0 ? s - 1 : s;
+}
+
+
+/* Band-limit a change of Q at sample t */
+static void place(double t, uint8_t q) {
+  double delta = (q ? AMPLITUDE : -AMPLITUDE) - target;
+  int64_t base, n;
+
+  if (delta == 0) return;
+  target += delta;
+  /* Anything late goes in as soon as the step can still start */
+  if (t < pos + HALF_WIDTH) t = pos + HALF_WIDTH;
+  base = (int64_t)floor(t);
+  naive[(base + (t > base)) & (SLOTS - 1)] += delta;
+  for (n = base - HALF_WIDTH + 1; n <= base + HALF_WIDTH; n++)
+    residual[n & (SLOTS - 1)] += delta * step_residual(n - t);
+}
+
+
+static double horizon() {
+  return (__atomic_load_n(&clock_cycles, __ATOMIC_ACQUIRE) - origin) / cycles_per_sample;
+}
+
+
+/* Up to frames samples into buf. In real time there are always frames
+   of them; otherwise only as many as emulation has covered. */
+static int render(int16_t *buf, int frames, int realtime) {
+  unsigned int h;
+  double t, y, lag;
+  int i, slot;
+
+  lag = horizon() - pos;
+  if (realtime && lag > MAX_LAG) origin += (lag - TARGET_LAG) * cycles_per_sample;
+
+  for (i = 0; i < frames; i++) {
+    if (horizon() < pos + HALF_WIDTH + 1) {
+      if (!realtime) break;
+      /* Hold emulated time still until it catches up */
+      origin -= cycles_per_sample;
+    }
+    h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    while (tail != h) {
+      t = (ring[tail & (BEEP_RING - 1)].at - origin) / cycles_per_sample;
+      if (t >= pos + HALF_WIDTH + 1) break;
+      place(t, ring[tail & (BEEP_RING - 1)].q);
+      __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    slot = pos & (SLOTS - 1);
+    level += naive[slot];
+    y = level + residual[slot];
+    naive[slot] = residual[slot] = 0;
+    hp_out = y - hp_in + HIGH_PASS * hp_out;
+    hp_in = y;
+    y = hp_out * 32767;
+    buf[i] = y > 32767 ? 32767 : y < -32768 ? -32768 : (int16_t)lrint(y);
+    pos++;
+  }
+  return i;
+}
+
+
+static void *write_loop(void *arg) {
+  int16_t buf[1024];
+  int n;
+  (void)arg;
+  for (;;) {
+    while ((n = render(buf, 1024, 0)) > 0) fwrite(buf, sizeof(buf[0]), n, out);
+    fflush(out);
+    if (stopping) break;
+    poll(NULL, 0, 10);
+  }
+  return NULL;
+}
+
+
+int beep_start(const char *filename) {
+  make_step();
+  head = tail = 0;
+  beep_dropped = 0;
+  origin = totals.cycles;
+  clock_cycles = totals.cycles;
+  pos = 0;
+  memset(naive, 0, sizeof(naive));
+  memset(residual, 0, sizeof(residual));
+  level = target = r.Q ? AMPLITUDE : -AMPLITUDE;
+  hp_in = level;
+  hp_out = 0;
+
+  if (filename) {
+    out = strcmp(filename, "-") ? fopen(filename, "wb") : stdout;
+    if (out == NULL) return -1;
+    stopping = 0;
+    if (pthread_create(&writer, NULL, write_loop, NULL)) {
+      if (out != stdout) fclose(out);
+      out = NULL;
+      return -1;
+    }
+  }
+  beep_on = 1;
+  return 0;
+}
+
+
+void beep_q(uint8_t q, uint64_t at) {
+  unsigned int h = head;
+  if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == BEEP_RING) {
+    beep_dropped++;
+    return;
+  }
+  ring[h & (BEEP_RING - 1)].at = at;
+  ring[h & (BEEP_RING - 1)].q = q;
+  __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+}
+
+
+void beep_clock(uint64_t cycles) {
+  if (beep_on) __atomic_store_n(&clock_cycles, cycles, __ATOMIC_RELEASE);
+}
+
+
+void beep_render(int16_t *buf, int frames) {
+  render(buf, frames, 1);
+}
+
+
+void beep_stop() {
+  if (!beep_on) return;
+  beep_on = 0;
+  if (out == NULL) return;
+  /* Far enough on for the last step to be written out whole */
+  __atomic_store_n(&clock_cycles,
+                   totals.cycles + (uint64_t)((2 * HALF_WIDTH + 1) * cycles_per_sample) + 1,
+                   __ATOMIC_RELEASE);
+  stopping = 1;
+  pthread_join(writer, NULL);
+  if (out != stdout) fclose(out);
+  out = NULL;
+}
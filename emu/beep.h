@@ -0,0 +1,62 @@
+#ifndef _beep_h_
+#define _beep_h_
+
+#include <stdint.h>
+
+/*
+  The beeper on the Q line. The firmware sounds it by toggling Q with
+  SEQ and REQ.
+
+  The emulating thread does no audio work: the core hands each change
+  of Q to beep_q(), stamped with totals.cycles, which puts it in a
+  single producer, single consumer ring, and the run loop publishes how
+  far emulation has got with beep_clock() now and then.
+
+  The audio side turns that into PCM at BEEP_RATE. Each change becomes
+  a band-limited step (a windowed sinc, integrated), so square waves
+  don't alias, and a high-pass filter takes out the DC of Q held high or
+  low. It has two ways of keeping time:
+
+   - beep_render() is for a real-time consumer such as a sound card
+     callback, which must get samples now. If emulation is too far
+     ahead it skips emulated time, and if emulation hasn't got far
+     enough it holds the current level: either way there is at most a
+     band-limited step, never a click or a gap.
+
+   - With a file, a thread writes exactly the samples emulation has
+     covered, so the sound is true to emulated time however fast the
+     emulator runs: raw signed 16 bit mono samples, host byte order
+     (aplay -f S16_LE -r 44100 -c 1 plays it).
+*/
+
+#define BEEP_RATE               44100
+
+/* Machine cycles per second: the crystal isn't known, and 2 MHz (eight
+   clocks a cycle) is in the usual range for an 1802 */
+#define BEEP_CYCLES_HZ          (2000000 / 8)
+
+/* Q changes the ring holds; more are dropped */
+#define BEEP_RING               4096
+
+extern int beep_on;
+
+/* Q changes dropped because the consumer fell behind */
+extern uint64_t beep_dropped;
+
+/* Start listening to Q, writing samples to filename ("-" for stdout) or,
+   with NULL, for beep_render(). Returns 0 on success. */
+int beep_start(const char *filename);
+
+/* Called by the core when Q changes */
+void beep_q(uint8_t q, uint64_t at);
+
+/* Emulation has got as far as cycles */
+void beep_clock(uint64_t cycles);
+
+/* frames samples for real-time output (not with a file) */
+void beep_render(int16_t *out, int frames);
+
+/* Write the rest and stop */
+void beep_stop();
+
+#endif
@@ -0,0 +1,212 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "bootcache.h"
+
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FNV_OFFSET              0xCBF29CE484222325ULL
+#define FNV_PRIME               0x100000001B3ULL
+
+/* A temporary file this old was left by a job that died writing it */
+#define TMP_STALE_S             60
+
+static char cache_dir[4096];
+
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (len--) {
+    h ^= *p++;
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+
+/* The running executable, as cpu_build only dates 1802.o. Falls back
+   to cpu_build where the executable can't be read. */
+static uint64_t build_hash(uint64_t h) {
+  struct stat st;
+  void *map;
+  int fd;
+
+  if ((fd = open("/proc/self/exe", O_RDONLY)) < 0)
+    return fnv(h, cpu_build, strlen(cpu_build));
+  if (fstat(fd, &st) || !st.st_size ||
+      (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    return fnv(h, cpu_build, strlen(cpu_build));
+  }
+  close(fd);
+  h = fnv(h, map, st.st_size);
+  munmap(map, st.st_size);
+  return h;
+}
+
+
+/* Everything the booted machine depends on */
+static uint64_t boot_key(long budget) {
+  uint64_t h = FNV_OFFSET;
+  uint64_t size = sizeof(cpu_snapshot);
+  h = fnv(h, BOOT_MAGIC, 8);
+  h = build_hash(h);
+  h = fnv(h, &size, sizeof(size));
+  h = fnv(h, &budget, sizeof(budget));
+  return fnv(h, mem, MEM_BYTES);
+}
+
+
+const char *boot_cache_dir() {
+  const char *env;
+  if ((env = getenv("MWEMU_CACHE")) && *env)
+    snprintf(cache_dir, sizeof(cache_dir), "%s", env);
+  else if ((env = getenv("XDG_CACHE_HOME")) && *env)
+    snprintf(cache_dir, sizeof(cache_dir), "%s/mwemu", env);
+  else if ((env = getenv("HOME")) && *env)
+    snprintf(cache_dir, sizeof(cache_dir), "%s/.cache/mwemu", env);
+  else
+    snprintf(cache_dir, sizeof(cache_dir), ".mwemu-cache");
+  return cache_dir;
+}
+
+
+/* mkdir -p */
+static void make_dirs(const char *dir) {
+  char path[4096];
+  char *p;
+  snprintf(path, sizeof(path), "%s", dir);
+  for (p = path + 1; *p; p++) {
+    if (*p != '/') continue;
+    *p = 0;
+    mkdir(path, 0755);
+    *p = '/';
+  }
+  mkdir(path, 0755);
+}
+
+
+/* Restore the machine from a cache file, if it is the one for key */
+static int load(const char *name, uint64_t key) {
+  const size_t len = sizeof(boot_header) + sizeof(cpu_snapshot);
+  const boot_header *h;
+  struct stat st;
+  void *map;
+  int fd, ok;
+
+  if ((fd = open(name, O_RDONLY)) < 0) return 0;
+  if (fstat(fd, &st) || (size_t)st.st_size != len) {
+    close(fd);
+    return 0;
+  }
+  map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return 0;
+
+  h = (const boot_header *)map;
+  ok = !memcmp(h->magic, BOOT_MAGIC, 8) && h->key == key &&
+    h->size == sizeof(cpu_snapshot);
+  if (ok) {
+    cpu_restore((const cpu_snapshot *)(h + 1));
+    totals.insns += h->insns;
+    /* Used: last in line to be pruned */
+    utimensat(AT_FDCWD, name, NULL, 0);
+  }
+  munmap(map, len);
+  return ok;
+}
+
+
+/* Delete all but the BOOT_CACHE_FILES most recently used snapshots,
+   and temporary files nobody is writing any more */
+static void prune(const char *dir) {
+  char names[BOOT_CACHE_FILES + 1][4096];
+  uint64_t times[BOOT_CACHE_FILES + 1];
+  uint64_t t;
+  char path[4096];
+  struct dirent *e;
+  struct stat st;
+  size_t len;
+  DIR *d;
+  int n = 0, i;
+
+  if ((d = opendir(dir)) == NULL) return;
+  while ((e = readdir(d)) != NULL) {
+    len = strlen(e->d_name);
+    if (len > 4 && !strcmp(e->d_name + len - 4, ".tmp")) {
+      snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+      if (!stat(path, &st) && st.st_mtime < time(NULL) - TMP_STALE_S) unlink(path);
+      continue;
+    }
+    if (len < 5 || strcmp(e->d_name + len - 5, ".boot")) continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+    if (stat(path, &st)) continue;
+    t = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    /* Insert by time, newest first; what falls off the end goes */
+    for (i = n; i > 0 && times[i - 1] < t; i--) {
+      times[i] = times[i - 1];
+      memcpy(names[i], names[i - 1], sizeof(names[i]));
+    }
+    times[i] = t;
+    memcpy(names[i], path, sizeof(names[i]));
+    if (n < BOOT_CACHE_FILES) n++;
+    else unlink(names[BOOT_CACHE_FILES]);
+  }
+  closedir(d);
+}
+
+
+static void save(const char *dir, const char *name, uint64_t key, uint64_t insns) {
+  char tmp[4200];
+  cpu_snapshot *s;
+  boot_header h;
+  FILE *f;
+  int ok;
+
+  s = (cpu_snapshot *)malloc(sizeof(cpu_snapshot));
+  if (!s) {
+    fprintf(stderr, "Couldn't allocate memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  cpu_save(s);
+  memcpy(h.magic, BOOT_MAGIC, 8);
+  h.key = key;
+  h.size = sizeof(cpu_snapshot);
+  h.insns = insns;
+
+  make_dirs(dir);
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", name, (int)getpid());
+  f = fopen(tmp, "wb");
+  ok = f != NULL;
+  if (f) {
+    ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(s, sizeof(*s), 1, f) == 1;
+    ok = !fclose(f) && ok;
+  }
+  if (ok) ok = !rename(tmp, name);
+  if (!ok) {
+    unlink(tmp);
+    fprintf(stderr, "Cannot write boot snapshot \"%s\".\n", name);
+  }
+  free(s);
+  prune(dir);
+}
+
+
+int boot_cached(const char *dir, long budget) {
+  char name[4096];
+  uint64_t key = boot_key(budget);
+  uint64_t start = totals.insns;
+
+  snprintf(name, sizeof(name), "%s/%016llx.boot", dir, (unsigned long long)key);
+  if (load(name, key)) return 1;
+
+  /* Counted from totals, as fused steps run several instructions */
+  while (!r.IDLE && totals.insns - start < (uint64_t)budget) cpu_cycle();
+  if (!r.IDLE) return -1;
+  save(dir, name, key, totals.insns - start);
+  return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef _bootcache_h_
+#define _bootcache_h_
+
+#include <stdint.h>
+
+/*
+  Boot snapshot cache.
+
+  From reset the firmware always runs the same way to its first IDL,
+  where it waits for input. boot_cached() does that once per ROM, saves
+  the machine as it is then into a cache directory, and on later runs
+  maps the file and restores the machine from it instead.
+
+  Files are named after a hash of what the boot depends on: the memory
+  image it starts from (the ROM and RAM), the emulator build (a hash of
+  the executable), the snapshot layout and the boot budget. A different
+  ROM or a rebuilt emulator just misses the cache. As RAM kept with -B
+  differs from session to session, only the BOOT_CACHE_FILES most
+  recently used snapshots are kept. Files are written under a temporary
+  name and renamed into place, so concurrent jobs can share a directory;
+  a temporary file left by a job that died is deleted once it is a
+  minute old.
+
+  On disk: a boot_header, then the cpu_snapshot as it is in memory.
+*/
+
+#define BOOT_MAGIC              "CYBOOT01"
+
+/* Snapshots kept in a cache directory; the least recently used go */
+#define BOOT_CACHE_FILES        16
+
+typedef struct _boot_header {
+  char magic[8];
+  uint64_t key;
+  uint64_t size;
+  /* Instructions the boot ran */
+  uint64_t insns;
+} boot_header;
+
+/* $MWEMU_CACHE, else $XDG_CACHE_HOME/mwemu, else ~/.cache/mwemu */
+const char *boot_cache_dir();
+
+/* Take the machine as cpu_reset() and load_rom() left it to its first
+   IDL, running at most budget instructions, from the cache in dir if it
+   is there. Returns 1 if the machine came from the cache, 0 if it
+   booted (and was cached), -1 if it didn't go idle in time. */
+int boot_cached(const char *dir, long budget);
+
+#endif
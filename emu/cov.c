@@ -0,0 +1,150 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "disasm.h"
+#include "cov.h"
+
+#include <string.h>
+
+uint8_t cov_map[MEM_BYTES];
+
+
+void cov_start() {
+  cpu_hooks |= HOOK_COVER;
+}
+
+
+void cov_stop() {
+  cpu_hooks &= ~HOOK_COVER;
+}
+
+
+void cov_reset() {
+  memset(cov_map, 0, sizeof(cov_map));
+}
+
+
+void cov_exec(uint16_t pc, uint8_t code) {
+  int i, len = dis_length(code);
+  for (i = 0; i < len; i++) COV_MARK((pc + i) & MEM_MASK, COV_EXEC);
+}
+
+
+int cov_save(const char *filename) {
+  FILE *f;
+  int ok;
+  f = fopen(filename, "w");
+  if (f == NULL) return -1;
+  ok = fwrite(COV_MAGIC, 1, 8, f) == 8 &&
+       fwrite(cov_map, 1, MEM_BYTES, f) == MEM_BYTES;
+  if (fclose(f)) ok = 0;
+  return ok ? 0 : -1;
+}
+
+
+int cov_load(const char *filename, uint8_t *map) {
+  FILE *f;
+  char magic[8];
+  int ok;
+  f = fopen(filename, "r");
+  if (f == NULL) return -1;
+  ok = fread(magic, 1, 8, f) == 8 && !memcmp(magic, COV_MAGIC, 8) &&
+       fread(map, 1, MEM_BYTES, f) == MEM_BYTES;
+  fclose(f);
+  return ok ? 0 : -1;
+}
+
+
+/* A word at a time, through memcpy() so the maps need no alignment */
+void cov_merge(uint8_t *dst, const uint8_t *src) {
+  uint64_t d, s;
+  int i;
+  for (i = 0; i < MEM_BYTES; i += 8) {
+    memcpy(&d, dst + i, 8);
+    memcpy(&s, src + i, 8);
+    d |= s;
+    memcpy(dst + i, &d, 8);
+  }
+}
+
+
+void cov_summary(FILE *f, const uint8_t *map) {
+  int addr, exec = 0, read = 0, written = 0, untouched = 0;
+  int ram_read = 0, ram_written = 0;
+
+  for (addr = 0; addr < MEM_BYTES; addr++) {
+    if (addr < ROM_BYTES) {
+      if (map[addr] & COV_EXEC) exec++;
+      if (map[addr] & COV_READ) read++;
+      if (map[addr] & COV_WRITE) written++;
+      if (!map[addr]) untouched++;
+    } else {
+      if (map[addr] & COV_READ) ram_read++;
+      if (map[addr] & COV_WRITE) ram_written++;
+    }
+  }
+
+  fprintf(f, "ROM coverage (%d bytes):\n", ROM_BYTES);
+  fprintf(f, "  executed   %5d  %5.1f%%\n", exec, 100.0 * exec / ROM_BYTES);
+  fprintf(f, "  read       %5d  %5.1f%%\n", read, 100.0 * read / ROM_BYTES);
+  fprintf(f, "  written    %5d  %5.1f%%\n", written, 100.0 * written / ROM_BYTES);
+  fprintf(f, "  untouched  %5d  %5.1f%%\n", untouched, 100.0 * untouched / ROM_BYTES);
+  fprintf(f, "Above ROM: %d bytes read, %d bytes written\n", ram_read, ram_written);
+}
+
+
+static int hexval(int c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+
+/* Flags of all bytes on a "0005 : F8 0E\t..." line, or -1 if it has none */
+static int line_flags(const char *line, const uint8_t *map) {
+  unsigned int addr = 0;
+  int i, flags = 0;
+  const char *p;
+
+  for (i = 0; i < 4; i++) {
+    if (hexval(line[i]) < 0) return -1;
+    addr = (addr << 4) | hexval(line[i]);
+  }
+  if (strncmp(line + 4, " : ", 3)) return -1;
+
+  p = line + 7;
+  while (hexval(p[0]) >= 0 && hexval(p[1]) >= 0) {
+    flags |= map[addr++ & MEM_MASK];
+    if (p[2] != ' ') break;
+    p += 3;
+  }
+  return flags;
+}
+
+
+int cov_annotate(FILE *out, const char *lst, const uint8_t *map) {
+  FILE *f;
+  char line[1024];
+  int flags, bol = 1;
+
+  f = fopen(lst, "r");
+  if (f == NULL) return -1;
+
+  while (fgets(line, sizeof(line), f)) {
+    if (bol) {
+      flags = line_flags(line, map);
+      if (flags < 0) {
+        fputs("    ", out);
+      } else {
+        fputc(flags & COV_EXEC ? 'x' : '-', out);
+        fputc(flags & COV_READ ? 'r' : '-', out);
+        fputc(flags & COV_WRITE ? 'w' : '-', out);
+        fputc(' ', out);
+      }
+    }
+    fputs(line, out);
+    bol = strchr(line, '\n') != NULL;
+  }
+  fclose(f);
+  return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef _cov_h_
+#define _cov_h_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+  Coverage map: one byte of flags per (masked) address, set from the
+  instruction fetch and the data load/store paths in 1802.c while
+  HOOK_COVER is on. Maps from many runs are combined by OR (covmerge).
+
+  On disk: the 8-byte magic COV_MAGIC followed by MEM_BYTES flag bytes.
+*/
+
+#define COV_EXEC                0x01 /* Fetched as part of an instruction */
+#define COV_READ                0x02 /* Read as data */
+#define COV_WRITE               0x04 /* Written */
+
+#define COV_MAGIC               "CYCOV001"
+
+extern uint8_t cov_map[];
+
+#define COV_MARK(addr, bit)     (cov_map[(addr)] |= (bit))
+
+void cov_start();
+void cov_stop();
+void cov_reset();
+
+/* Called by cpu_cycle() for the instruction just executed at pc */
+void cov_exec(uint16_t pc, uint8_t code);
+
+/* Save cov_map / load a map file into map. Return 0 on success. */
+int cov_save(const char *filename);
+int cov_load(const char *filename, uint8_t *map);
+
+void cov_merge(uint8_t *dst, const uint8_t *src);
+
+/* Executed / read / written / untouched byte counts over the ROM */
+void cov_summary(FILE *f, const uint8_t *map);
+
+/* Copy a DASMx listing to out with a coverage column in front of every
+   line that carries bytes. Returns 0 on success. */
+int cov_annotate(FILE *out, const char *lst, const uint8_t *map);
+
+#endif
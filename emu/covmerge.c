@@ -0,0 +1,81 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "cov.h"
+
+#include <string.h>
+
+/*
+  Combine coverage maps written by mwemu -c. Map files are named on the
+  command line, or one per line on stdin when there are too many for that.
+*/
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-o merged] [-l listing -a annotated] [map ...]\n", prog);
+  exit(1);
+}
+
+static uint8_t map[MEM_BYTES];
+static uint8_t merged[MEM_BYTES];
+
+int merge_one(const char *filename) {
+  if (cov_load(filename, map)) {
+    fprintf(stderr, "Cannot read coverage map \"%s\".\n", filename);
+    return 0;
+  }
+  cov_merge(merged, map);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  int c, runs = 0, failed = 0, i;
+  char *out = NULL, *lst = NULL, *annotated = NULL;
+  char name[4096];
+  FILE *f;
+
+  while ((c = getopt(argc, argv, "o:l:a:")) != -1) {
+    switch (c) {
+    case 'o': out = optarg; break;
+    case 'l': lst = optarg; break;
+    case 'a': annotated = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if ((lst == NULL) != (annotated == NULL)) usage(argv[0]);
+
+  if (optind < argc) {
+    for (i = optind; i < argc; i++) {
+      if (merge_one(argv[i])) runs++;
+      else failed++;
+    }
+  } else {
+    while (fgets(name, sizeof(name), stdin)) {
+      name[strcspn(name, "\r\n")] = 0;
+      if (!name[0]) continue;
+      if (merge_one(name)) runs++;
+      else failed++;
+    }
+  }
+
+  printf("Merged %d coverage maps.\n", runs);
+  cov_summary(stdout, merged);
+
+  if (out) {
+    memcpy(cov_map, merged, MEM_BYTES);
+    if (cov_save(out)) {
+      fprintf(stderr, "Cannot write coverage map \"%s\".\n", out);
+      exit(1);
+    }
+  }
+
+  if (annotated) {
+    f = fopen(annotated, "w");
+    if (f == NULL || cov_annotate(f, lst, merged)) {
+      fprintf(stderr, "Cannot annotate \"%s\" into \"%s\".\n", lst, annotated);
+      exit(1);
+    }
+    fclose(f);
+  }
+
+  /* What was read is merged, but the result is missing some runs */
+  return failed ? 1 : 0;
+}
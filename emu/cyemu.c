@@ -0,0 +1,279 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "lcd.h"
+#include "statehash.h"
+#include "keys.h"
+#include "cyemu.h"
+
+#include <string.h>
+
+/* Instructions the firmware gets to go idle again after an interrupt */
+#define TICK_BUDGET             200000
+
+#define SNAPSHOT_MAGIC          "CYSNAP01"
+
+struct cyemu {
+  uint8_t *mem;
+  cpu_regs r;
+  cpu_io io;
+  uint8_t bus;
+  uint64_t cycles;
+  uint64_t interrupts;
+  uint64_t rom_writes;
+  lcd_state lcd;
+};
+
+typedef struct _cyemu_snapshot {
+  char magic[8];
+  char build[32];
+  cpu_snapshot s;
+} cyemu_snapshot;
+
+/* The instance whose machine is in the core's globals */
+static cyemu *current;
+
+
+static void put_away(cyemu *e) {
+  e->r = r;
+  e->io = io;
+  e->bus = bus;
+  e->cycles = cpu_cycles;
+  e->interrupts = cpu_interrupts;
+  e->rom_writes = rom_writes;
+  e->lcd = lcd;
+}
+
+
+static void activate(cyemu *e) {
+  if (current == e) return;
+  if (current) put_away(current);
+  r = e->r;
+  io = e->io;
+  bus = e->bus;
+  mem = e->mem;
+  cpu_cycles = e->cycles;
+  cpu_interrupts = e->interrupts;
+  rom_writes = e->rom_writes;
+  lcd = e->lcd;
+  /* The page hashes were of the last one's memory */
+  mem_touch_all();
+  current = e;
+}
+
+
+int cyemu_version(void) {
+  return CYEMU_API_VERSION;
+}
+
+
+cyemu *cyemu_create(void) {
+  cyemu *e = (cyemu *)calloc(1, sizeof(cyemu));
+  if (e == NULL) return NULL;
+  e->mem = (uint8_t *)calloc(1, MEM_BYTES);
+  if (e->mem == NULL) {
+    free(e);
+    return NULL;
+  }
+  cpu_quiet = 1;
+  activate(e);
+  cpu_reset();
+  return e;
+}
+
+
+void cyemu_destroy(cyemu *e) {
+  if (e == NULL) return;
+  if (current == e) {
+    current = NULL;
+    mem = NULL;
+  }
+  free(e->mem);
+  free(e);
+}
+
+
+int cyemu_load_rom(cyemu *e, const void *rom, size_t len) {
+  if (len > MEM_BYTES) return -1;
+  activate(e);
+  memcpy(mem, rom, len);
+  mem_unmapped();
+  cpu_reset();
+  return 0;
+}
+
+
+void cyemu_reset(cyemu *e) {
+  activate(e);
+  cpu_reset();
+}
+
+
+uint64_t cyemu_run(cyemu *e, uint64_t cycles) {
+  uint64_t start, end;
+  activate(e);
+  start = cpu_cycles;
+  end = start + cycles;
+  while (cpu_cycles < end) {
+    if (r.IDLE && !(io.INT && r.IE)) {
+      /* Nothing happens until an interrupt: the rest is idle cycles */
+      totals.cycles += end - cpu_cycles;
+      totals.idle_cycles += end - cpu_cycles;
+      cpu_cycles = end;
+      break;
+    }
+    cpu_cycle();
+  }
+  return cpu_cycles - start;
+}
+
+
+void cyemu_step(cyemu *e) {
+  activate(e);
+  cpu_cycle();
+}
+
+
+uint64_t cyemu_cycles(cyemu *e) {
+  activate(e);
+  return cpu_cycles;
+}
+
+
+int cyemu_set_input(cyemu *e, int port, uint8_t value) {
+  if (port < 1 || port > 7) return -1;
+  activate(e);
+  io.IN[port] = value;
+  return 0;
+}
+
+
+int cyemu_set_flag(cyemu *e, int flag, int level) {
+  activate(e);
+  level = level != 0;
+  switch (flag) {
+  case 1: io.EF1 = level; break;
+  case 2: io.EF2 = level; break;
+  case 3: io.EF3 = level; break;
+  case 4: io.EF4 = level; break;
+  default: return -1;
+  }
+  return 0;
+}
+
+
+void cyemu_set_interrupt(cyemu *e, int level) {
+  activate(e);
+  io.INT = level != 0;
+}
+
+
+int cyemu_chord(cyemu *e, uint8_t chord) {
+  activate(e);
+  if (!r.IDLE) return -1;
+  return key_chord(KEY_CY(chord), TICK_BUDGET) == KEY_OK ? 0 : -1;
+}
+
+
+int cyemu_read(cyemu *e, uint16_t addr, void *buf, size_t len) {
+  if (addr + len > MEM_BYTES) return -1;
+  activate(e);
+  memcpy(buf, mem + addr, len);
+  return 0;
+}
+
+
+int cyemu_write(cyemu *e, uint16_t addr, const void *buf, size_t len) {
+  const uint8_t *p = (const uint8_t *)buf;
+  size_t i;
+  if (addr + len > MEM_BYTES) return -1;
+  activate(e);
+  for (i = 0; i < len; i++) mem_poke(addr + i, p[i]);
+  return 0;
+}
+
+
+void cyemu_get_regs(cyemu *e, cyemu_regs *regs) {
+  activate(e);
+  memcpy(regs->r, r.R, sizeof(regs->r));
+  regs->d = r.D;
+  regs->df = r.DF;
+  regs->b = r.B;
+  regs->p = r.P;
+  regs->x = r.X;
+  regs->n = r.N;
+  regs->i = r.I;
+  regs->t = r.T;
+  regs->ie = r.IE;
+  regs->q = r.Q;
+  regs->idle = r.IDLE;
+}
+
+
+void cyemu_set_regs(cyemu *e, const cyemu_regs *regs) {
+  activate(e);
+  memcpy(r.R, regs->r, sizeof(r.R));
+  r.D = regs->d;
+  r.DF = regs->df & 1;
+  r.B = regs->b;
+  r.P = regs->p & 0x0F;
+  r.X = regs->x & 0x0F;
+  r.N = regs->n & 0x0F;
+  r.I = regs->i & 0x0F;
+  r.T = regs->t;
+  r.IE = regs->ie & 1;
+  r.Q = regs->q & 1;
+  r.IDLE = regs->idle & 1;
+}
+
+
+int cyemu_display_rows(void) {
+  return LCD_ROWS;
+}
+
+
+int cyemu_display_cols(void) {
+  return LCD_COLS;
+}
+
+
+int cyemu_display(cyemu *e, int row, char *text, size_t len) {
+  if (row < 0 || row >= LCD_ROWS || len < LCD_COLS + 1) return -1;
+  activate(e);
+  lcd_text(row, text);
+  return 0;
+}
+
+
+uint64_t cyemu_hash(cyemu *e) {
+  activate(e);
+  return state_hash();
+}
+
+
+size_t cyemu_snapshot_size(void) {
+  return sizeof(cyemu_snapshot);
+}
+
+
+int cyemu_save(cyemu *e, void *buf, size_t len) {
+  cyemu_snapshot *s = (cyemu_snapshot *)buf;
+  if (len < sizeof(cyemu_snapshot)) return -1;
+  activate(e);
+  memcpy(s->magic, SNAPSHOT_MAGIC, sizeof(s->magic));
+  memset(s->build, 0, sizeof(s->build));
+  strncpy(s->build, cpu_build, sizeof(s->build) - 1);
+  cpu_save(&s->s);
+  return 0;
+}
+
+
+int cyemu_restore(cyemu *e, const void *buf, size_t len) {
+  const cyemu_snapshot *s = (const cyemu_snapshot *)buf;
+  if (len < sizeof(cyemu_snapshot) ||
+      memcmp(s->magic, SNAPSHOT_MAGIC, sizeof(s->magic)) ||
+      strncmp(s->build, cpu_build, sizeof(s->build) - 1))
+    return -1;
+  activate(e);
+  cpu_restore(&s->s);
+  return 0;
+}
@@ -0,0 +1,123 @@
+#ifndef _cyemu_h_
+#define _cyemu_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  libcyemu: the emulator as a library, for programs that run firmware
+  as part of something else (test services, mostly).
+
+  "make lib" builds libcyemu.a and libcyemu.so. Both export nothing but
+  the functions below, which have C linkage; link with -pthread -lm.
+  Nothing on this path writes to stdout or stderr, or exits: errors
+  are return values.
+
+  An instance is a whole machine: 64 KB of memory with the ROM at the
+  bottom, the CPU, its I/O lines and the display. Any number can exist,
+  but the core keeps the machine it runs in globals, so instances take
+  turns in them: calls on the same instance in a row cost nothing
+  extra, switching costs a copy of the registers. Use the library from
+  one thread at a time.
+
+  Snapshots are opaque and belong to the build that made them;
+  cyemu_restore() refuses anything else.
+
+  The functions and structures here only ever gain members at the end
+  or new neighbours; CYEMU_API_VERSION goes up when they do.
+*/
+
+#define CYEMU_API_VERSION       1
+
+#if defined(__GNUC__)
+#define CYEMU_API               __attribute__((visibility("default")))
+#else
+#define CYEMU_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cyemu cyemu;
+
+/* The CPU's registers */
+typedef struct cyemu_regs {
+  uint16_t r[16];
+  uint8_t d;
+  uint8_t df;
+  uint8_t b;
+  uint8_t p;    /* Which of r is the program counter */
+  uint8_t x;
+  uint8_t n;
+  uint8_t i;
+  uint8_t t;
+  uint8_t ie;
+  uint8_t q;
+  uint8_t idle; /* Stopped by IDL, waiting for an interrupt */
+} cyemu_regs;
+
+CYEMU_API int cyemu_version(void);
+
+/* A machine with empty memory, or NULL if there isn't memory for one */
+CYEMU_API cyemu *cyemu_create(void);
+CYEMU_API void cyemu_destroy(cyemu *e);
+
+/* Put len bytes of ROM image at address 0 and reset. Returns 0, or -1
+   if it is bigger than memory. */
+CYEMU_API int cyemu_load_rom(cyemu *e, const void *rom, size_t len);
+CYEMU_API void cyemu_reset(cyemu *e);
+
+/* Run for at least cycles machine cycles (instructions take two or
+   three; an idle CPU with no interrupt coming is skipped over). Returns
+   the number run. */
+CYEMU_API uint64_t cyemu_run(cyemu *e, uint64_t cycles);
+
+/* Run one instruction (or one idle cycle) */
+CYEMU_API void cyemu_step(cyemu *e);
+
+/* Machine cycles since reset */
+CYEMU_API uint64_t cyemu_cycles(cyemu *e);
+
+/* Input: the latch INP port (1..7) reads, flag EF1..EF4, and the
+   interrupt line. Each stays as set. Return -1 for a bad port or flag. */
+CYEMU_API int cyemu_set_input(cyemu *e, int port, uint8_t value);
+CYEMU_API int cyemu_set_flag(cyemu *e, int flag, int level);
+CYEMU_API void cyemu_set_interrupt(cyemu *e, int level);
+
+/* Type a chord on the keyboard, numbered as CyChordTable in cyemu.js
+   does: bit 0 is Cmd, bits 1..5 the thumb and fingers. The firmware
+   must be idle waiting for input. Returns 0 once it has taken it and is
+   idle again, or -1 if it didn't get back there, wrote into ROM or ran
+   outside it. RAM that was never set up wraps every letter; keys.h has
+   the chords that set it up. */
+CYEMU_API int cyemu_chord(cyemu *e, uint8_t chord);
+
+/* Memory. Writes can patch the ROM. Return -1 if the range goes past
+   the end of memory. */
+CYEMU_API int cyemu_read(cyemu *e, uint16_t addr, void *buf, size_t len);
+CYEMU_API int cyemu_write(cyemu *e, uint16_t addr, const void *buf, size_t len);
+
+CYEMU_API void cyemu_get_regs(cyemu *e, cyemu_regs *regs);
+CYEMU_API void cyemu_set_regs(cyemu *e, const cyemu_regs *regs);
+
+/* The text of a row of the display, NUL terminated; len must have room
+   for cyemu_display_cols() + 1. Returns -1 for a bad row or short buffer. */
+CYEMU_API int cyemu_display_rows(void);
+CYEMU_API int cyemu_display_cols(void);
+CYEMU_API int cyemu_display(cyemu *e, int row, char *text, size_t len);
+
+/* A hash of memory and registers: equal for equal machines */
+CYEMU_API uint64_t cyemu_hash(cyemu *e);
+
+/* Snapshots: cyemu_snapshot_size() bytes. Return 0, or -1 if the
+   buffer is too small, or isn't a snapshot from this build. */
+CYEMU_API size_t cyemu_snapshot_size(void);
+CYEMU_API int cyemu_save(cyemu *e, void *buf, size_t len);
+CYEMU_API int cyemu_restore(cyemu *e, const void *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
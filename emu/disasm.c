@@ -0,0 +1,254 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "disasm.h"
+
+#include <string.h>
+
+/*
+  Table-driven 1802 disassembler. Mnemonics and operand formats come from
+  Tabula in 1802.c, so the disassembler and the CPU can't disagree about
+  what an opcode is. Symbols are kept in flat per-address arrays, so all
+  lookups on the trace path are O(1) and formatting avoids printf.
+*/
+
+static const char *labels[MEM_BYTES];
+static const char *comments[MEM_BYTES];
+
+/* Nearest labelled address at or below each address */
+static uint16_t nearest[MEM_BYTES];
+static int have_symbols;
+
+static const char hexdig[] = "0123456789ABCDEF";
+
+
+static char *put_hex2(char *o, uint8_t v) {
+  o[0] = hexdig[v >> 4];
+  o[1] = hexdig[v & 0xF];
+  return o + 2;
+}
+
+
+static char *put_hex4(char *o, uint16_t v) {
+  return put_hex2(put_hex2(o, v >> 8), v & 0xFF);
+}
+
+
+static char *put_str(char *o, const char *s) {
+  while (*s) *o++ = *s++;
+  return o;
+}
+
+
+static char *put_addr(char *o, uint16_t addr) {
+  if (labels[addr]) return put_str(o, labels[addr]);
+  return put_hex4(o, addr);
+}
+
+
+static int hex4(const char *s, unsigned int *v) {
+  int i, h;
+  *v = 0;
+  for (i = 0; i < 4; i++) {
+    if (s[i] >= '0' && s[i] <= '9') h = s[i] - '0';
+    else if (s[i] >= 'A' && s[i] <= 'F') h = s[i] - 'A' + 10;
+    else if (s[i] >= 'a' && s[i] <= 'f') h = s[i] - 'a' + 10;
+    else return 0;
+    *v = (*v << 4) | h;
+  }
+  return 1;
+}
+
+
+static char *copy_token(const char *s, int len, int max) {
+  char *t;
+  if (len > max) len = max;
+  t = (char *)malloc(len + 1);
+  if (!t) {
+    fprintf(stderr, "Couldn't allocate memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(t, s, len);
+  t[len] = 0;
+  return t;
+}
+
+
+static void set_label(unsigned int addr, const char *s, int len) {
+  if (labels[addr]) return;
+  labels[addr] = copy_token(s, len, DIS_LABEL_MAX);
+}
+
+
+/*
+  Listing lines we care about (CR/LF, tab separated):
+    "0029\t\t\t\tL0029:"                          label
+    "0071 : C8\t\t\" \"\t\tlskp\t...\t;INFO: ..."  instruction with comment
+    "1C32\t\tCode\tL1C32"                          symbol table entry
+*/
+int dis_load_lst(const char *filename) {
+  FILE *f;
+  char line[512];
+  char *p, *e;
+  unsigned int addr, a;
+  int n = 0, len;
+  const char *last;
+
+  f = fopen(filename, "r");
+  if (f == NULL) return -1;
+
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (!hex4(line, &addr)) continue;
+    p = line + 4;
+
+    if (p[0] == ' ' && p[1] == ':') {
+      /* Instruction: only the trailing comment is interesting */
+      e = strstr(p, "\t;");
+      if (e && !comments[addr]) {
+        e += 2;
+        comments[addr] = copy_token(e, strlen(e), DIS_MAX / 2);
+      }
+      continue;
+    }
+
+    while (*p == '\t' || *p == ' ') p++;
+    if (!strncmp(p, "Code\t", 5) || !strncmp(p, "Data\t", 5)) p += 5;
+    while (*p == '\t' || *p == ' ') p++;
+    len = strcspn(p, ":\t ");
+    if (len == 0) continue;
+    if (!labels[addr]) n++;
+    set_label(addr, p, len);
+  }
+  fclose(f);
+
+  /* Precompute the nearest-label map used by dis_symbolize() */
+  last = NULL;
+  a = 0;
+  for (addr = 0; addr < MEM_BYTES; addr++) {
+    if (labels[addr]) {
+      last = labels[addr];
+      a = addr;
+    }
+    nearest[addr] = last ? a : addr;
+  }
+  have_symbols = 1;
+
+  return n;
+}
+
+
+const char *dis_label(uint16_t addr) {
+  return labels[addr];
+}
+
+
+const char *dis_comment(uint16_t addr) {
+  return comments[addr];
+}
+
+
+long dis_lookup(const char *name) {
+  long addr;
+  for (addr = 0; addr < MEM_BYTES; addr++)
+    if (labels[addr] && !strcasecmp(labels[addr], name)) return addr;
+  return -1;
+}
+
+
+uint16_t dis_nearest(uint16_t addr) {
+  return have_symbols ? nearest[addr] : addr;
+}
+
+
+void dis_symbolize(uint16_t addr, char *buf) {
+  uint16_t base = dis_nearest(addr);
+  char *o = buf;
+  if (labels[base]) {
+    o = put_str(o, labels[base]);
+    if (base != addr) {
+      *o++ = '+';
+      o += sprintf(o, "%X", addr - base);
+    }
+  } else {
+    o = put_hex4(o, addr);
+  }
+  *o = 0;
+}
+
+
+int dis_length(uint8_t op) {
+  switch (Tabula[op].fmt) {
+  case OPF_IMM:
+  case OPF_SHORT:
+    return 2;
+  case OPF_LONG:
+    return 3;
+  }
+  return 1;
+}
+
+
+/* "0005:  F8 0E     LDI 0E" -- the layout of misc/disasm.txt */
+int dis_format(uint16_t addr, const uint8_t *code, char *buf) {
+  const cpu_op *op = &Tabula[code[0]];
+  int len = dis_length(code[0]);
+  int i;
+  char *o = buf, *col;
+  const char *c;
+
+  o = put_hex4(o, addr);
+  *o++ = ':';
+  *o++ = ' ';
+  *o++ = ' ';
+  col = o + 10;
+  for (i = 0; i < len; i++) {
+    o = put_hex2(o, code[i]);
+    *o++ = ' ';
+  }
+  while (o < col) *o++ = ' ';
+
+  o = put_str(o, op->name);
+  switch (op->fmt) {
+  case OPF_REG:
+    *o++ = ' ';
+    *o++ = 'R';
+    *o++ = hexdig[code[0] & 0xF];
+    break;
+  case OPF_PORT:
+    *o++ = ' ';
+    *o++ = '0' + (code[0] & 7);
+    break;
+  case OPF_IMM:
+    *o++ = ' ';
+    o = put_hex2(o, code[1]);
+    break;
+  case OPF_SHORT:
+    /* Target is in the page of the operand byte */
+    *o++ = ' ';
+    o = put_addr(o, ((addr + 1) & 0xFF00) | code[1]);
+    break;
+  case OPF_LONG:
+    *o++ = ' ';
+    o = put_addr(o, (code[1] << 8) | code[2]);
+    break;
+  }
+
+  c = comments[addr];
+  if (c) {
+    while (o < buf + 40) *o++ = ' ';
+    *o++ = ';';
+    while (*c && o < buf + DIS_MAX - 1) *o++ = *c++;
+  }
+  *o = 0;
+
+  return len;
+}
+
+
+int dis_insn(uint16_t addr, char *buf) {
+  uint8_t code[3];
+  code[0] = mem_fetch(addr);
+  code[1] = mem_fetch(addr + 1);
+  code[2] = mem_fetch(addr + 2);
+  return dis_format(addr, code, buf);
+}
@@ -0,0 +1,39 @@
+#ifndef _disasm_h_
+#define _disasm_h_
+
+#include <stdint.h>
+
+/* Room for one formatted line, including a (truncated) comment */
+#define DIS_MAX                 160
+
+/* Longest label kept from a listing */
+#define DIS_LABEL_MAX           32
+
+/* Load labels and comments from a DASMx listing (mwrom/microwriter.lst).
+   Returns the number of labels loaded, or -1 if the file can't be read. */
+int dis_load_lst(const char *filename);
+
+/* Label / comment at exactly this address, or NULL */
+const char *dis_label(uint16_t addr);
+const char *dis_comment(uint16_t addr);
+
+/* Address of a label, or -1 */
+long dis_lookup(const char *name);
+
+/* Nearest labelled address at or below addr (addr itself if none) */
+uint16_t dis_nearest(uint16_t addr);
+
+/* "L0E5E+4" style name for any address (plain hex if no label precedes) */
+void dis_symbolize(uint16_t addr, char *buf);
+
+/* Instruction length in bytes */
+int dis_length(uint8_t op);
+
+/* Disassemble the instruction whose bytes are at code[], located at addr.
+   Writes one line into buf (DIS_MAX bytes), returns the instruction length. */
+int dis_format(uint16_t addr, const uint8_t *code, char *buf);
+
+/* Same, reading the emulated memory */
+int dis_insn(uint16_t addr, char *buf);
+
+#endif
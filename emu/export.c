@@ -0,0 +1,87 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "export.h"
+#include "line.h"
+
+#include <string.h>
+
+/* Changes are looked for this many bytes at a time */
+#define BLOCK_BYTES             32
+
+static FILE *out;
+static uint16_t doc_addr, doc_len;
+static uint8_t *shadow;
+/* The document as text when last written, and as it is now */
+static char *text, *next;
+static int text_len;
+
+uint64_t export_writes;
+
+
+static void *alloc(size_t len) {
+  void *p = calloc(len, 1);
+  if (!p) {
+    fprintf(stderr, "Couldn't allocate memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+int export_open(const char *filename, uint16_t addr, uint16_t len) {
+  if (len == 0 || addr + len > MEM_BYTES) return -1;
+  out = strcmp(filename, "-") ? fopen(filename, "w") : stdout;
+  if (out == NULL) return -1;
+  shadow = (uint8_t *)alloc(len);
+  text = (char *)alloc(len * 2 + 1);
+  next = (char *)alloc(len * 2 + 1);
+  doc_addr = addr;
+  doc_len = len;
+  text_len = 0;
+  export_writes = 0;
+  return 0;
+}
+
+
+void export_poll() {
+  const uint8_t *doc;
+  char *t;
+  int b, len;
+
+  if (out == NULL || !r.IDLE) return;
+  doc = mem + doc_addr;
+  for (b = 0; b < doc_len; b += BLOCK_BYTES)
+    if (memcmp(doc + b, shadow + b, doc_len - b < BLOCK_BYTES ? doc_len - b : BLOCK_BYTES))
+      break;
+  if (b >= doc_len) return;
+  memcpy(shadow, doc, doc_len);
+
+  len = line_decode(doc, doc_len, next);
+  if (len >= text_len && !memcmp(next, text, text_len)) {
+    /* Only added to, if at all: bytes past the NUL may have changed */
+    if (len == text_len) return;
+    fwrite(next + text_len, 1, len - text_len, out);
+  } else {
+    fputc('\f', out);
+    fwrite(next, 1, len, out);
+  }
+  fflush(out);
+  export_writes++;
+  t = text;
+  text = next;
+  next = t;
+  text_len = len;
+}
+
+
+void export_close() {
+  if (out == NULL) return;
+  export_poll();
+  if (out != stdout) fclose(out);
+  out = NULL;
+  free(shadow);
+  free(text);
+  free(next);
+  shadow = NULL;
+  text = next = NULL;
+}
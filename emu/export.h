@@ -0,0 +1,45 @@
+#ifndef _export_h_
+#define _export_h_
+
+#include <stdint.h>
+
+#include "line.h"
+
+/*
+  Document export: streams the text of a document in RAM to a host file
+  or pipe as it changes.
+
+  A document is a region of RAM holding the firmware's characters, up
+  to the first NUL or the end of the region, turned into text as
+  line_decode() does (see line.h). export_poll(), called from the run
+  loop, only looks at it while the CPU is idle between interrupts (so
+  never half way through an update), and finds changes by comparing it
+  with a copy block by block, so an unchanged document costs a few
+  memcmp()s.
+
+  What is written: text added at the end of the document, which is what
+  typing does. Any other change writes a form feed, then the whole
+  document as it now is.
+
+  The listing doesn't say where the firmware keeps documents. The only
+  text it is known to put in RAM is the line it is editing (the boot
+  banner, then what is typed), so that is the default; export_open()
+  takes any other region. mwemu -k types chords for it to capture.
+*/
+
+#define EXPORT_ADDR             LINE_ADDR
+#define EXPORT_BYTES            LINE_BYTES
+
+/* Exports so far */
+extern uint64_t export_writes;
+
+/* Start streaming the document at addr to filename ("-" for stdout).
+   Returns 0 on success. */
+int export_open(const char *filename, uint16_t addr, uint16_t len);
+
+void export_poll();
+
+/* Write any last change and close the stream */
+void export_close();
+
+#endif
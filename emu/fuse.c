@@ -0,0 +1,172 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "fuse.h"
+
+#include <string.h>
+
+/* The SCRT routines, up to the short branch back to the SEP R3 just
+   before them (the branch's target byte follows) */
+static const uint8_t scrt_call_code[] = {
+  0xE2, 0x96, 0x73, 0x86, 0x73, 0x93, 0xB6, 0x83,
+  0xA6, 0x46, 0xB3, 0x46, 0xA3, 0x30
+};
+static const uint8_t scrt_return_code[] = {
+  0x96, 0xB3, 0x86, 0xA3, 0xE2, 0x12, 0x72, 0xA6, 0xF0, 0xB6, 0x30
+};
+
+/* Instructions a SEP R4/R5 runs, counting itself and the SEP R3 */
+#define CALL_INSNS              16
+#define RETURN_INSNS            13
+
+static const char *fuse_names[FUSE_KINDS] = {
+  "", "LD16", "CALL", "RETURN", "SEX_SEP"
+};
+
+/* What starts at each ROM address */
+static uint8_t fuse_at[ROM_BYTES];
+
+/* Entry points of the SCRT routines, 0 if the ROM has none */
+static uint16_t scrt_call, scrt_return;
+
+uint64_t fuse_count[FUSE_KINDS];
+uint64_t fuse_insns;
+
+
+/* Where code ending in a short branch back to a SEP R3 placed just
+   before it starts, or 0 */
+static uint16_t find_routine(const uint8_t *code, int len) {
+  uint16_t a, target;
+  for (a = 1; a + len < ROM_BYTES; a++) {
+    if (memcmp(mem + a, code, len)) continue;
+    target = ((a + len) & 0xFF00) | mem[a + len];
+    if (target == a - 1 && mem[target] == 0xD3) return a;
+  }
+  return 0;
+}
+
+
+void fuse_scan() {
+  uint16_t a;
+  uint8_t *m = mem;
+
+  memset(fuse_at, FUSE_NONE, sizeof(fuse_at));
+  scrt_call = find_routine(scrt_call_code, sizeof(scrt_call_code));
+  scrt_return = find_routine(scrt_return_code, sizeof(scrt_return_code));
+
+  /* Data bytes that happen to match are harmless: the table is only
+     looked at where an instruction is about to be fetched */
+  for (a = 0; a < ROM_BYTES; a++) {
+    if (m[a] == 0xD4 && scrt_call)
+      fuse_at[a] = FUSE_CALL;
+    else if (m[a] == 0xD5 && scrt_return)
+      fuse_at[a] = FUSE_RETURN;
+    else if (a + 5 < ROM_BYTES && m[a] == 0xF8 && m[a + 3] == 0xF8 &&
+             (m[a + 2] & 0xF0) == 0xB0 && m[a + 5] == (m[a + 2] ^ 0x10))
+      fuse_at[a] = FUSE_LD16;
+    else if (a + 1 < ROM_BYTES && (m[a] & 0xF0) == 0xE0 && (m[a + 1] & 0xF0) == 0xD0)
+      fuse_at[a] = FUSE_SEX_SEP;
+  }
+}
+
+
+void fuse_start() {
+  fuse_scan();
+  memset(fuse_count, 0, sizeof(fuse_count));
+  fuse_insns = 0;
+  cpu_fuse = 1;
+}
+
+
+void fuse_stop() {
+  cpu_fuse = 0;
+}
+
+
+/* Each of these does exactly what its instructions would have, in the
+   same order as far as memory is concerned, and returns how many
+   instructions that was (all of them take two machine cycles) */
+
+/* LDI hi; PHI r; LDI lo; PLO r */
+static int ld16(uint16_t pc) {
+  uint8_t k = mem[pc + 2] & 0x0F;
+  if (k == r.P) return 0;
+  r.D = mem[pc + 4];
+  r.R[k] = mem[pc + 1] << 8 | r.D;
+  r.R[r.P] += 6;
+  return 4;
+}
+
+
+/* SEP R4 from R3 into the call routine, which pushes R6, makes it
+   point at the inline target address and jumps there */
+static int call() {
+  uint8_t hi;
+  if (r.P != 3 || r.R[4] != scrt_call) return 0;
+  r.R[3]++;
+  r.X = 2;
+  mem_write(r.R[2]--, r.R[6] >> 8);
+  mem_write(r.R[2]--, r.R[6] & 0xFF);
+  r.R[6] = r.R[3];
+  hi = mem_read(r.R[6]++);
+  r.D = mem_read(r.R[6]++);
+  r.R[3] = hi << 8 | r.D;
+  r.N = 3;
+  return CALL_INSNS;
+}
+
+
+/* SEP R5 from R3 into the return routine, which continues at R6 and
+   pops the caller's R6 */
+static int ret() {
+  if (r.P != 3 || r.R[5] != scrt_return) return 0;
+  r.R[3] = r.R[6];
+  r.X = 2;
+  r.R[2]++;
+  r.R[6] = mem_read(r.R[2]++);
+  r.D = mem_read(r.R[2]);
+  r.R[6] |= r.D << 8;
+  r.N = 3;
+  return RETURN_INSNS;
+}
+
+
+/* SEX x; SEP p */
+static int sex_sep(uint16_t pc) {
+  r.R[r.P] += 2;
+  r.X = mem[pc] & 0x0F;
+  r.N = mem[pc + 1] & 0x0F;
+  r.P = r.N;
+  return 2;
+}
+
+
+int fuse_cycle(uint16_t pc) {
+  uint8_t kind;
+  int n;
+
+  if (pc >= ROM_BYTES || (kind = fuse_at[pc]) == FUSE_NONE) return 0;
+  /* An interrupt now would be taken after the first instruction */
+  if (trace || cpu_hooks || (io.INT && r.IE)) return 0;
+
+  switch (kind) {
+  case FUSE_LD16: n = ld16(pc); break;
+  case FUSE_CALL: n = call(); break;
+  case FUSE_RETURN: n = ret(); break;
+  default: n = sex_sep(pc); break;
+  }
+  if (n == 0) return 0;
+
+  fuse_count[kind]++;
+  fuse_insns += n;
+  cpu_cycles += 2 * n;
+  totals.insns += n;
+  totals.cycles += 2 * n;
+  return 1;
+}
+
+
+void fuse_report(FILE *f) {
+  int k;
+  for (k = 1; k < FUSE_KINDS; k++)
+    fprintf(f, "%-8s %12llu\n", fuse_names[k], (unsigned long long)fuse_count[k]);
+}
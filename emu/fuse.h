@@ -0,0 +1,50 @@
+#ifndef _fuse_h_
+#define _fuse_h_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+  Superinstructions. fuse_start() scans the ROM for a few idioms that
+  prof_ngram_report() shows to be the hottest, and from then on
+  cpu_cycle() runs each one as a single operation with the same result
+  as executing its instructions one by one:
+
+   LD16     LDI hi; PHI r; LDI lo; PLO r      a 16 bit constant into r
+   CALL     SEP R4, through the SCRT call routine and back to R3
+   RETURN   SEP R5, through the SCRT return routine and back to R3
+   SEX_SEP  SEX x; SEP p                      leaving a SEP subroutine
+
+  A fused operation only starts when no interrupt would be taken part
+  way through it, and never while trace or cpu_hooks are on, so traces,
+  profiles and coverage maps see every instruction. Other code that
+  counts calls to cpu_cycle() as instructions should use totals.insns
+  instead while fusing.
+*/
+
+#define FUSE_NONE               0
+#define FUSE_LD16               1
+#define FUSE_CALL               2
+#define FUSE_RETURN             3
+#define FUSE_SEX_SEP            4
+#define FUSE_KINDS              5
+
+/* Times each kind ran since fuse_start() */
+extern uint64_t fuse_count[FUSE_KINDS];
+
+/* Instructions those ran */
+extern uint64_t fuse_insns;
+
+void fuse_start();
+void fuse_stop();
+
+/* Find the idioms again, after the ROM has been patched */
+void fuse_scan();
+
+/* Called by cpu_cycle() while fusing: runs a fused operation at pc if
+   there is one, returning 1, else 0 */
+int fuse_cycle(uint16_t pc);
+
+void fuse_report(FILE *f);
+
+#endif
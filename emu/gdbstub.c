@@ -0,0 +1,771 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "gdbstub.h"
+#include "disasm.h"
+#include "prof.h"
+#include "metrics.h"
+#include "rewind.h"
+#include "beep.h"
+#include "statehash.h"
+
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/* Largest packet we accept or send (hex payload) */
+#define PKT_MAX                 4096
+
+/* How many instructions to run between checks for a ^C from the client */
+#define POLL_INTERVAL           4096
+
+/* Stop signals reported to the client */
+#define SIGINT_STOP             2
+#define SIGTRAP_STOP            5
+
+#define NUM_REGS                24
+#define REG_PC                  16
+
+
+static int listen_fd = -1;
+static int conn_fd = -1;
+static int no_ack;
+
+/* Receive buffer */
+static char rx_buf[PKT_MAX];
+static int rx_len, rx_pos;
+
+/* One bit per address: 8K, so the continue loop tests it in O(1) */
+static uint8_t bp_map[MEM_BYTES / 8];
+
+#define BP_TEST(a)  (bp_map[(a) >> 3] & (1 << ((a) & 7)))
+#define BP_SET(a)   (bp_map[(a) >> 3] |= (1 << ((a) & 7)))
+#define BP_CLR(a)   (bp_map[(a) >> 3] &= ~(1 << ((a) & 7)))
+
+/* Write watchpoints, caught by their bytes changing */
+#define WATCH_MAX               8
+#define WATCH_BYTES             16
+
+typedef struct _watch {
+  uint16_t addr;
+  uint16_t len;
+  uint8_t old[WATCH_BYTES];
+} watch;
+
+static watch watches[WATCH_MAX];
+static int n_watches;
+
+/* Why we last stopped, beyond the signal: the watchpoint that was hit
+   (or -1), and whether going back ran out of history */
+static long stop_watch = -1;
+static int stop_begin;
+
+/* Where rewind_back() saw a watched write, and to what */
+static uint64_t back_watch_at;
+static long back_watch = -1;
+
+
+static const char target_xml[] =
+  "<?xml version=\"1.0\"?>"
+  "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+  "<target version=\"1.0\">"
+  "<feature name=\"org.cyemu.cdp1802\">"
+  "<reg name=\"r0\" bitsize=\"16\" regnum=\"0\"/>"
+  "<reg name=\"r1\" bitsize=\"16\"/>"
+  "<reg name=\"r2\" bitsize=\"16\"/>"
+  "<reg name=\"r3\" bitsize=\"16\"/>"
+  "<reg name=\"r4\" bitsize=\"16\"/>"
+  "<reg name=\"r5\" bitsize=\"16\"/>"
+  "<reg name=\"r6\" bitsize=\"16\"/>"
+  "<reg name=\"r7\" bitsize=\"16\"/>"
+  "<reg name=\"r8\" bitsize=\"16\"/>"
+  "<reg name=\"r9\" bitsize=\"16\"/>"
+  "<reg name=\"r10\" bitsize=\"16\"/>"
+  "<reg name=\"r11\" bitsize=\"16\"/>"
+  "<reg name=\"r12\" bitsize=\"16\"/>"
+  "<reg name=\"r13\" bitsize=\"16\"/>"
+  "<reg name=\"r14\" bitsize=\"16\"/>"
+  "<reg name=\"r15\" bitsize=\"16\"/>"
+  "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+  "<reg name=\"d\" bitsize=\"8\"/>"
+  "<reg name=\"df\" bitsize=\"8\"/>"
+  "<reg name=\"p\" bitsize=\"8\"/>"
+  "<reg name=\"x\" bitsize=\"8\"/>"
+  "<reg name=\"t\" bitsize=\"8\"/>"
+  "<reg name=\"ie\" bitsize=\"8\"/>"
+  "<reg name=\"q\" bitsize=\"8\"/>"
+  "</feature>"
+  "</target>";
+
+
+/* Hex helpers */
+
+static const char hexchars[] = "0123456789abcdef";
+
+
+static int hexval(int c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+
+/* Parse a hex number at *p, advancing *p past it */
+static unsigned long parse_hex(const char **p) {
+  unsigned long v = 0;
+  int h;
+  while ((h = hexval(**p)) >= 0) {
+    v = (v << 4) | h;
+    (*p)++;
+  }
+  return v;
+}
+
+
+static char *put_hex(char *out, unsigned long v, int digits) {
+  while (digits--) *out++ = hexchars[(v >> (digits * 4)) & 0xF];
+  return out;
+}
+
+
+/* Register access */
+
+static int reg_size(int n) {
+  return (n <= REG_PC) ? 2 : 1;
+}
+
+
+static unsigned int reg_get(int n) {
+  if (n < 16) return r.R[n];
+  switch (n) {
+  case REG_PC: return PC();
+  case 17: return r.D;
+  case 18: return r.DF;
+  case 19: return r.P;
+  case 20: return r.X;
+  case 21: return r.T;
+  case 22: return r.IE;
+  case 23: return r.Q;
+  }
+  return 0;
+}
+
+
+static void reg_set(int n, unsigned int v) {
+  if (n < 16) {
+    r.R[n] = v;
+    return;
+  }
+  switch (n) {
+  case REG_PC: setPC(v); break;
+  case 17: r.D = v; break;
+  case 18: r.DF = v & 1; break;
+  case 19: r.P = v & 0x0F; break;
+  case 20: r.X = v & 0x0F; break;
+  case 21: r.T = v; break;
+  case 22: r.IE = v & 1; break;
+  case 23: r.Q = v & 1; break;
+  }
+}
+
+
+/* Transport */
+
+static int gdb_getc() {
+  ssize_t n;
+  if (rx_pos == rx_len) {
+    n = recv(conn_fd, rx_buf, sizeof(rx_buf), 0);
+    if (n <= 0) return -1;
+    rx_len = n;
+    rx_pos = 0;
+  }
+  return (unsigned char)rx_buf[rx_pos++];
+}
+
+
+static int gdb_write(const char *buf, int len) {
+  ssize_t n;
+  while (len > 0) {
+    n = send(conn_fd, buf, len, MSG_NOSIGNAL);
+    if (n <= 0) return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+/* Read one packet into buf. Returns its length, -1 if the client went
+   away, -2 if it sent an out-of-band interrupt (^C), or -3 if the packet
+   was longer than PKT_MAX - 1 (it is acknowledged, but not kept). */
+static int get_packet(char *buf) {
+  int c, hi, lo, len, over;
+  uint8_t sum;
+
+  for (;;) {
+    do {
+      c = gdb_getc();
+      if (c < 0) return -1;
+      if (c == 0x03) return -2;
+    } while (c != '$');
+
+    len = 0;
+    over = 0;
+    sum = 0;
+    while ((c = gdb_getc()) != '#') {
+      if (c < 0) return -1;
+      if (c == '$') { /* Restart */
+        len = 0;
+        over = 0;
+        sum = 0;
+        continue;
+      }
+      if (len < PKT_MAX - 1) buf[len++] = c;
+      else over = 1;
+      sum += c;
+    }
+    hi = gdb_getc();
+    lo = gdb_getc();
+    if (lo < 0) return -1;
+    buf[len] = 0;
+
+    if (no_ack) return over ? -3 : len;
+    if (((hexval(hi) << 4) | hexval(lo)) == sum) {
+      if (gdb_write("+", 1)) return -1;
+      return over ? -3 : len;
+    }
+    if (gdb_write("-", 1)) return -1;
+  }
+}
+
+
+static int put_packet(const char *data) {
+  static char out[PKT_MAX + 4];
+  int len = 0, c;
+  uint8_t sum = 0;
+
+  out[len++] = '$';
+  while (*data && len < PKT_MAX) {
+    sum += *data;
+    out[len++] = *data++;
+  }
+  out[len++] = '#';
+  out[len++] = hexchars[sum >> 4];
+  out[len++] = hexchars[sum & 0xF];
+
+  for (;;) {
+    if (gdb_write(out, len)) return -1;
+    if (no_ack) return 0;
+    do {
+      c = gdb_getc();
+      if (c < 0) return -1;
+    } while (c != '+' && c != '-');
+    if (c == '+') return 0;
+  }
+}
+
+
+/* Has the client sent a ^C while the CPU was running? */
+static int poll_break() {
+  struct pollfd pfd;
+  if (rx_pos == rx_len) {
+    pfd.fd = conn_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) <= 0) return 0;
+  }
+  return gdb_getc() == 0x03;
+}
+
+
+/* Watchpoints */
+
+static int watch_set(uint16_t addr, unsigned long len) {
+  watch *w;
+  if (n_watches == WATCH_MAX || len == 0 || len > WATCH_BYTES ||
+      addr + len > MEM_BYTES) return -1;
+  w = &watches[n_watches++];
+  w->addr = addr;
+  w->len = len;
+  memcpy(w->old, mem + addr, len);
+  return 0;
+}
+
+
+static void watch_clear(uint16_t addr, unsigned long len) {
+  int i;
+  for (i = 0; i < n_watches; i++) {
+    if (watches[i].addr != addr || watches[i].len != len) continue;
+    watches[i] = watches[--n_watches];
+    return;
+  }
+}
+
+
+/* Take the watched bytes as they are now */
+static void watch_sync() {
+  int i;
+  for (i = 0; i < n_watches; i++)
+    memcpy(watches[i].old, mem + watches[i].addr, watches[i].len);
+}
+
+
+/* The address of a watchpoint whose bytes changed since last time, or -1 */
+static long watch_check() {
+  watch *w;
+  int i;
+  for (i = 0; i < n_watches; i++) {
+    w = &watches[i];
+    if (!memcmp(w->old, mem + w->addr, w->len)) continue;
+    memcpy(w->old, mem + w->addr, w->len);
+    return w->addr;
+  }
+  return -1;
+}
+
+
+/* Execution */
+
+static int run_continue() {
+  unsigned long n = 0;
+  watch_sync();
+  for (;;) {
+    rewind_step();
+    if (BP_TEST(PC())) return SIGTRAP_STOP;
+    if (n_watches && (stop_watch = watch_check()) >= 0) return SIGTRAP_STOP;
+    if (!(++n % POLL_INTERVAL)) {
+      metrics_poll();
+      if (poll_break()) return SIGINT_STOP;
+    }
+  }
+}
+
+
+/* For rewind_back(): stop at breakpoints, and before watched writes */
+static int back_hit(int first) {
+  long a;
+  if (first) {
+    watch_sync();
+  } else if (n_watches && (a = watch_check()) >= 0) {
+    back_watch_at = rewind_now - 1;
+    back_watch = a;
+    return REWIND_HIT_BEFORE;
+  }
+  return BP_TEST(PC()) ? REWIND_HIT_HERE : 0;
+}
+
+
+static int run_back() {
+  back_watch = -1;
+  if (!rewind_back(back_hit)) {
+    stop_begin = 1;
+  } else if (back_watch >= 0 && back_watch_at == rewind_now) {
+    stop_watch = back_watch;
+  }
+  return SIGTRAP_STOP;
+}
+
+
+static void stop_reply(char *out, int sig) {
+  if (stop_watch >= 0)
+    sprintf(out, "T%.2xwatch:%lx;", sig, stop_watch);
+  else if (stop_begin)
+    sprintf(out, "T%.2xreplaylog:begin;", sig);
+  else
+    sprintf(out, "S%.2x", sig);
+  stop_watch = -1;
+  stop_begin = 0;
+}
+
+
+/* Monitor commands ("monitor ..." in gdb) */
+
+/* Parse an address given as a label or in hex */
+static long monitor_addr(const char *arg) {
+  char name[DIS_LABEL_MAX + 1];
+  long addr;
+  int len = strcspn(arg, " ");
+  if (len > DIS_LABEL_MAX) len = DIS_LABEL_MAX;
+  memcpy(name, arg, len);
+  name[len] = 0;
+  addr = dis_lookup(name);
+  if (addr < 0) addr = parse_hex(&arg);
+  return addr & 0xFFFF;
+}
+
+
+/* Run one command, writing its text output into out (text, not hex) */
+static void monitor(const char *cmd, char *out, int size) {
+  char line[DIS_MAX], sym[DIS_LABEL_MAX + 8];
+  const char *arg, *label;
+  long addr, count;
+  double seconds;
+  int len;
+  FILE *f;
+
+  arg = strchr(cmd, ' ');
+  arg = arg ? arg + 1 : cmd + strlen(cmd);
+  out[0] = 0;
+
+  if (!strncmp(cmd, "dis", 3)) {
+    /* dis [addr|label [count]] */
+    addr = *arg ? monitor_addr(arg) : PC();
+    arg = strchr(arg, ' ');
+    count = arg ? strtol(arg + 1, NULL, 0) : 8;
+    len = 0;
+    while (count-- > 0 && len < size - 2 * DIS_MAX) {
+      label = dis_label(addr);
+      if (label) len += sprintf(out + len, "%s:\n", label);
+      addr = (addr + dis_insn(addr, line)) & 0xFFFF;
+      len += sprintf(out + len, "%s\n", line);
+    }
+  } else if (!strncmp(cmd, "sym", 3)) {
+    /* sym addr|label */
+    addr = monitor_addr(arg);
+    dis_symbolize(addr, sym);
+    sprintf(out, "%.4lx = %s\n", addr, sym);
+  } else if (!strncmp(cmd, "where", 5)) {
+    dis_symbolize(PC(), sym);
+    dis_insn(PC(), line);
+    sprintf(out, "%s\n%s\n", sym, line);
+  } else if (!strncmp(cmd, "prof", 4)) {
+    /* prof on|off|reset|[report [top]] */
+    if (!strcmp(arg, "on")) {
+      prof_start();
+    } else if (!strcmp(arg, "off")) {
+      prof_stop();
+    } else if (!strcmp(arg, "reset")) {
+      prof_reset();
+    } else {
+      arg = strchr(arg, ' ');
+      f = fmemopen(out, size, "w");
+      if (f) {
+        prof_report(f, arg ? atoi(arg + 1) : 10);
+        fclose(f);
+      }
+    }
+  } else if (!strncmp(cmd, "hash", 4)) {
+    sprintf(out, "%016llx (memory %016llx)\n", (unsigned long long)state_hash(),
+            (unsigned long long)state_mem_hash());
+  } else if (!strncmp(cmd, "rewind", 6) && rewind_on) {
+    /* rewind [seconds] */
+    if (*arg) {
+      seconds = strtod(arg, NULL);
+      if (rewind_cycles((uint64_t)(seconds * BEEP_CYCLES_HZ)))
+        len = sprintf(out, "Back to the start of history.\n");
+      else
+        len = 0;
+      dis_symbolize(PC(), sym);
+      sprintf(out + len, "Step %llu, %s (flushregs to show it)\n",
+              (unsigned long long)rewind_now, sym);
+    } else {
+      sprintf(out, "Steps %llu to %llu, %.1f MB\n",
+              (unsigned long long)rewind_oldest(), (unsigned long long)rewind_now,
+              rewind_bytes / 1048576.0);
+    }
+  } else {
+    snprintf(out, size, "Commands: dis [addr|label [count]], sym addr|label, "
+             "where, prof on|off|reset|report [top], hash, rewind [seconds]\n");
+  }
+}
+
+
+/* Queries */
+
+static int handle_query(const char *pkt, char *out) {
+  static char cmd[PKT_MAX / 2], text[PKT_MAX / 2];
+  const char *p;
+  char *o;
+  unsigned long off, len, total, i;
+
+  if (!strncmp(pkt, "qRcmd,", 6)) {
+    p = pkt + 6;
+    for (i = 0; p[0] && p[1] && i < sizeof(cmd) - 1; i++, p += 2)
+      cmd[i] = (hexval(p[0]) << 4) | hexval(p[1]);
+    cmd[i] = 0;
+    monitor(cmd, text, sizeof(text));
+    o = out;
+    *o++ = 'O';
+    for (p = text; *p; p++) o = put_hex(o, (uint8_t)*p, 2);
+    *o = 0;
+    if (put_packet(out)) return -1;
+    strcpy(out, "OK");
+  } else if (!strncmp(pkt, "qSupported", 10)) {
+    sprintf(out, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+%s",
+            PKT_MAX - 1, rewind_on ? ";ReverseStep+;ReverseContinue+" : "");
+  } else if (!strcmp(pkt, "qAttached")) {
+    strcpy(out, "1");
+  } else if (!strncmp(pkt, "qXfer:features:read:target.xml:", 31)) {
+    p = pkt + 31;
+    off = parse_hex(&p);
+    if (*p == ',') p++;
+    len = parse_hex(&p);
+    total = sizeof(target_xml) - 1;
+    if (len > PKT_MAX - 8) len = PKT_MAX - 8;
+    if (off >= total) {
+      strcpy(out, "l");
+    } else {
+      if (off + len > total) len = total - off;
+      out[0] = (off + len == total) ? 'l' : 'm';
+      memcpy(out + 1, target_xml + off, len);
+      out[len + 1] = 0;
+    }
+  } else {
+    out[0] = 0;
+  }
+  return 0;
+}
+
+
+/* Serve one client. Returns 1 if the client asked us to quit. */
+static int gdb_session() {
+  static char pkt[PKT_MAX];
+  static char out[PKT_MAX + 1];
+  const char *p;
+  char *o;
+  unsigned long addr, len, i;
+  int n, type;
+
+  no_ack = 0;
+  rx_len = rx_pos = 0;
+
+  for (;;) {
+    n = get_packet(pkt);
+    if (n == -1) return 0;
+    if (n == -2) { /* ^C while already stopped */
+      stop_reply(out, SIGINT_STOP);
+      if (put_packet(out)) return 0;
+      continue;
+    }
+    if (n == -3) { /* Too long to have been read whole */
+      if (put_packet("E01")) return 0;
+      continue;
+    }
+
+    out[0] = 0;
+    p = pkt + 1;
+
+    switch (pkt[0]) {
+    case '?':
+      stop_reply(out, SIGTRAP_STOP);
+      break;
+
+    case 'g':
+      o = out;
+      for (i = 0; i < NUM_REGS; i++)
+        o = put_hex(o, reg_get(i), reg_size(i) * 2);
+      *o = 0;
+      break;
+
+    case 'G':
+      for (i = 0; i < NUM_REGS; i++) {
+        if (strlen(p) < (size_t)reg_size(i) * 2) break;
+        addr = 0;
+        for (n = 0; n < reg_size(i) * 2; n++) addr = (addr << 4) | hexval(*p++);
+        reg_set(i, addr);
+      }
+      rewind_input();
+      strcpy(out, "OK");
+      break;
+
+    case 'p':
+      i = parse_hex(&p);
+      if (i < NUM_REGS) {
+        *put_hex(out, reg_get(i), reg_size(i) * 2) = 0;
+      } else {
+        strcpy(out, "E01");
+      }
+      break;
+
+    case 'P':
+      i = parse_hex(&p);
+      if (i < NUM_REGS && *p == '=') {
+        p++;
+        reg_set(i, parse_hex(&p));
+        rewind_input();
+        strcpy(out, "OK");
+      } else {
+        strcpy(out, "E01");
+      }
+      break;
+
+    case 'm':
+      addr = parse_hex(&p);
+      if (*p == ',') p++;
+      len = parse_hex(&p);
+      /* Two hex digits a byte, within put_packet()'s PKT_MAX - 1 */
+      if (len > (PKT_MAX - 1) / 2) len = (PKT_MAX - 1) / 2;
+      o = out;
+      for (i = 0; i < len; i++) o = put_hex(o, mem_fetch(addr + i), 2);
+      *o = 0;
+      break;
+
+    case 'M':
+      addr = parse_hex(&p);
+      if (*p == ',') p++;
+      len = parse_hex(&p);
+      if (*p == ':') p++;
+      /* All of it or none */
+      if (strlen(p) < 2 * len) {
+        strcpy(out, "E01");
+        break;
+      }
+      for (i = 0; i < len; i++, p += 2)
+        rewind_poke(addr + i, (hexval(p[0]) << 4) | hexval(p[1]));
+      strcpy(out, "OK");
+      break;
+
+    case 'c':
+      if (*p) {
+        setPC(parse_hex(&p));
+        rewind_input();
+      }
+      stop_reply(out, run_continue());
+      break;
+
+    case 's':
+      if (*p) {
+        setPC(parse_hex(&p));
+        rewind_input();
+      }
+      rewind_step();
+      stop_reply(out, SIGTRAP_STOP);
+      break;
+
+    case 'b':
+      /* Reverse step and continue, when recording */
+      if (!rewind_on) break;
+      if (*p == 's') {
+        if (rewind_now == rewind_oldest()) stop_begin = 1;
+        else rewind_seek(rewind_now - 1);
+        stop_reply(out, SIGTRAP_STOP);
+      } else if (*p == 'c') {
+        stop_reply(out, run_back());
+      }
+      break;
+
+    case 'Z':
+    case 'z':
+      type = parse_hex(&p);
+      if (*p == ',') p++;
+      addr = parse_hex(&p) & 0xFFFF;
+      /* Software and hardware breakpoints are the same thing here */
+      if (type == 0 || type == 1) {
+        if (pkt[0] == 'Z') BP_SET(addr); else BP_CLR(addr);
+        strcpy(out, "OK");
+      } else if (type == 2) {
+        if (*p == ',') p++;
+        len = parse_hex(&p);
+        if (pkt[0] == 'z') watch_clear(addr, len);
+        else if (watch_set(addr, len)) strcpy(out, "E01");
+        if (!out[0]) strcpy(out, "OK");
+      }
+      break;
+
+    case 'H':
+      strcpy(out, "OK");
+      break;
+
+    case 'q':
+      if (handle_query(pkt, out)) return 0;
+      break;
+
+    case 'Q':
+      if (!strcmp(pkt, "QStartNoAckMode")) {
+        strcpy(out, "OK");
+        if (put_packet(out)) return 0;
+        no_ack = 1;
+        continue;
+      }
+      break;
+
+    case 'D':
+      put_packet("OK");
+      return 0;
+
+    case 'k':
+      return 1;
+
+    default:
+      break;
+    }
+
+    if (put_packet(out)) return 0;
+  }
+}
+
+
+void gdb_open(const char *spec) {
+  struct sockaddr_in in_addr;
+  struct sockaddr_un un_addr;
+  struct stat st;
+  const char *s = spec;
+  int one = 1;
+
+  if (*s == ':') s++;
+  if (*s && strspn(s, "0123456789") == strlen(s)) {
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+      perror("socket");
+      exit(1);
+    }
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&in_addr, 0, sizeof(in_addr));
+    in_addr.sin_family = AF_INET;
+    in_addr.sin_port = htons(atoi(s));
+    in_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd, (struct sockaddr *)&in_addr, sizeof(in_addr)) < 0) {
+      fprintf(stderr, "Cannot bind GDB stub to port %s.\n", s);
+      exit(1);
+    }
+  } else {
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+      perror("socket");
+      exit(1);
+    }
+    if (strlen(spec) >= sizeof(un_addr.sun_path)) {
+      fprintf(stderr, "Socket path \"%s\" is too long.\n", spec);
+      exit(1);
+    }
+    memset(&un_addr, 0, sizeof(un_addr));
+    un_addr.sun_family = AF_UNIX;
+    strcpy(un_addr.sun_path, spec);
+    /* Replace a socket left by an earlier run, but nothing else */
+    if (lstat(spec, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(spec);
+    if (bind(listen_fd, (struct sockaddr *)&un_addr, sizeof(un_addr)) < 0) {
+      fprintf(stderr, "Cannot bind GDB stub to \"%s\".\n", spec);
+      exit(1);
+    }
+  }
+
+  if (listen(listen_fd, 1) < 0) {
+    perror("listen");
+    exit(1);
+  }
+  printf("GDB stub listening on \"%s\".\n", spec);
+}
+
+
+void gdb_serve() {
+  int one = 1, quit = 0;
+
+  while (!quit) {
+    conn_fd = accept(listen_fd, NULL, NULL);
+    if (conn_fd < 0) {
+      perror("accept");
+      exit(1);
+    }
+    setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    printf("GDB client attached.\n");
+    quit = gdb_session();
+    close(conn_fd);
+    conn_fd = -1;
+    printf("GDB client detached.\n");
+  }
+  close(listen_fd);
+}
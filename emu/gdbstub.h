@@ -0,0 +1,32 @@
+#ifndef _gdbstub_h_
+#define _gdbstub_h_
+
+/*
+  GDB Remote Serial Protocol stub.
+
+  Listens on a local TCP port (spec is a number, or ":number") or on a
+  Unix domain socket (spec is anything else, taken as a path), and serves
+  one debugger client at a time. The CPU only runs when the client says
+  so; there is no stub code in cpu_cycle(). Write watchpoints (Z2) are
+  supported, caught by the watched bytes changing.
+
+  With rewind_start() (see rewind.h) it also takes gdb's reverse-step
+  and reverse-continue, which stops at breakpoints and before writes to
+  watched bytes, and "monitor rewind seconds" goes back in emulated time.
+
+  Register numbering (p/P packets, and order in g/G):
+   0..15   R0..RF   16 bit, big-endian (as the 1802 stores them)
+   16      PC       16 bit, alias of R(P)
+   17      D        8 bit
+   18      DF       8 bit
+   19      P        8 bit
+   20      X        8 bit
+   21      T        8 bit
+   22      IE       8 bit
+   23      Q        8 bit
+*/
+
+void gdb_open(const char *spec);
+void gdb_serve();
+
+#endif
@@ -0,0 +1,112 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "keys.h"
+
+#include <string.h>
+
+#define CHORD_TICKS             (1 + KEY_RELEASE_TICKS)
+
+/* What key_setup() types, as CyChordTable numbers it */
+static const uint8_t setup[] = {61, 25, 25, 53, 2};
+
+/* Chords queued by key_type(), after as many of setup[] as the machine
+   needs (-1 until it is idle and that is known), and how many ticks of
+   them are typed */
+static uint8_t *typed;
+static int typed_len, typed_ticks, setup_len = -1, raised;
+
+
+void key_idle() {
+  io.IN[KEY_PORT] = KEY_UP;
+  io.EF2 = 1;
+}
+
+
+int key_tick(long budget) {
+  uint64_t writes = rom_writes;
+  long n;
+  /* Idle with interrupts off: nothing can ever wake it */
+  if (!r.IE) return KEY_HANG;
+  io.INT = 1;
+  cpu_cycle();
+  io.INT = 0;
+  for (n = 0; n < budget && !r.IDLE; n++) {
+    cpu_cycle();
+    if (PC() >= ROM_BYTES) return KEY_BAD_PC;
+    if (rom_writes != writes) return KEY_ROM_WRITE;
+  }
+  return r.IDLE ? KEY_OK : KEY_HANG;
+}
+
+
+int key_chord(uint8_t chord, long budget) {
+  int t, res;
+  io.IN[KEY_PORT] = KEY_DOWN(chord);
+  res = key_tick(budget);
+  io.IN[KEY_PORT] = KEY_UP;
+  for (t = 0; t < KEY_RELEASE_TICKS && res == KEY_OK; t++) res = key_tick(budget);
+  return res;
+}
+
+
+int key_setup(long budget) {
+  unsigned int c;
+  int res = KEY_OK;
+  if (mem[KEY_LINE_LENGTH]) return KEY_OK;
+  for (c = 0; c < sizeof(setup) && res == KEY_OK; c++)
+    res = key_chord(KEY_CY(setup[c]), budget);
+  return res;
+}
+
+
+int key_type(const char *chords) {
+  const char *s = chords;
+  char *end;
+  long c;
+
+  free(typed);
+  typed = (uint8_t *)malloc(strlen(chords) + 1);
+  if (!typed) {
+    fprintf(stderr, "Couldn't allocate memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  for (typed_len = 0; *s; typed_len++) {
+    c = strtol(s, &end, 0);
+    if (end == s || c < 1 || c > 63 || (*end && *end != ',' && *end != ' ')) {
+      c = typed_len + 1;
+      typed_len = 0;
+      return c;
+    }
+    typed[typed_len] = c;
+    s = end + (*end == ',' || *end == ' ');
+  }
+  typed_ticks = 0;
+  setup_len = -1;
+  key_idle();
+  return 0;
+}
+
+
+static uint8_t queued(int i) {
+  return KEY_CY(i < setup_len ? setup[i] : typed[i - setup_len]);
+}
+
+
+int key_poll() {
+  int left;
+  if (setup_len < 0) {
+    if (!r.IDLE) return 1;
+    setup_len = mem[KEY_LINE_LENGTH] ? 0 : sizeof(setup);
+  }
+  left = (setup_len + typed_len) * CHORD_TICKS - typed_ticks;
+  if (raised) {
+    io.INT = 0;
+    raised = 0;
+  } else if (left && r.IDLE && r.IE) {
+    io.IN[KEY_PORT] = typed_ticks % CHORD_TICKS ? KEY_UP :
+      KEY_DOWN(queued(typed_ticks / CHORD_TICKS));
+    io.INT = raised = 1;
+    typed_ticks++;
+  }
+  return left;
+}
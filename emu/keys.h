@@ -0,0 +1,101 @@
+#ifndef _keys_h_
+#define _keys_h_
+
+#include <stdint.h>
+
+/*
+  Typing on the keyboard.
+
+  Each interrupt wakes the main thread at 0EFB, which calls the scan at
+  0C65. Unless serial input is on (bit 3 of 4003), that reads INP 4 at
+  0C83, active low: it inverts the port and ORs what is down into the
+  chord at 4000. Once the port reads nothing down, it waits (0054),
+  reads again to be sure (0C9B) and takes the chord: both thumb bits is
+  Cmd (0D36), the Cmd bit alone is a command with the fingers (0D47),
+  anything else is decoded as a letter (0CB5, 0CCA). So a chord is one
+  interrupt with its keys down, then KEY_RELEASE_TICKS with none; each
+  time the firmware must get back to IDL with interrupts enabled or it
+  has hung.
+
+  With serial input on, the scan first polls EF2, the receive line, for
+  a start bit (0C7D) and only reads the keys if none comes; the line
+  idles with EF2 set, so key_idle() sets it.
+
+  CyChordTable in cyemu.js numbers the keys differently: Cmd 1, thumb
+  2, index 4, middle 8, ring 16, little 32. KEY_CY() makes port bits of
+  those. Bit 2 of the port is a modifier the firmware notes in 4003
+  before decoding the rest (0D41), and bit 7 isn't read.
+
+  RAM that has never been set up has every setting zero, line length
+  (4032) included: every letter then wraps the line, so after nine
+  letters without a space there is nowhere left to break it, and the
+  firmware restarts through 0000, running off ROM on the way and
+  switching itself off (0E62). key_setup() does what an owner would
+  after fitting batteries, and has the firmware load its settings.
+
+  These work on the machine in the globals. key_chord() runs the ticks
+  itself; a run loop that has its own work between instructions calls
+  key_poll() after each one instead, to type what key_type() was given.
+  Lanes (lanes.h) set the port themselves, with KEY_DOWN() and KEY_UP.
+*/
+
+#define KEY_PORT                4
+#define KEY_RELEASE_TICKS       2
+
+/* Port bits */
+#define KEY_CMD                 0x01
+#define KEY_THUMB               0x02
+#define KEY_EXTRA               0x04
+#define KEY_INDEX               0x08
+#define KEY_MIDDLE              0x10
+#define KEY_RING                0x20
+#define KEY_LITTLE              0x40
+
+/* A chord as CyChordTable numbers it, in port bits */
+#define KEY_CY(chord)           ((uint8_t)(((chord) & 0x03) | ((chord) & 0x3C) << 1))
+
+/* What the port reads with chord down, and with nothing down */
+#define KEY_DOWN(chord)         ((uint8_t)~(chord))
+#define KEY_UP                  0xFF
+
+/* The line length setting, 0 until the machine is set up */
+#define KEY_LINE_LENGTH         0x4032
+
+/* Outcomes of a tick or a chord */
+#define KEY_OK                  0
+#define KEY_HANG                1       /* Not idle within the budget */
+#define KEY_ROM_WRITE           2
+#define KEY_BAD_PC              3       /* Ran outside ROM */
+
+/* Nothing down, and the serial receive line idle */
+void key_idle();
+
+/* Raise one interrupt with the keys as they are, and run until the
+   firmware idles again, for at most budget steps */
+int key_tick(long budget);
+
+/* Type chord (port bits): the keys down for a tick, then up for the
+   release ticks. Leaves the port at KEY_UP. Returns the first outcome
+   that isn't KEY_OK, or KEY_OK. */
+int key_chord(uint8_t chord, long budget);
+
+/* On a machine that isn't set up, type the commands that load the
+   settings (Cmd-m Cmd-n lifts the guard cold start puts on them, Cmd-n
+   Cmd-, runs 0DB6, which copies the table at 1DC4), then a space for
+   the firmware to lose: on a cold start the first letter goes into the
+   line's first cell, which every redraw paints over. Returns as
+   key_chord() does. */
+int key_setup(long budget);
+
+/* Queue CyChordTable chords ("12,56,10", decimal, or hex with 0x) for
+   key_poll() to type, after what key_setup() would if the machine isn't
+   set up by then. Returns 0, or the position (from 1) of the first that
+   isn't a number from 1 to 63, having queued nothing. */
+int key_type(const char *chords);
+
+/* Raise the next tick's interrupt once the firmware is idle, and lower
+   it again after the instruction that takes it. Returns 0 once there
+   is nothing left to do. */
+int key_poll();
+
+#endif
@@ -0,0 +1,631 @@
+#include "lanes.h"
+
+#include <string.h>
+
+/* The kernels are built twice on x86-64, plain and for AVX2, and the
+   loader picks one for the host */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define LANES_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define LANES_KERNEL
+#endif
+
+/* Key of a lane with nothing to run */
+#define NONE                    0xFFFFFFFF
+
+/* What step() returns */
+#define STEP_DONE               0 /* Every lane has stopped */
+#define STEP_RAN                1
+#define STEP_SINGLE             2 /* The lanes picked need the core */
+
+/* Branch and skip conditions */
+#define C_NEVER                 0
+#define C_ALWAYS                1
+#define C_Q                     2
+#define C_NQ                    3
+#define C_Z                     4
+#define C_NZ                    5
+#define C_DF                    6
+#define C_NF                    7
+#define C_IE                    8
+
+
+lanes *lanes_new(int n, const cpu_snapshot *s) {
+  lanes *L;
+  int l;
+
+  if (n < 1 || n > LANES_MAX) {
+    fprintf(stderr, "Between 1 and %d lanes, not %d.\n", LANES_MAX, n);
+    exit(1);
+  }
+  L = (lanes *)calloc(1, sizeof(lanes));
+  if (!L) {
+    fprintf(stderr, "Couldn't allocate memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  L->n = n;
+  for (l = 0; l < n; l++) {
+    L->mem[l] = (uint8_t *)malloc(MEM_BYTES);
+    if (!L->mem[l]) {
+      fprintf(stderr, "Couldn't allocate memory!\n");
+      exit(EXIT_FAILURE);
+    }
+    lanes_set(L, l, s);
+  }
+  return L;
+}
+
+
+void lanes_free(lanes *L) {
+  int l;
+  for (l = 0; l < L->n; l++) free(L->mem[l]);
+  free(L);
+}
+
+
+void lanes_get(const lanes *L, int l, cpu_snapshot *s) {
+  int k;
+  memset(&s->r, 0, sizeof(s->r));
+  for (k = 0; k < 16; k++) s->r.R[k] = L->R[k][l];
+  s->r.D = L->D[l];
+  s->r.DF = L->DF[l];
+  s->r.B = L->B[l];
+  s->r.P = L->P[l];
+  s->r.X = L->X[l];
+  s->r.N = L->N[l];
+  s->r.I = L->I[l];
+  s->r.T = L->T[l];
+  s->r.IE = L->IE[l];
+  s->r.Q = L->Q[l];
+  s->r.IDLE = L->IDLE[l];
+  s->io = L->io[l];
+  s->bus = L->bus[l];
+  s->cycles = L->cycles[l];
+  s->interrupts = L->interrupts[l];
+  /* There is one display, whichever lane wrote to it */
+  s->lcd = lcd;
+  memcpy(s->mem, L->mem[l], MEM_BYTES);
+  totals.snapshots++;
+}
+
+
+void lanes_set(lanes *L, int l, const cpu_snapshot *s) {
+  int k;
+  for (k = 0; k < 16; k++) L->R[k][l] = s->r.R[k];
+  L->D[l] = s->r.D;
+  L->DF[l] = s->r.DF;
+  L->B[l] = s->r.B;
+  L->P[l] = s->r.P;
+  L->X[l] = s->r.X;
+  L->N[l] = s->r.N;
+  L->I[l] = s->r.I;
+  L->T[l] = s->r.T;
+  L->IE[l] = s->r.IE;
+  L->Q[l] = s->r.Q;
+  L->IDLE[l] = s->r.IDLE;
+  L->io[l] = s->io;
+  L->bus[l] = s->bus;
+  L->cycles[l] = s->cycles;
+  L->interrupts[l] = s->interrupts;
+  L->rom_writes[l] = 0;
+  memcpy(L->mem[l], s->mem, MEM_BYTES);
+  totals.snapshots++;
+}
+
+
+/* Move one lane into the core's globals and back */
+
+static void load(lanes *L, int l) {
+  int k;
+  for (k = 0; k < 16; k++) r.R[k] = L->R[k][l];
+  r.D = L->D[l];
+  r.DF = L->DF[l];
+  r.B = L->B[l];
+  r.P = L->P[l];
+  r.X = L->X[l];
+  r.N = L->N[l];
+  r.I = L->I[l];
+  r.T = L->T[l];
+  r.IE = L->IE[l];
+  r.Q = L->Q[l];
+  r.IDLE = L->IDLE[l];
+  io = L->io[l];
+  bus = L->bus[l];
+  mem = L->mem[l];
+  cpu_cycles = L->cycles[l];
+  cpu_interrupts = L->interrupts[l];
+  rom_writes = L->rom_writes[l];
+}
+
+
+static void store(lanes *L, int l) {
+  int k;
+  for (k = 0; k < 16; k++) L->R[k][l] = r.R[k];
+  L->D[l] = r.D;
+  L->DF[l] = r.DF;
+  L->B[l] = r.B;
+  L->P[l] = r.P;
+  L->X[l] = r.X;
+  L->N[l] = r.N;
+  L->I[l] = r.I;
+  L->T[l] = r.T;
+  L->IE[l] = r.IE;
+  L->Q[l] = r.Q;
+  L->IDLE[l] = r.IDLE;
+  L->bus[l] = bus;
+  L->cycles[l] = cpu_cycles;
+  L->interrupts[l] = cpu_interrupts;
+  L->rom_writes[l] = rom_writes;
+}
+
+
+static void rekey(lanes *L, int l) {
+  L->key[l] = (L->IDLE[l] || !L->budget[l]) ? NONE :
+    (uint32_t)L->R[L->P[l]][l] << 4 | L->P[l];
+}
+
+
+/* The lanes picked, one at a time through cpu_cycle() */
+static void single(lanes *L) {
+  int l;
+  for (l = 0; l < L->n; l++) {
+    if (!L->pick[l]) continue;
+    load(L, l);
+    cpu_cycle();
+    store(L, l);
+    L->budget[l]--;
+    rekey(L, l);
+    L->insns++;
+    L->single++;
+  }
+  L->steps++;
+}
+
+
+/* Data traffic of one lane; like mem_read() and mem_write() without
+   the hooks, which send everything through single() anyway */
+
+static inline uint8_t lane_read(const lanes *L, int l, uint16_t addr) {
+  return L->mem[l][addr];
+}
+
+
+static inline void lane_write(lanes *L, int l, uint16_t addr, uint8_t data) {
+  if (addr < ROM_BYTES) {
+    L->rom_writes[l]++;
+    return;
+  }
+  L->mem[l][addr] = data;
+}
+
+
+/* The byte at R(X) of each lane in m */
+static inline void gather_x(const lanes *L, const uint8_t *m, uint8_t *v) {
+  int l;
+  for (l = 0; l < L->n; l++)
+    v[l] = m[l] ? lane_read(L, l, L->R[L->X[l]][l]) : 0;
+}
+
+
+static inline void condition(const lanes *L, int c, uint8_t *v) {
+  int l, n = L->n;
+  switch (c) {
+  case C_NEVER:  for (l = 0; l < n; l++) v[l] = 0; break;
+  case C_ALWAYS: for (l = 0; l < n; l++) v[l] = 1; break;
+  case C_Q:      for (l = 0; l < n; l++) v[l] = L->Q[l]; break;
+  case C_NQ:     for (l = 0; l < n; l++) v[l] = !L->Q[l]; break;
+  case C_Z:      for (l = 0; l < n; l++) v[l] = L->D[l] == 0; break;
+  case C_NZ:     for (l = 0; l < n; l++) v[l] = L->D[l] != 0; break;
+  case C_DF:     for (l = 0; l < n; l++) v[l] = L->DF[l]; break;
+  case C_NF:     for (l = 0; l < n; l++) v[l] = !L->DF[l]; break;
+  case C_IE:     for (l = 0; l < n; l++) v[l] = L->IE[l]; break;
+  }
+}
+
+
+/* The D <- D op v opcodes. Bit 3 of the opcode only says whether v was
+   an immediate byte or the byte at R(X), so it is ignored here. */
+static inline void alu(lanes *L, const uint8_t *m, const uint8_t *v, uint8_t code) {
+  uint16_t t;
+  int l, n = L->n;
+  uint8_t *D = L->D, *DF = L->DF;
+
+  switch (code & 0xF7) {
+  case 0xF0: /* LDX, LDI */
+    for (l = 0; l < n; l++) D[l] = m[l] ? v[l] : D[l];
+    break;
+  case 0xF1: /* OR, ORI */
+    for (l = 0; l < n; l++) D[l] = m[l] ? D[l] | v[l] : D[l];
+    break;
+  case 0xF2: /* AND, ANI */
+    for (l = 0; l < n; l++) D[l] = m[l] ? D[l] & v[l] : D[l];
+    break;
+  case 0xF3: /* XOR, XRI */
+    for (l = 0; l < n; l++) D[l] = m[l] ? D[l] ^ v[l] : D[l];
+    break;
+  case 0xF4: /* ADD, ADI */
+    for (l = 0; l < n; l++) {
+      t = D[l] + v[l];
+      D[l] = m[l] ? t & 0xFF : D[l];
+      DF[l] = m[l] ? t >> 8 : DF[l];
+    }
+    break;
+  case 0xF5: /* SD, SDI */
+    for (l = 0; l < n; l++) {
+      t = v[l] + 0xFF - D[l] + 1;
+      D[l] = m[l] ? t & 0xFF : D[l];
+      DF[l] = m[l] ? t >> 8 : DF[l];
+    }
+    break;
+  case 0xF7: /* SM, SMI */
+    for (l = 0; l < n; l++) {
+      t = D[l] + 0xFF - v[l] + 1;
+      D[l] = m[l] ? t & 0xFF : D[l];
+      DF[l] = m[l] ? t >> 8 : DF[l];
+    }
+    break;
+  case 0x74: /* ADC, ADCI */
+    for (l = 0; l < n; l++) {
+      t = D[l] + v[l] + DF[l];
+      D[l] = m[l] ? t & 0xFF : D[l];
+      DF[l] = m[l] ? t >> 8 : DF[l];
+    }
+    break;
+  case 0x75: /* SDB, SDBI */
+    for (l = 0; l < n; l++) {
+      t = v[l] + 0xFF - D[l] + DF[l];
+      D[l] = m[l] ? t & 0xFF : D[l];
+      DF[l] = m[l] ? t >> 8 : DF[l];
+    }
+    break;
+  case 0x77: /* SMB, SMBI */
+    for (l = 0; l < n; l++) {
+      t = D[l] + 0xFF - v[l] + DF[l];
+      D[l] = m[l] ? t & 0xFF : D[l];
+      DF[l] = m[l] ? t >> 8 : DF[l];
+    }
+    break;
+  }
+}
+
+
+/* Issue one opcode: the lowest PC any runnable lane is at, for all the
+   lanes at it */
+LANES_KERNEL
+static int step(lanes *L) {
+  uint32_t lo = NONE, nk, *key = L->key;
+  uint8_t v[LANES_MAX], *m = L->pick;
+  uint16_t pc, target = 0, next = 0, t, *pcr, *rn;
+  uint8_t code, imm, k, c, *D = L->D, *DF = L->DF;
+  int n = L->n, l, p, count = 0, branch = -1, scattered = 0;
+
+  for (l = 0; l < n; l++) lo = key[l] < lo ? key[l] : lo;
+  if (lo == NONE) return STEP_DONE;
+  for (l = 0; l < n; l++) {
+    m[l] = key[l] == lo ? 0xFF : 0;
+    count += m[l] & 1;
+  }
+
+  pc = lo >> 4;
+  p = lo & 15;
+  /* Code in RAM may differ between lanes; the ROM is the same in all */
+  if (trace || cpu_hooks || pc >= ROM_BYTES - 2) {
+    return STEP_SINGLE;
+  }
+  code = L->mem[0][pc];
+  imm = L->mem[0][pc + 1];
+  k = code & 0x0F;
+  pcr = L->R[p];
+  rn = L->R[k];
+
+/* Step past an instruction of len bytes before executing it, as the
+   core's incPC() does */
+#define ADVANCE(len) \
+  for (l = 0; l < n; l++) pcr[l] = m[l] ? pc + (len) : pcr[l]
+
+  switch (code >> 4) {
+  case 0x0:
+    ADVANCE(1);
+    if (k == 0) { /* IDL */
+      for (l = 0; l < n; l++) L->IDLE[l] = m[l] ? 1 : L->IDLE[l];
+    } else { /* LDN */
+      for (l = 0; l < n; l++)
+        if (m[l]) D[l] = lane_read(L, l, rn[l]);
+    }
+    break;
+
+  case 0x1: /* INC */
+    ADVANCE(1);
+    for (l = 0; l < n; l++) rn[l] += m[l] & 1;
+    break;
+
+  case 0x2: /* DEC */
+    ADVANCE(1);
+    for (l = 0; l < n; l++) rn[l] -= m[l] & 1;
+    break;
+
+  case 0x3: /* Short branches, SKP */
+    switch (k) {
+    case 0x0: branch = C_ALWAYS; break;
+    case 0x1: branch = C_Q; break;
+    case 0x2: branch = C_Z; break;
+    case 0x3: branch = C_DF; break;
+    case 0x8: branch = C_NEVER; break;
+    case 0x9: branch = C_NQ; break;
+    case 0xA: branch = C_NZ; break;
+    case 0xB: branch = C_NF; break;
+    default: /* EF lines */
+      return STEP_SINGLE;
+    }
+    target = ((pc + 1) & 0xFF00) | imm;
+    next = pc + 2;
+    break;
+
+  case 0x4: /* LDA */
+    ADVANCE(1);
+    for (l = 0; l < n; l++) {
+      if (!m[l]) continue;
+      D[l] = lane_read(L, l, rn[l]);
+      rn[l]++;
+    }
+    break;
+
+  case 0x5: /* STR */
+    ADVANCE(1);
+    for (l = 0; l < n; l++)
+      if (m[l]) lane_write(L, l, rn[l], D[l]);
+    break;
+
+  case 0x6:
+    if (k) { /* I/O */
+      return STEP_SINGLE;
+    }
+    ADVANCE(1); /* IRX */
+    for (l = 0; l < n; l++)
+      if (m[l]) L->R[L->X[l]][l]++;
+    break;
+
+  case 0x7:
+    switch (k) {
+    case 0x0: case 0x1: /* RET, DIS */
+      ADVANCE(1);
+      gather_x(L, m, v);
+      for (l = 0; l < n; l++) {
+        if (!m[l]) continue;
+        L->R[L->X[l]][l]++;
+        L->P[l] = v[l] & 0x0F;
+        L->X[l] = v[l] >> 4;
+        L->IE[l] = !k;
+      }
+      scattered = 1;
+      break;
+    case 0x2: /* LDXA */
+      ADVANCE(1);
+      gather_x(L, m, v);
+      alu(L, m, v, 0xF0);
+      for (l = 0; l < n; l++)
+        if (m[l]) L->R[L->X[l]][l]++;
+      break;
+    case 0x3: /* STXD */
+      ADVANCE(1);
+      for (l = 0; l < n; l++) {
+        if (!m[l]) continue;
+        lane_write(L, l, L->R[L->X[l]][l], D[l]);
+        L->R[L->X[l]][l]--;
+      }
+      break;
+    case 0x4: case 0x5: case 0x7: /* ADC, SDB, SMB */
+      ADVANCE(1);
+      gather_x(L, m, v);
+      alu(L, m, v, code);
+      break;
+    case 0x6: /* SHRC */
+      ADVANCE(1);
+      for (l = 0; l < n; l++) {
+        c = (D[l] >> 1) | (DF[l] << 7);
+        DF[l] = m[l] ? D[l] & 1 : DF[l];
+        D[l] = m[l] ? c : D[l];
+      }
+      break;
+    case 0xA: case 0xB: /* REQ, SEQ */
+      ADVANCE(1);
+      for (l = 0; l < n; l++) L->Q[l] = m[l] ? k & 1 : L->Q[l];
+      break;
+    case 0xC: case 0xD: case 0xF: /* ADCI, SDBI, SMBI */
+      ADVANCE(2);
+      memset(v, imm, n);
+      alu(L, m, v, code);
+      break;
+    case 0xE: /* SHLC */
+      ADVANCE(1);
+      for (l = 0; l < n; l++) {
+        c = (D[l] << 1) | DF[l];
+        DF[l] = m[l] ? D[l] >> 7 : DF[l];
+        D[l] = m[l] ? c : D[l];
+      }
+      break;
+    default: /* SAV, MARK */
+      return STEP_SINGLE;
+    }
+    break;
+
+  case 0x8: /* GLO */
+    ADVANCE(1);
+    for (l = 0; l < n; l++) D[l] = m[l] ? rn[l] & 0xFF : D[l];
+    break;
+
+  case 0x9: /* GHI */
+    ADVANCE(1);
+    for (l = 0; l < n; l++) D[l] = m[l] ? rn[l] >> 8 : D[l];
+    break;
+
+  case 0xA: /* PLO */
+    ADVANCE(1);
+    for (l = 0; l < n; l++) {
+      t = (rn[l] & 0xFF00) | D[l];
+      rn[l] = m[l] ? t : rn[l];
+    }
+    break;
+
+  case 0xB: /* PHI */
+    ADVANCE(1);
+    for (l = 0; l < n; l++) {
+      t = (D[l] << 8) | (rn[l] & 0x00FF);
+      rn[l] = m[l] ? t : rn[l];
+    }
+    break;
+
+  case 0xC: /* Long branches and skips */
+    switch (k) {
+    case 0x0: branch = C_ALWAYS; break;
+    case 0x1: branch = C_Q; break;
+    case 0x2: branch = C_Z; break;
+    case 0x3: branch = C_DF; break;
+    case 0x4: branch = C_NEVER; break;
+    case 0x5: branch = C_NQ; break;
+    case 0x6: branch = C_NZ; break;
+    case 0x7: branch = C_NF; break;
+    case 0x8: branch = C_ALWAYS; break;
+    case 0x9: branch = C_NQ; break;
+    case 0xA: branch = C_NZ; break;
+    case 0xB: branch = C_NF; break;
+    case 0xC: branch = C_IE; break;
+    case 0xD: branch = C_Q; break;
+    case 0xE: branch = C_Z; break;
+    case 0xF: branch = C_DF; break;
+    }
+    if (k & 0x4 || k == 0x8) {
+      /* Skip: the target is past the next two bytes */
+      target = pc + 3;
+      next = pc + 1;
+    } else {
+      target = (imm << 8) | L->mem[0][pc + 2];
+      next = pc + 3;
+    }
+    break;
+
+  case 0xD: /* SEP */
+    ADVANCE(1);
+    for (l = 0; l < n; l++) {
+      L->N[l] = m[l] ? k : L->N[l];
+      L->P[l] = m[l] ? k : L->P[l];
+    }
+    break;
+
+  case 0xE: /* SEX */
+    ADVANCE(1);
+    for (l = 0; l < n; l++) {
+      L->N[l] = m[l] ? k : L->N[l];
+      L->X[l] = m[l] ? k : L->X[l];
+    }
+    break;
+
+  case 0xF:
+    if (k == 0x6) { /* SHR */
+      ADVANCE(1);
+      for (l = 0; l < n; l++) {
+        c = D[l] >> 1;
+        DF[l] = m[l] ? D[l] & 1 : DF[l];
+        D[l] = m[l] ? c : D[l];
+      }
+    } else if (k == 0xE) { /* SHL */
+      ADVANCE(1);
+      for (l = 0; l < n; l++) {
+        c = D[l] << 1;
+        DF[l] = m[l] ? D[l] >> 7 : DF[l];
+        D[l] = m[l] ? c : D[l];
+      }
+    } else if (k & 0x8) { /* Immediate */
+      ADVANCE(2);
+      memset(v, imm, n);
+      alu(L, m, v, code);
+    } else { /* Via R(X) */
+      ADVANCE(1);
+      gather_x(L, m, v);
+      alu(L, m, v, code);
+    }
+    break;
+  }
+#undef ADVANCE
+
+  if (branch >= 0) {
+    condition(L, branch, v);
+    for (l = 0; l < n; l++) {
+      t = v[l] ? target : next;
+      pcr[l] = m[l] ? t : pcr[l];
+    }
+  }
+
+  /* All the lanes picked now run on the same register, perhaps a new
+     one after SEP */
+  if ((code & 0xF0) == 0xD0) p = k;
+  c = OP_CYCLES(code);
+  for (l = 0; l < n; l++) {
+    L->budget[l] -= m[l] & 1;
+    L->spent[l] += m[l] & c;
+    nk = (uint32_t)L->R[p][l] << 4 | p;
+    nk = L->budget[l] ? nk : NONE;
+    key[l] = m[l] ? nk : key[l];
+  }
+  if (code == 0x00) /* IDL */
+    for (l = 0; l < n; l++) key[l] = m[l] ? NONE : key[l];
+  if (scattered) /* Each lane has its own P */
+    for (l = 0; l < n; l++)
+      if (m[l]) rekey(L, l);
+  totals.insns += count;
+  totals.cycles += count * c;
+  L->insns += count;
+  L->steps++;
+  return STEP_RAN;
+}
+
+
+uint64_t lanes_tick(lanes *L, uint32_t budget) {
+  cpu_regs saved_r = r;
+  cpu_io saved_io = io;
+  uint8_t saved_bus = bus, *saved_mem = mem;
+  uint64_t saved_cycles = cpu_cycles, saved_interrupts = cpu_interrupts;
+  uint64_t saved_rom_writes = rom_writes, before = L->insns;
+  int l, s;
+
+  for (l = 0; l < L->n; l++) {
+    L->budget[l] = budget;
+    if (!L->IDLE[l]) {
+      /* Raise INT for one cycle of a lane that's still busy */
+      load(L, l);
+      io.INT = 1;
+      cpu_cycle();
+      store(L, l);
+      continue;
+    }
+    /* The idle cycle, as cpu_cycle() does it */
+    L->cycles[l]++;
+    totals.cycles++;
+    totals.idle_cycles++;
+    if (!L->IE[l]) continue;
+    L->T[l] = (L->X[l] << 4) | L->P[l];
+    L->P[l] = 1;
+    L->X[l] = 2;
+    L->IE[l] = 0;
+    L->IDLE[l] = 0;
+    L->interrupts[l]++;
+    totals.interrupts++;
+  }
+
+  for (l = 0; l < L->n; l++) rekey(L, l);
+  while ((s = step(L)))
+    if (s == STEP_SINGLE) single(L);
+  for (l = 0; l < L->n; l++) {
+    L->cycles[l] += L->spent[l];
+    L->spent[l] = 0;
+  }
+
+  r = saved_r;
+  io = saved_io;
+  bus = saved_bus;
+  mem = saved_mem;
+  cpu_cycles = saved_cycles;
+  cpu_interrupts = saved_interrupts;
+  rom_writes = saved_rom_writes;
+  return L->insns - before;
+}
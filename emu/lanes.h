@@ -0,0 +1,85 @@
+#ifndef _lanes_h_
+#define _lanes_h_
+
+#include "mwemu.h"
+#include "1802.h"
+
+/*
+  Many machines running the same ROM in lockstep.
+
+  Registers are kept as arrays, one element per machine ("lane"). Each
+  step picks the lanes whose program counters agree (the lowest such
+  PC first, so lanes that split at a branch meet again further on) and
+  executes that one opcode for all of them with straight-line loops the
+  compiler turns into SIMD code; on x86-64 there is an AVX2 version,
+  chosen at run time. I/O (which devices have to see), EF branches,
+  MARK, SAV and code running from RAM are executed one lane at a time
+  through the ordinary core, as are all opcodes when trace or
+  cpu_hooks are on. Either way the result is exactly what cpu_cycle()
+  would have done.
+
+  The core's globals (r, io, mem and the counters) are borrowed for
+  that and put back afterwards.
+*/
+
+#define LANES_MAX               1024
+
+/* Array length: a power of two would put the start of every array in
+   the same few cache sets */
+#define LANES_ROW               (LANES_MAX + 96)
+
+typedef struct _lanes {
+  int n;
+
+  uint16_t R[16][LANES_ROW];
+  uint8_t D[LANES_ROW];
+  uint8_t DF[LANES_ROW];
+  uint8_t B[LANES_ROW];
+  uint8_t P[LANES_ROW];
+  uint8_t X[LANES_ROW];
+  uint8_t N[LANES_ROW];
+  uint8_t I[LANES_ROW];
+  uint8_t T[LANES_ROW];
+  uint8_t IE[LANES_ROW];
+  uint8_t Q[LANES_ROW];
+  uint8_t IDLE[LANES_ROW];
+  uint8_t bus[LANES_ROW];
+
+  /* Each lane's inputs, and its own 64K */
+  cpu_io io[LANES_ROW];
+  uint8_t *mem[LANES_ROW];
+
+  uint64_t cycles[LANES_ROW];
+  uint64_t interrupts[LANES_ROW];
+  uint64_t rom_writes[LANES_ROW];
+
+  /* Instructions each lane may still run in this tick, and the machine
+     cycles it has run so far (added to cycles when the tick ends) */
+  uint32_t budget[LANES_ROW];
+  uint32_t spent[LANES_ROW];
+
+  /* Where each lane is, as PC << 4 | P; all ones once it has stopped */
+  uint32_t key[LANES_ROW];
+
+  /* The lanes the current opcode is issued to */
+  uint8_t pick[LANES_ROW];
+
+  /* Opcodes issued, lane instructions executed, and how many of those
+     went one lane at a time */
+  uint64_t steps;
+  uint64_t insns;
+  uint64_t single;
+} lanes;
+
+/* n copies of a machine */
+lanes *lanes_new(int n, const cpu_snapshot *s);
+void lanes_free(lanes *L);
+
+void lanes_get(const lanes *L, int lane, cpu_snapshot *s);
+void lanes_set(lanes *L, int lane, const cpu_snapshot *s);
+
+/* One interrupt on every lane, then run each lane until it idles again
+   or has run budget instructions. Returns the instructions executed. */
+uint64_t lanes_tick(lanes *L, uint32_t budget);
+
+#endif
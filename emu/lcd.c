@@ -0,0 +1,127 @@
+#include "mwemu.h"
+#include "lcd.h"
+
+#include <string.h>
+
+lcd_state lcd;
+
+
+/* Index into ddram of a DDRAM address */
+static int ddram_index(uint8_t addr) {
+  if (lcd.lines == 2) return (addr & 0x40 ? 40 : 0) + (addr & 0x3F) % 40;
+  return addr % LCD_DDRAM;
+}
+
+
+/* Redraw fb from display RAM */
+static void draw() {
+  uint8_t row[LCD_COLS];
+  int y, x, line = LCD_DDRAM / lcd.lines;
+
+  for (y = 0; y < LCD_ROWS; y++) {
+    for (x = 0; x < LCD_COLS; x++)
+      row[x] = lcd.on && y < lcd.lines ? lcd.ddram[y * line + (lcd.offset + x) % line] : ' ';
+    if (memcmp(lcd.fb[y], row, LCD_COLS)) {
+      memcpy(lcd.fb[y], row, LCD_COLS);
+      lcd.dirty |= 1u << y;
+      lcd.frame++;
+    }
+  }
+}
+
+
+void lcd_reset() {
+  memset(&lcd, 0, sizeof(lcd));
+  memset(lcd.ddram, ' ', LCD_DDRAM);
+  memset(lcd.fb, ' ', sizeof(lcd.fb));
+  lcd.lines = 1;
+  /* The firmware never turns it on */
+  lcd.on = 1;
+}
+
+
+static void move(int delta) {
+  if (lcd.lines == 2) {
+    /* 00-27 and 40-67, wrapping from each to the other */
+    int i = ddram_index(lcd.addr) + delta;
+    i = (i + LCD_DDRAM) % LCD_DDRAM;
+    lcd.addr = i < 40 ? i : 0x40 + i - 40;
+  } else {
+    lcd.addr = (lcd.addr + delta + LCD_DDRAM) % LCD_DDRAM;
+  }
+}
+
+
+static void shift_display(int delta) {
+  int line = LCD_DDRAM / lcd.lines;
+  lcd.offset = (lcd.offset + delta + line) % line;
+}
+
+
+static void command(uint8_t c) {
+  if (c & 0x80) {
+    lcd.addr = c & 0x7F;
+    lcd.to_cgram = 0;
+  } else if (c & 0x40) {
+    lcd.addr = c & 0x3F;
+    lcd.to_cgram = 1;
+  } else if (c & 0x20) {
+    lcd.lines = c & 0x08 ? 2 : 1;
+    lcd.offset = 0;
+  } else if (c & 0x10) {
+    /* Cursor or display shift */
+    if (c & 0x08) shift_display(c & 0x04 ? -1 : 1);
+    else move(c & 0x04 ? 1 : -1);
+  } else if (c & 0x08) {
+    lcd.on = (c >> 2) & 1;
+    lcd.cursor = (c >> 1) & 1;
+    lcd.blink = c & 1;
+  } else if (c & 0x04) {
+    /* End of frame (see lcd.h) */
+    lcd.addr = 0;
+  } else if (c & 0x02) {
+    lcd.addr = 0;
+    lcd.offset = 0;
+  } else if (c & 0x01) {
+    memset(lcd.ddram, ' ', LCD_DDRAM);
+    lcd.addr = 0;
+    lcd.offset = 0;
+  }
+  draw();
+}
+
+
+static void data(uint8_t d) {
+  if (lcd.to_cgram) {
+    lcd.cgram[lcd.addr & (LCD_CGRAM - 1)] = d;
+    lcd.addr = (lcd.addr + 1) & (LCD_CGRAM - 1);
+    return;
+  }
+  lcd.ddram[ddram_index(lcd.addr)] = d;
+  move(1);
+  draw();
+}
+
+
+void lcd_out(uint8_t port, uint8_t value) {
+  if (port == LCD_CMD) command(value);
+  else data(value);
+}
+
+
+void lcd_text(int row, char *text) {
+  int x;
+  uint8_t c;
+  for (x = 0; x < LCD_COLS; x++) {
+    c = lcd.fb[row][x];
+    text[x] = c >= 0x20 && c < 0x7F ? c : '?';
+  }
+  text[LCD_COLS] = 0;
+}
+
+
+uint32_t lcd_take_dirty() {
+  uint32_t d = lcd.dirty;
+  lcd.dirty = 0;
+  return d;
+}
@@ -0,0 +1,72 @@
+#ifndef _lcd_h_
+#define _lcd_h_
+
+#include <stdint.h>
+
+/*
+  The LCD, without SDL. The firmware drives a character display through
+  two OUT ports, as for an HD44780 controller: commands to LCD_CMD and
+  characters to LCD_DATA. At boot it clears it (01) and writes the
+  banner. From then on every redraw is the whole line, 16 characters,
+  followed by 05, and no address is ever set: so 05 ends a frame,
+  putting the address back at the start of the line. (To an HD44780 it
+  would be entry mode, decrement with display shift, and each redraw
+  would land backwards at the wrong addresses.) Entry mode commands are
+  taken that way; the rest are an HD44780's, and data always goes to
+  the next address up.
+
+  What the firmware draws is the tail of the line it is editing in RAM,
+  in the display's own character codes (see line.h).
+
+  lcd keeps what the controller would: display RAM, the address
+  counter, display on/off and shift, and from those the framebuffer,
+  the character codes each row of the panel shows. Every
+  change to a row sets its bit in lcd.dirty, and bumps lcd.frame, so a
+  caller can tell whether anything changed since it last looked with a
+  single compare, and copy only the rows that did.
+
+  Only the visible effect is modelled: no busy flag, no timing, and the
+  character generator RAM is kept but not drawn.
+*/
+
+#define LCD_CMD                 2
+#define LCD_DATA                3
+
+#define LCD_ROWS                1
+#define LCD_COLS                16
+
+/* Display RAM; in two line mode the second line starts at 40 */
+#define LCD_DDRAM               80
+#define LCD_CGRAM               64
+
+typedef struct _lcd_state {
+  uint8_t ddram[LCD_DDRAM];
+  uint8_t cgram[LCD_CGRAM];
+  /* What the panel shows: blanks while the display is off */
+  uint8_t fb[LCD_ROWS][LCD_COLS];
+
+  uint8_t addr;                 /* Address counter */
+  uint8_t to_cgram;             /* Data goes to CGRAM, not DDRAM */
+  uint8_t lines;                /* Function set: 1 or 2 */
+  uint8_t on, cursor, blink;    /* Display control */
+  uint8_t offset;               /* Display shift, in characters */
+
+  uint32_t dirty;               /* A bit per row of fb that changed */
+  uint64_t frame;               /* Counts changes to fb */
+} lcd_state;
+
+extern lcd_state lcd;
+
+void lcd_reset();
+
+/* Called by out() for the LCD's ports */
+void lcd_out(uint8_t port, uint8_t data);
+
+/* Row of fb as text: printable ASCII, '?' for other codes. text holds
+   LCD_COLS + 1. */
+void lcd_text(int row, char *text);
+
+/* lcd.dirty, cleared */
+uint32_t lcd_take_dirty();
+
+#endif
@@ -0,0 +1,75 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "line.h"
+
+#include <string.h>
+
+#define PREFIX                  0xB4
+
+
+int line_length() {
+  const uint8_t *nul = (const uint8_t *)memchr(mem + LINE_ADDR, 0, LINE_BYTES);
+  return nul ? nul - (mem + LINE_ADDR) : LINE_BYTES;
+}
+
+
+/* The display code for a symbol, from the ROM's table (026D) */
+static uint8_t glyph(uint8_t c) {
+  int i;
+  if (c < 0x90) i = 0;
+  else if (c < 0xA0) i = 1;
+  else if (c < 0xB0) i = 2;
+  else i = c - 0xAD;
+  return mem[LINE_GLYPHS + i];
+}
+
+
+int line_cells(uint8_t *cells, int n) {
+  static uint8_t all[LINE_BYTES * 2];
+  const uint8_t *p = mem + LINE_ADDR;
+  int i, len = line_length(), k = 0;
+
+  for (i = 0; i < len; i++) {
+    if (p[i] >= 0x80) {
+      all[k++] = glyph(p[i]);
+      if (p[i] == PREFIX) i++;
+    } else if (p[i] < 0x20) {
+      all[k++] = 0xA5;
+      all[k++] = p[i] + 0x60;
+    } else if (p[i] == 0x7E) {
+      all[k++] = 0xB5;
+    } else if (p[i] == 0x7F) {
+      all[k++] = 0xAB;
+    } else {
+      all[k++] = p[i];
+    }
+  }
+  if (n > k) n = k;
+  memcpy(cells, all + k - n, n);
+  return n;
+}
+
+
+int line_decode(const uint8_t *p, int len, char *text) {
+  int i, k = 0;
+
+  for (i = 0; i < len && p[i]; i++) {
+    if (p[i] >= 0x80) {
+      text[k++] = '?';
+      /* The byte after a prefix goes with it, unless the text ends */
+      if (p[i] == PREFIX && i + 1 < len && p[i + 1]) i++;
+    } else if (p[i] < 0x20) {
+      text[k++] = '^';
+      text[k++] = p[i] + 0x40;
+    } else {
+      text[k++] = p[i];
+    }
+  }
+  text[k] = 0;
+  return k;
+}
+
+
+int line_text(char *text) {
+  return line_decode(mem + LINE_ADDR, LINE_BYTES, text);
+}
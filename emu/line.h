@@ -0,0 +1,43 @@
+#ifndef _line_h_
+#define _line_h_
+
+#include <stdint.h>
+
+/*
+  The line of text the firmware is editing, in RAM at LINE_ADDR up to
+  the first NUL. At boot it holds the banner, padded with spaces in
+  front; typing adds to the end. It isn't one line of the display: the
+  firmware marks where it wraps (90 or B0 in the text, at the line
+  length set in 4032) and lets the text run on through RAM.
+
+  Characters are the firmware's own codes: ASCII from 20 to 7D, control
+  codes below 20, and codes from 80 up for its own symbols, B4 being a
+  prefix to the byte after it. To draw the line (0B38-0BF3 in the
+  listing) it turns each into one or two of the display's codes, codes
+  from 80 up through a table in ROM at LINE_GLYPHS, and sends the last
+  LINE_CELLS of those, then two status cells.
+*/
+
+#define LINE_ADDR               0x4081
+#define LINE_BYTES              (RAM_END - LINE_ADDR)
+
+#define LINE_CELLS              14
+#define LINE_GLYPHS             0x1DE4
+
+/* Bytes before the NUL, at most LINE_BYTES */
+int line_length();
+
+/* The last n display cells of the line, as the firmware draws it, into
+   cells. Returns how many there are, fewer than n if the line is short. */
+int line_cells(uint8_t *cells, int n);
+
+/* Characters from p, up to the first NUL or len bytes, as text: ASCII
+   as it is, control codes as ^ and a letter, and the firmware's symbols
+   as '?'. text holds len * 2 + 1. Returns the length. */
+int line_decode(const uint8_t *p, int len, char *text);
+
+/* The line as text, as line_decode() has it. text holds LINE_BYTES * 2
+   + 1. Returns the length. */
+int line_text(char *text);
+
+#endif
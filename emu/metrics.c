@@ -0,0 +1,280 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "metrics.h"
+
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+/* Rates are averaged over windows at least this long */
+#define RATE_WINDOW_NS          1000000000LL
+
+#define TEXT_MAX                8192
+
+typedef struct _metrics_values {
+  cpu_stats totals;
+  double mips;
+  double idle_ratio;
+  double io_rate;
+  double uptime;
+} metrics_values;
+
+/* One writer (the emulating thread), any number of readers */
+typedef struct _metrics_slot {
+  unsigned int seq;             /* Odd while the writer is in the middle */
+  char name[32];
+  metrics_values v;
+  /* Writer only */
+  int64_t start_ns;
+  int64_t window_ns;
+  cpu_stats window;
+} metrics_slot;
+
+static metrics_slot slots[METRICS_INSTANCES];
+static int n_slots;
+static pthread_mutex_t register_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int self = -1;
+
+static pthread_t exporter;
+static int exporting;
+static volatile int stopping;
+static const char *stats_path;
+static int stats_interval_ms = 1000;
+static char sock_path[108];
+static int sock_fd = -1;
+
+
+static int64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+int metrics_register(const char *name) {
+  metrics_slot *s;
+  pthread_mutex_lock(&register_lock);
+  if (n_slots == METRICS_INSTANCES) {
+    pthread_mutex_unlock(&register_lock);
+    return -1;
+  }
+  self = n_slots;
+  s = &slots[n_slots];
+  snprintf(s->name, sizeof(s->name), "%s", name);
+  s->start_ns = s->window_ns = now_ns();
+  s->window = totals;
+  s->v.totals = totals;
+  /* Readers only look at slots below n_slots */
+  __atomic_store_n(&n_slots, n_slots + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&register_lock);
+  return self;
+}
+
+
+void metrics_poll() {
+  metrics_slot *s;
+  int64_t now, dt;
+  double secs;
+
+  if (self < 0) return;
+  s = &slots[self];
+  now = now_ns();
+
+  __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  s->v.totals = totals;
+  s->v.uptime = (now - s->start_ns) * 1e-9;
+  dt = now - s->window_ns;
+  if (dt >= RATE_WINDOW_NS) {
+    secs = dt * 1e-9;
+    s->v.mips = (totals.insns - s->window.insns) / secs / 1e6;
+    s->v.io_rate = (totals.io_events - s->window.io_events) / secs;
+    s->v.idle_ratio = totals.cycles == s->window.cycles ? 0 :
+      (double)(totals.idle_cycles - s->window.idle_cycles) /
+      (totals.cycles - s->window.cycles);
+    s->window = totals;
+    s->window_ns = now;
+  }
+
+  __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/* Consistent copy of a slot */
+static void read_slot(metrics_slot *s, metrics_values *v) {
+  unsigned int seq;
+  do {
+    seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    memcpy(v, &s->v, sizeof(*v));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || seq != __atomic_load_n(&s->seq, __ATOMIC_RELAXED));
+}
+
+
+static int format(char *buf, int size) {
+  static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+  } names[] = {
+    {"cyemu_instructions_total", "counter", "Emulated instructions executed"},
+    {"cyemu_cycles_total", "counter", "Emulated machine cycles, idle included"},
+    {"cyemu_idle_cycles_total", "counter", "Machine cycles spent stopped in IDL"},
+    {"cyemu_interrupts_total", "counter", "Interrupts taken"},
+    {"cyemu_io_events_total", "counter", "INP and OUT instructions"},
+    {"cyemu_snapshots_total", "counter", "Machine state saves and restores"},
+    {"cyemu_mips", "gauge", "Emulated instructions per microsecond"},
+    {"cyemu_idle_ratio", "gauge", "Share of machine cycles spent idle"},
+    {"cyemu_io_events_per_second", "gauge", "INP and OUT instructions per second"},
+    {"cyemu_uptime_seconds", "gauge", "Time since the instance registered"}
+  };
+  metrics_values v;
+  uint64_t counters[METRICS_INSTANCES][6];
+  double gauges[METRICS_INSTANCES][4];
+  int i, k, n, len = 0;
+
+  n = __atomic_load_n(&n_slots, __ATOMIC_ACQUIRE);
+  for (i = 0; i < n; i++) {
+    read_slot(&slots[i], &v);
+    counters[i][0] = v.totals.insns;
+    counters[i][1] = v.totals.cycles;
+    counters[i][2] = v.totals.idle_cycles;
+    counters[i][3] = v.totals.interrupts;
+    counters[i][4] = v.totals.io_events;
+    counters[i][5] = v.totals.snapshots;
+    gauges[i][0] = v.mips;
+    gauges[i][1] = v.idle_ratio;
+    gauges[i][2] = v.io_rate;
+    gauges[i][3] = v.uptime;
+  }
+
+  for (k = 0; k < 10 && len < size; k++) {
+    len += snprintf(buf + len, size - len, "# HELP %s %s\n# TYPE %s %s\n",
+                    names[k].name, names[k].help, names[k].name, names[k].type);
+    for (i = 0; i < n && len < size; i++) {
+      if (k < 6)
+        len += snprintf(buf + len, size - len, "%s{instance=\"%s\"} %llu\n",
+                        names[k].name, slots[i].name,
+                        (unsigned long long)counters[i][k]);
+      else
+        len += snprintf(buf + len, size - len, "%s{instance=\"%s\"} %.6g\n",
+                        names[k].name, slots[i].name, gauges[i][k - 6]);
+    }
+  }
+  return len < size ? len : size - 1;
+}
+
+
+/* Write a new file beside the old one and rename it over, so a scraper
+   never sees half a file */
+static void write_stats(const char *text, int len) {
+  char tmp[4096];
+  FILE *f;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path);
+  f = fopen(tmp, "w");
+  if (f == NULL) return;
+  if (fwrite(text, 1, len, f) != (size_t)len || fclose(f)) {
+    remove(tmp);
+    return;
+  }
+  rename(tmp, stats_path);
+}
+
+
+static void *export_loop(void *arg) {
+  static char text[TEXT_MAX];
+  struct pollfd pfd;
+  int64_t next = 0, now;
+  int len, client, timeout;
+
+  (void)arg;
+  while (!stopping) {
+    now = now_ns();
+    if (stats_path && now >= next) {
+      len = format(text, sizeof(text));
+      write_stats(text, len);
+      next = now + stats_interval_ms * 1000000LL;
+    }
+
+    timeout = stats_path ? (int)((next - now) / 1000000) : 200;
+    if (timeout > 200) timeout = 200;
+    if (timeout < 1) timeout = 1;
+
+    if (sock_fd < 0) {
+      poll(NULL, 0, timeout);
+      continue;
+    }
+    pfd.fd = sock_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout) <= 0) continue;
+    client = accept(sock_fd, NULL, NULL);
+    if (client < 0) continue;
+    len = format(text, sizeof(text));
+    send(client, text, len, MSG_NOSIGNAL);
+    close(client);
+  }
+  return NULL;
+}
+
+
+static int start_exporter() {
+  if (exporting) return 0;
+  stopping = 0;
+  if (pthread_create(&exporter, NULL, export_loop, NULL)) return -1;
+  exporting = 1;
+  return 0;
+}
+
+
+int metrics_export_file(const char *path, int interval_ms) {
+  stats_path = path;
+  if (interval_ms > 0) stats_interval_ms = interval_ms;
+  return start_exporter();
+}
+
+
+int metrics_export_socket(const char *path) {
+  struct sockaddr_un sun;
+  struct stat st;
+
+  if (strlen(path) >= sizeof(sun.sun_path)) return -1;
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strcpy(sun.sun_path, path);
+
+  sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock_fd < 0) return -1;
+  /* Replace a socket left by an earlier run, but nothing else */
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+  if (bind(sock_fd, (struct sockaddr *)&sun, sizeof(sun)) || listen(sock_fd, 8)) {
+    close(sock_fd);
+    sock_fd = -1;
+    return -1;
+  }
+  strcpy(sock_path, path);
+  return start_exporter();
+}
+
+
+void metrics_stop() {
+  if (exporting) {
+    stopping = 1;
+    pthread_join(exporter, NULL);
+    exporting = 0;
+  }
+  /* Leave a final, complete set of figures behind */
+  if (stats_path) {
+    static char text[TEXT_MAX];
+    write_stats(text, format(text, sizeof(text)));
+  }
+  if (sock_fd >= 0) {
+    close(sock_fd);
+    sock_fd = -1;
+    unlink(sock_path);
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef _metrics_h_
+#define _metrics_h_
+
+/*
+  Live metrics for long-running emulator sessions.
+
+  Each emulating thread registers an instance, then calls metrics_poll()
+  every few thousand instructions from its run loop. That copies the
+  core's running totals (see cpu_stats in 1802.h) into the instance's
+  slot under a sequence lock. The instruction loop itself only does the
+  plain increments it already does, with no atomics and no shared
+  cache lines.
+
+  An exporter thread reads the slots and serves them in the Prometheus
+  text format: rewritten into a file every interval, and/or once to
+  every client that connects to a Unix socket.
+*/
+
+#define METRICS_INSTANCES       16
+
+/* Name this thread's emulator. Returns its slot, or -1 if all are taken. */
+int metrics_register(const char *name);
+
+/* Publish this thread's totals, if it registered; cheap enough to call
+   every few thousand instructions */
+void metrics_poll();
+
+/* Start exporting. Return 0 on success; the socket path must fit in
+   sun_path, and only a socket already there is replaced. */
+int metrics_export_file(const char *path, int interval_ms);
+int metrics_export_socket(const char *path);
+
+/* Stop the exporter and remove the socket */
+void metrics_stop();
+
+#endif
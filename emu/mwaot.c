@@ -0,0 +1,431 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "disasm.h"
+
+#include <string.h>
+
+/*
+  Translates a ROM image into C for aot.h: see there for what is
+  translated and when the interpreter takes over.
+*/
+
+/* What an instruction does to the flow of control */
+#define FLOW_NEXT               0 /* Falls through */
+#define FLOW_END                1 /* Ends its run */
+
+/* What has to be checked after an instruction, which may have changed
+   the register the run is using as program counter */
+#define CHECK_NONE              0
+#define CHECK_REG               1 /* Wrote R(N) */
+#define CHECK_X                 2 /* Wrote R(X) */
+#define CHECK_R2                3 /* Wrote R2 (MARK) */
+
+static uint8_t rom[ROM_BYTES];
+static long rom_size;
+
+/* Instructions the control flow reaches, and where each run starts */
+static uint8_t reached[ROM_BYTES];
+static uint8_t is_entry[ROM_BYTES];
+static uint16_t run_of[ROM_BYTES];
+
+static uint16_t work[ROM_BYTES];
+static int n_work;
+
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-o output.c] [-l listing] rom\n", prog);
+  exit(1);
+}
+
+
+static uint16_t short_target(uint16_t a) {
+  return ((a + 1) & 0xFF00) | rom[a + 1];
+}
+
+
+static uint16_t long_target(uint16_t a) {
+  return rom[a + 1] << 8 | rom[a + 2];
+}
+
+
+/* Instructions with operands running off the end of the ROM are left
+   to the interpreter */
+static int fits(uint16_t a) {
+  return a < ROM_BYTES && a + dis_length(rom[a]) <= ROM_BYTES;
+}
+
+
+/* LBQ, LBZ, LBDF, LBNQ, LBNZ, LBNF */
+static int long_branch(uint8_t op) {
+  return (op >= 0xC1 && op <= 0xC3) || (op >= 0xC9 && op <= 0xCB);
+}
+
+
+static void push(uint16_t a) {
+  if (fits(a) && !is_entry[a]) {
+    is_entry[a] = 1;
+    work[n_work++] = a;
+  }
+}
+
+
+/* Follow the flow of control from the pending entry points */
+static void follow() {
+  uint16_t a;
+  uint8_t op;
+
+  while (n_work) {
+    a = work[--n_work];
+    while (fits(a) && !reached[a]) {
+      reached[a] = 1;
+      op = rom[a];
+      if (op == 0x30) {                         /* BR */
+        push(short_target(a));
+        break;
+      } else if ((op & 0xF0) == 0x30 && op != 0x38) {
+        push(short_target(a));                  /* Bcc */
+        push(a + 2);
+        break;
+      } else if (op == 0xC0) {                  /* LBR */
+        push(long_target(a));
+        break;
+      } else if (long_branch(op)) {             /* LBcc */
+        push(long_target(a));
+        push(a + 3);
+        break;
+      } else if (op == 0x38 || op == 0xC8) {    /* SKP, LSKP */
+        push(a + (op == 0x38 ? 2 : 3));
+        break;
+      } else if ((op & 0xF0) == 0xC0 && op != 0xC4) {
+        push(a + 1);                            /* Long skips */
+        push(a + 3);
+        break;
+      } else if ((op & 0xF0) == 0xD0) {         /* SEP */
+        /* Whatever it calls comes back with a SEP to here; SEP R4 may
+           be an SCRT call, with its target inline */
+        if (op == 0xD4 && fits(a + 2)) {
+          push(long_target(a));
+          push(a + 3);
+        }
+        push(a + 1);
+        break;
+      } else if (op == 0x00) {                  /* IDL: an interrupt returns here */
+        push(a + 1);
+        break;
+      } else if (op == 0x70 || op == 0x71) {    /* RET, DIS */
+        break;
+      }
+      a += dis_length(op);
+    }
+  }
+}
+
+
+/* A PLO into the program counter is a jump within its page; the
+   firmware's threaded code interpreter dispatches that way (LDA R3;
+   PLO R7 at 011D). The targets are bytecodes, so instead every
+   instruction in a page with a PLO in it, from the first reached one on,
+   is taken as an entry. Returns the number of new entries. */
+static int sweep_pages() {
+  uint16_t page, a;
+  int plo, before = n_work;
+
+  for (page = 0; page < ROM_BYTES; page += 0x100) {
+    plo = 0;
+    for (a = page; a < page + 0x100; a++)
+      if (reached[a] && (rom[a] & 0xF0) == 0xA0) plo = 1;
+    if (!plo) continue;
+    for (a = page; a < page + 0x100 && !reached[a]; a++)
+      ;
+    for (; a < page + 0x100 && fits(a); a += dis_length(rom[a]))
+      push(a);
+  }
+  return n_work - before;
+}
+
+
+static void discover() {
+  uint16_t a;
+
+  push(0x0000);
+  /* 16 bit constants into the ROM (LDI hi; PHI r; LDI lo; PLO r) are
+     most likely SEP targets, such as the interrupt routine */
+  for (a = 0; a + 5 < ROM_BYTES; a++)
+    if (rom[a] == 0xF8 && rom[a + 3] == 0xF8 && (rom[a + 2] & 0xF0) == 0xB0 &&
+        rom[a + 5] == (rom[a + 2] ^ 0x10))
+      push(rom[a + 1] << 8 | rom[a + 4]);
+
+  do {
+    follow();
+  } while (sweep_pages());
+}
+
+
+/* The ALU operation of op on D and the byte m, as C */
+static void emit_alu(FILE *f, uint8_t op, const char *m) {
+  switch (op & 0x87) {
+  case 0x80: fprintf(f, "    r.D = %s;\n", m); break;                    /* LDX, LDI */
+  case 0x81: fprintf(f, "    r.D |= %s;\n", m); break;                   /* OR */
+  case 0x82: fprintf(f, "    r.D &= %s;\n", m); break;                   /* AND */
+  case 0x83: fprintf(f, "    r.D ^= %s;\n", m); break;                   /* XOR */
+  case 0x84: fprintf(f, "    t = r.D + %s;\n", m); break;                /* ADD */
+  case 0x85: fprintf(f, "    t = %s + 0xFF - r.D + 1;\n", m); break;     /* SD */
+  case 0x87: fprintf(f, "    t = r.D + 0xFF - %s + 1;\n", m); break;     /* SM */
+  case 0x04: fprintf(f, "    t = r.D + %s + r.DF;\n", m); break;         /* ADC */
+  case 0x05: fprintf(f, "    t = %s + 0xFF - r.D + r.DF;\n", m); break;  /* SDB */
+  case 0x07: fprintf(f, "    t = r.D + 0xFF - %s + r.DF;\n", m); break;  /* SMB */
+  }
+  if ((op & 0x04) && (op & 0x03) != 0x02)
+    fprintf(f, "    r.DF = t > 0xFF;\n    r.D = t;\n");
+}
+
+
+/* I/O, and Q for the beeper, go through the core where devices see
+   them, at the cycle the interpreter would have got to (c already
+   counts this instruction) */
+static void emit_device(FILE *f, uint8_t op) {
+  fprintf(f, "    totals.cycles += c - 2;\n    Tabula[0x%02X].fn();\n"
+          "    totals.cycles -= c - 2;\n", op);
+}
+
+
+/* One instruction's C. Returns FLOW_END if the run stops after it. */
+static int emit_insn(FILE *f, uint16_t a, int *check) {
+  static const char *cond[16] = {
+    "1", "r.Q", "r.D == 0", "r.DF", "io.EF1", "io.EF2", "io.EF3", "io.EF4",
+    "0", "!r.Q", "r.D != 0", "!r.DF", "!io.EF1", "!io.EF2", "!io.EF3", "!io.EF4"
+  };
+  uint8_t op = rom[a], k = op & 0x0F;
+  char m[16];
+
+  *check = CHECK_NONE;
+  switch (op >> 4) {
+  case 0x0:
+    fprintf(f, "    *pc = 0x%04X;\n", a + 1);
+    if (op == 0x00) {
+      fprintf(f, "    r.IDLE = 1;\n");
+      return FLOW_END;
+    }
+    fprintf(f, "    r.D = mem_read(r.R[%d]);\n", k);
+    return FLOW_NEXT;
+  case 0x1:
+  case 0x2:
+    fprintf(f, "    *pc = 0x%04X;\n    r.R[%d]%s;\n", a + 1, k, op < 0x20 ? "++" : "--");
+    *check = CHECK_REG;
+    return FLOW_NEXT;
+  case 0x3:
+    if (op == 0x38)
+      fprintf(f, "    *pc = 0x%04X;\n", a + 2);
+    else
+      fprintf(f, "    *pc = %s ? 0x%04X : 0x%04X;\n", cond[k], short_target(a), a + 2);
+    return FLOW_END;
+  case 0x4:
+    fprintf(f, "    *pc = 0x%04X;\n    r.D = mem_read(r.R[%d]);\n    r.R[%d]++;\n",
+            a + 1, k, k);
+    *check = CHECK_REG;
+    return FLOW_NEXT;
+  case 0x5:
+    fprintf(f, "    *pc = 0x%04X;\n    mem_write(r.R[%d], r.D);\n", a + 1, k);
+    return FLOW_NEXT;
+  case 0x6:
+    if (op == 0x60) {
+      fprintf(f, "    *pc = 0x%04X;\n    r.R[r.X]++;\n", a + 1);
+      *check = CHECK_X;
+      return FLOW_NEXT;
+    }
+    emit_device(f, op);
+    if (op < 0x68) *check = CHECK_X;
+    return FLOW_NEXT;
+  case 0x7:
+    switch (op) {
+    case 0x70: case 0x71: case 0x78: case 0x79:
+      fprintf(f, "    Tabula[0x%02X].fn();\n", op);
+      if (op == 0x79) *check = CHECK_R2;
+      return op < 0x72 ? FLOW_END : FLOW_NEXT;
+    case 0x72:
+      fprintf(f, "    *pc = 0x%04X;\n    r.D = mem_read(r.R[r.X]);\n    r.R[r.X]++;\n", a + 1);
+      *check = CHECK_X;
+      return FLOW_NEXT;
+    case 0x73:
+      fprintf(f, "    *pc = 0x%04X;\n    mem_write(r.R[r.X], r.D);\n    r.R[r.X]--;\n", a + 1);
+      *check = CHECK_X;
+      return FLOW_NEXT;
+    case 0x7A: case 0x7B:
+      emit_device(f, op);
+      return FLOW_NEXT;
+    case 0x76:
+      fprintf(f, "    *pc = 0x%04X;\n    t = r.DF;\n    r.DF = r.D & 1;\n"
+              "    r.D = r.D >> 1 | t << 7;\n", a + 1);
+      return FLOW_NEXT;
+    case 0x7E:
+      fprintf(f, "    *pc = 0x%04X;\n    t = r.DF;\n    r.DF = r.D >> 7;\n"
+              "    r.D = r.D << 1 | t;\n", a + 1);
+      return FLOW_NEXT;
+    }
+    break;
+  case 0x8:
+    fprintf(f, "    *pc = 0x%04X;\n    r.D = r.R[%d];\n", a + 1, k);
+    return FLOW_NEXT;
+  case 0x9:
+    fprintf(f, "    *pc = 0x%04X;\n    r.D = r.R[%d] >> 8;\n", a + 1, k);
+    return FLOW_NEXT;
+  case 0xA:
+    fprintf(f, "    *pc = 0x%04X;\n    r.R[%d] = (r.R[%d] & 0xFF00) | r.D;\n", a + 1, k, k);
+    *check = CHECK_REG;
+    return FLOW_NEXT;
+  case 0xB:
+    fprintf(f, "    *pc = 0x%04X;\n    r.R[%d] = r.D << 8 | (r.R[%d] & 0xFF);\n", a + 1, k, k);
+    *check = CHECK_REG;
+    return FLOW_NEXT;
+  case 0xC:
+    if (op == 0xC4) {
+      fprintf(f, "    *pc = 0x%04X;\n", a + 1);
+      return FLOW_NEXT;
+    }
+    if (op == 0xC8) {
+      fprintf(f, "    *pc = 0x%04X;\n", a + 3);
+    } else if (op == 0xCC) {
+      fprintf(f, "    *pc = r.IE ? 0x%04X : 0x%04X;\n", a + 3, a + 1);
+    } else if (op & 0x04) {
+      /* Long skips: LSNQ is C5 where LBNQ is C9, LSQ is CD where LBQ
+         is C1, and so on */
+      fprintf(f, "    *pc = %s ? 0x%04X : 0x%04X;\n", cond[k ^ 0x0C], a + 3, a + 1);
+    } else {
+      fprintf(f, "    *pc = %s ? 0x%04X : 0x%04X;\n", cond[k], long_target(a), a + 3);
+    }
+    return FLOW_END;
+  case 0xD:
+    fprintf(f, "    *pc = 0x%04X;\n    r.N = %d;\n    r.P = %d;\n", a + 1, k, k);
+    return FLOW_END;
+  case 0xE:
+    fprintf(f, "    *pc = 0x%04X;\n    r.N = %d;\n    r.X = %d;\n", a + 1, k, k);
+    return FLOW_NEXT;
+  }
+
+  /* Fx and the 7x arithmetic */
+  if (op == 0xF6) {
+    fprintf(f, "    *pc = 0x%04X;\n    r.DF = r.D & 1;\n    r.D >>= 1;\n", a + 1);
+  } else if (op == 0xFE) {
+    fprintf(f, "    *pc = 0x%04X;\n    r.DF = r.D >> 7;\n    r.D <<= 1;\n", a + 1);
+  } else if (op & 0x08) {
+    snprintf(m, sizeof(m), "0x%02X", rom[a + 1]);
+    fprintf(f, "    *pc = 0x%04X;\n", a + 2);
+    emit_alu(f, op, m);
+  } else {
+    fprintf(f, "    *pc = 0x%04X;\n", a + 1);
+    emit_alu(f, op, "mem_read(r.R[r.X])");
+  }
+  return FLOW_NEXT;
+}
+
+
+static void emit_exit(FILE *f, const char *cond) {
+  fprintf(f, "    if (%s) return AOT_RESULT(n, c);\n", cond);
+}
+
+
+/* A run: the instructions from a up to the one that ends it, with an
+   entry for each. Returns the number of instructions. */
+static int emit_run(FILE *f, uint16_t a) {
+  char line[DIS_MAX], *body, *p;
+  size_t size;
+  FILE *code;
+  uint16_t b;
+  int check, flow, insns = 0;
+
+  code = open_memstream(&body, &size);
+  fprintf(f, "\nstatic uint32_t run_%04X(uint16_t entry) {\n"
+          "  uint16_t *pc = &r.R[r.P];\n"
+          "  unsigned int n = 0, c = 0, t;\n\n"
+          "  (void)pc;\n  (void)t;\n"
+          "  switch (entry) {\n", a);
+  for (b = a; ; b += dis_length(rom[b])) {
+    run_of[b] = a + 1;
+    insns++;
+    fprintf(f, "  case 0x%04X: goto a%04X;\n", b, b);
+
+    dis_format(b, rom + b, line);
+    /* Listing comments must not end ours */
+    while ((p = strstr(line, "*/"))) p[0] = '+';
+    fprintf(code, "a%04X: /* %s */\n    n++;\n    c += %d;\n", b, line,
+            (rom[b] >> 4) == 0xC ? 3 : 2);
+    flow = emit_insn(code, b, &check);
+    if (flow == FLOW_END) break;
+    if (check == CHECK_REG) {
+      snprintf(line, sizeof(line), "r.P == %d", rom[b] & 0x0F);
+      emit_exit(code, line);
+    } else if (check == CHECK_X) {
+      emit_exit(code, "r.P == r.X");
+    } else if (check == CHECK_R2) {
+      emit_exit(code, "r.P == 2");
+    }
+    /* The next instruction may already be in another run */
+    if (!fits(b + dis_length(rom[b])) || run_of[b + dis_length(rom[b])]) break;
+  }
+  fclose(code);
+  fprintf(f, "  }\n  return 0;\n\n%s  return AOT_RESULT(n, c);\n}\n", body);
+  free(body);
+  return insns;
+}
+
+
+int main(int argc, char **argv) {
+  int c, runs = 0, insns = 0;
+  char *lst = NULL, *out = NULL;
+  uint16_t a;
+  FILE *f;
+
+  while ((c = getopt(argc, argv, "o:l:")) != -1) {
+    switch (c) {
+    case 'o': out = optarg; break;
+    case 'l': lst = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind >= argc) usage(argv[0]);
+
+  if (lst && dis_load_lst(lst) < 0) {
+    fprintf(stderr, "Cannot open listing \"%s\".\n", lst);
+    exit(1);
+  }
+
+  f = fopen(argv[optind], "r");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open ROM image \"%s\".\n", argv[optind]);
+    exit(1);
+  }
+  rom_size = fread(rom, 1, ROM_BYTES, f);
+  fclose(f);
+
+  f = out ? fopen(out, "w") : stdout;
+  if (f == NULL) {
+    fprintf(stderr, "Cannot write \"%s\".\n", out);
+    exit(1);
+  }
+
+  discover();
+
+  fprintf(f, "/* %s translated by mwaot: do not edit */\n\n"
+          "#include \"mwemu.h\"\n#include \"1802.h\"\n#include \"aot.h\"\n\n"
+          "static const uint8_t rom[ROM_BYTES] = {", argv[optind]);
+  for (a = 0; a < ROM_BYTES; a++)
+    fprintf(f, "%s0x%02X,", a % 12 ? " " : "\n  ", rom[a]);
+  fprintf(f, "\n};\n\nstatic aot_image image;\n");
+
+  for (a = 0; a < ROM_BYTES; a++) {
+    if (!reached[a] || run_of[a]) continue;
+    insns += emit_run(f, a);
+    runs++;
+  }
+
+  fprintf(f, "\n\nstatic int install() {\n  image.rom = rom;\n");
+  for (a = 0; a < ROM_BYTES; a++)
+    if (run_of[a]) fprintf(f, "  image.run[0x%04X] = run_%04X;\n", a, run_of[a] - 1);
+  fprintf(f, "  return aot_register(&image);\n}\n\n"
+          "static int installed = install();\n");
+  if (f != stdout) fclose(f);
+
+  fprintf(stderr, "%ld bytes: %d runs, %d instructions translated.\n",
+          rom_size, runs, insns);
+  return 0;
+}
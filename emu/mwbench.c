@@ -0,0 +1,578 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "perfctr.h"
+#include "lanes.h"
+#include "fuse.h"
+#include "aot.h"
+#include "keys.h"
+#include "lcd.h"
+#include "line.h"
+
+#include <string.h>
+#include <time.h>
+
+/*
+  Emulator benchmarks. Each one is run several times and the fastest run
+  is reported, as MIPS and ns per instruction (or ns per operation for
+  the snapshot benchmarks). -o writes the same figures as a tab-separated
+  file; -c compares this run against such a file and fails if anything
+  got slower by more than the threshold. -P adds host performance
+  counters per benchmark, summed over all its runs.
+*/
+
+#define RESULTS_MAX             16
+#define NAME_MAX                32
+
+/* Steps the firmware gets to go idle again after an interrupt */
+#define TICK_BUDGET             1000000
+
+typedef struct _bench_result {
+  char name[NAME_MAX];
+  const char *unit;
+  uint64_t count;
+  double ns;
+  perf_counts perf;
+} bench_result;
+
+static bench_result results[RESULTS_MAX];
+static int n_results;
+static int runs = 3;
+static cpu_snapshot boot;
+static int use_perf;
+static perf_counts phase_perf;
+
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* Time a measured region, counting it into phase_perf under -P */
+static double timer_start() {
+  if (use_perf) perf_begin();
+  return now_ns();
+}
+
+
+static double timer_stop(double t0) {
+  double t = now_ns() - t0;
+  if (use_perf) perf_end(&phase_perf);
+  return t;
+}
+
+
+static void report(const char *name, const char *unit, uint64_t count, double ns) {
+  bench_result *b = &results[n_results++];
+  snprintf(b->name, NAME_MAX, "%s", name);
+  b->unit = unit;
+  b->count = count;
+  b->ns = ns;
+  b->perf = phase_perf;
+  memset(&phase_perf, 0, sizeof(phase_perf));
+  if (!strcmp(unit, "insn"))
+    printf("%-12s %10llu insns %10.3f ms %8.2f MIPS %8.2f ns/insn\n", name,
+           (unsigned long long)count, ns / 1e6, count / (ns / 1e3), ns / count);
+  else
+    printf("%-12s %10llu %-5s %10.3f ms %17s %8.2f ns/%s\n", name,
+           (unsigned long long)count, unit, ns / 1e6, "", ns / count, unit);
+  if (use_perf) perf_print(stdout, "  host", &b->perf, count * runs, unit);
+}
+
+
+/* Opcode classes: a loop at 0000 that keeps to one kind of instruction */
+
+static const uint8_t prog_reg[] = {
+  0x87, 0xFC, 0x01, 0xA7,       /* GLO R7; ADI 01; PLO R7 */
+  0x97, 0x7C, 0x00, 0xB7,       /* GHI R7; ADCI 00; PHI R7 */
+  0x18, 0x29, 0xF6, 0xFE,       /* INC R8; DEC R9; SHR; SHL */
+  0x89, 0xFB, 0x5A, 0xA9,       /* GLO R9; XRI 5A; PLO R9 */
+  0x30, 0x00                    /* BR 00 */
+};
+
+static const uint8_t prog_mem[] = {
+  0x52, 0x02, 0xF0, 0xF4,       /* STR R2; LDN R2; LDX; ADD */
+  0x73, 0x60, 0x42, 0x22,       /* STXD; IRX; LDA R2; DEC R2 */
+  0xF2, 0x52, 0x72, 0x22,       /* AND; STR R2; LDXA; DEC R2 */
+  0x30, 0x00                    /* BR 00 */
+};
+
+static const uint8_t prog_branch[] = {
+  0x32, 0x03,                   /* 00: BZ 03 (taken) */
+  0x00,
+  0x3A, 0x00,                   /* 03: BNZ 00 (not taken) */
+  0x30, 0x08,                   /* 05: BR 08 */
+  0x00,
+  0x3B, 0x0B,                   /* 08: BNF 0B (taken) */
+  0x00,
+  0x33, 0x00,                   /* 0B: BDF 00 (not taken) */
+  0x38, 0x00,                   /* 0D: SKP */
+  0x30, 0x00                    /* 0F: BR 00 */
+};
+
+static const uint8_t prog_long[] = {
+  0xC0, 0x00, 0x04,             /* 00: LBR 0004 */
+  0x00,
+  0xC8, 0x00, 0x00,             /* 04: LSKP */
+  0xC2, 0x00, 0x0B,             /* 07: LBZ 000B (taken) */
+  0x00,
+  0xCA, 0x00, 0x00,             /* 0B: LBNZ 0000 (not taken) */
+  0xCE, 0x00, 0x00,             /* 0E: LSZ (skips) */
+  0xC6,                         /* 11: LSNZ (doesn't) */
+  0xC4,                         /* 12: NOP */
+  0xC0, 0x00, 0x00              /* 13: LBR 0000 */
+};
+
+static const uint8_t prog_ctl[] = {
+  0xE3, 0x7B, 0xD0, 0xF6,       /* SEX R3; SEQ; SEP R0; SHR */
+  0xE2, 0x7A, 0xD0, 0x76,       /* SEX R2; REQ; SEP R0; SHRC */
+  0xFF, 0x01, 0x7E, 0xFE,       /* SMI 01; SHLC; SHL */
+  0x30, 0x00                    /* BR 00 */
+};
+
+
+static void bench_class(const char *name, const uint8_t *prog, int len, long insns) {
+  double best = 0, t;
+  long i;
+  int run, a;
+
+  for (run = 0; run < runs; run++) {
+    memset(mem, 0, MEM_BYTES);
+    for (a = 0; a < len; a++) mem_poke(a, prog[a]);
+    cpu_reset();
+    r.D = 0;
+    r.DF = 0;
+    r.X = 2;
+    r.R[2] = 0x4000;
+
+    t = timer_start();
+    for (i = 0; i < insns; i++) cpu_cycle();
+    t = timer_stop(t);
+    if (!run || t < best) best = t;
+  }
+  report(name, "insn", insns, best);
+}
+
+
+/* Firmware workloads */
+
+/* Outcomes of a chord, by KEY_ code */
+static const char *outcomes[] = {"ok", "hang", "ROM write", "ran outside ROM"};
+
+
+/* A chord that didn't come back leaves nothing worth timing or
+   comparing: the workloads type text the firmware takes */
+static void chord_failed(const char *what, unsigned int c, int res) {
+  fprintf(stderr, "%s: chord %u: %s at %.4x.\n", what, c, outcomes[res], PC());
+  exit(1);
+}
+
+
+static void bench_boot(const char *rom, int boots) {
+  cpu_snapshot *reset = (cpu_snapshot *)malloc(sizeof(cpu_snapshot));
+  double best = 0, t, total;
+  uint64_t insns = 0;
+  int run, i, res;
+
+  memset(mem, 0, MEM_BYTES);
+  cpu_reset();
+  load_rom((char *)rom);
+  key_idle();
+  cpu_save(reset);
+
+  for (run = 0; run < runs; run++) {
+    total = 0;
+    insns = 0;
+    for (i = 0; i < boots; i++) {
+      cpu_restore(reset);
+      t = timer_start();
+      while (!r.IDLE) {
+        cpu_cycle();
+        insns++;
+      }
+      total += timer_stop(t);
+    }
+    if (!run || total < best) best = total;
+  }
+  /* Keep the idle machine, set up, for the workloads that follow */
+  if ((res = key_setup(TICK_BUDGET)) != KEY_OK) chord_failed("setup", 0, res);
+  cpu_save(&boot);
+  free(reset);
+  report("boot", "insn", insns, best);
+}
+
+
+/* Let the firmware handle one interrupt with the current inputs.
+   Instructions are counted from totals, as fused steps run several. */
+static uint64_t tick() {
+  uint64_t start = totals.insns;
+  key_tick(TICK_BUDGET);
+  return totals.insns - start;
+}
+
+
+/* "the quick brown fox jumps over the lazy dog." in CyChordTable chords */
+static const uint8_t text[] = {
+  20, 34, 4, 2, 40, 32, 6, 10, 18, 2, 56, 22, 8, 54, 24, 2,
+  30, 8, 58, 2, 50, 32, 60, 62, 16, 2, 8, 36, 4, 22, 2, 20,
+  34, 4, 2, 38, 12, 42, 26, 2, 14, 8, 48, 28
+};
+
+
+/* Register, counter and memory differences between two machines */
+static int same_machine(const cpu_snapshot *a, const cpu_snapshot *b) {
+  int k;
+  for (k = 0; k < 16; k++)
+    if (a->r.R[k] != b->r.R[k]) return 0;
+  return a->r.D == b->r.D && a->r.DF == b->r.DF && a->r.B == b->r.B &&
+    a->r.P == b->r.P && a->r.X == b->r.X && a->r.N == b->r.N &&
+    a->r.T == b->r.T && a->r.IE == b->r.IE && a->r.Q == b->r.Q &&
+    a->r.IDLE == b->r.IDLE && a->bus == b->bus &&
+    a->cycles == b->cycles && a->interrupts == b->interrupts &&
+    !memcmp(a->mem, b->mem, MEM_BYTES);
+}
+
+
+/* Type the text repeat times, from the boot snapshot */
+static uint64_t chords(int repeat) {
+  uint64_t start = totals.insns;
+  unsigned int c;
+  int i, res;
+
+  cpu_restore(&boot);
+  for (i = 0; i < repeat; i++)
+    for (c = 0; c < sizeof(text); c++)
+      if ((res = key_chord(KEY_CY(text[c]), TICK_BUDGET)) != KEY_OK)
+        chord_failed("chords", c, res);
+  return totals.insns - start;
+}
+
+
+static void bench_chords(int repeat) {
+  double best = 0, t;
+  uint64_t insns = 0;
+  int run;
+
+  for (run = 0; run < runs; run++) {
+    t = timer_start();
+    insns = chords(repeat);
+    t = timer_stop(t);
+    if (!run || t < best) best = t;
+  }
+  report("chords", "insn", insns, best);
+}
+
+
+/* Type the text once from boot. Whenever a chord redraws the display it
+   must show the tail of the line in RAM, as the firmware draws it;
+   between redraws RAM can be ahead (the cursor). Returns the number of
+   redraws that didn't. */
+static int check_display() {
+  uint8_t cells[LINE_CELLS];
+  uint64_t frame;
+  unsigned int c;
+  int wrong = 0, res;
+
+  cpu_restore(&boot);
+  for (c = 0; c < sizeof(text); c++) {
+    frame = lcd.frame;
+    if ((res = key_chord(KEY_CY(text[c]), TICK_BUDGET)) != KEY_OK)
+      chord_failed("display", c, res);
+    if (lcd.frame == frame) continue;
+    if (line_cells(cells, LINE_CELLS) != LINE_CELLS ||
+        memcmp(cells, lcd.fb[0], LINE_CELLS)) {
+      fprintf(stderr, "Display differs from the line in RAM after chord %u.\n", c);
+      wrong++;
+    }
+  }
+  return wrong;
+}
+
+
+static int start_fuse() {
+  fuse_start();
+  return 1;
+}
+
+
+/* The chord workload with one of the faster engines switched on, if
+   start() can. Returns 1 if it came out unlike the same run through the
+   plain interpreter. */
+static int bench_engine(const char *name, int (*start)(), void (*stop)(),
+                        const uint64_t *engine_insns, int repeat) {
+  cpu_snapshot *want = (cpu_snapshot *)malloc(sizeof(cpu_snapshot));
+  cpu_snapshot *got = (cpu_snapshot *)malloc(sizeof(cpu_snapshot));
+  double best = 0, t;
+  uint64_t insns = 0, want_insns;
+  int run, wrong;
+
+  want_insns = chords(repeat);
+  cpu_save(want);
+
+  if (!start()) {
+    free(want);
+    free(got);
+    return 0;
+  }
+  for (run = 0; run < runs; run++) {
+    t = timer_start();
+    insns = chords(repeat);
+    t = timer_stop(t);
+    if (!run || t < best) best = t;
+  }
+  stop();
+  cpu_save(got);
+
+  wrong = insns != want_insns || !same_machine(want, got);
+  if (wrong) fprintf(stderr, "%s chords differ from cpu_cycle().\n", name);
+  report(name, "insn", insns, best);
+  printf("  %.1f%% of instructions run by it\n",
+         100.0 * *engine_insns / (insns * runs));
+  free(want);
+  free(got);
+  return wrong;
+}
+
+
+/* Interrupts with no key down: the firmware's idle housekeeping */
+static void bench_idle(int ticks) {
+  double best = 0, t;
+  uint64_t insns = 0;
+  int run, i;
+
+  for (run = 0; run < runs; run++) {
+    cpu_restore(&boot);
+    insns = 0;
+    t = timer_start();
+    for (i = 0; i < ticks; i++) insns += tick();
+    t = timer_stop(t);
+    if (!run || t < best) best = t;
+  }
+  report("idle", "insn", insns, best);
+}
+
+
+/* Where lane l of the lanes benchmark starts: up to 15 ticks after the
+   boot snapshot, so the lanes are at different points of the firmware's
+   housekeeping and don't all take the same path through it */
+static void lane_start(int l) {
+  int k;
+  cpu_restore(&boot);
+  for (k = 0; k < l % 16; k++) tick();
+}
+
+
+/* Whether lane l fell over during the chord just typed, as key_chord()
+   would have found: not back at IDL in ROM with interrupts on */
+static int lane_failed(const lanes *L, int l) {
+  return !L->IDLE[l] || !L->IE[l] || L->rom_writes[l] ||
+    L->R[L->P[l]][l] >= ROM_BYTES;
+}
+
+
+/* The chord workload on n machines at once, each starting at a
+   different letter, so that they take different paths through the
+   firmware. Returns the number of lanes that came out unlike the same
+   input run through cpu_cycle(), or 1 if the lanes never split up. */
+static int bench_lanes(int n, int repeat) {
+  cpu_snapshot *want = (cpu_snapshot *)malloc(sizeof(cpu_snapshot));
+  cpu_snapshot *got = (cpu_snapshot *)malloc(sizeof(cpu_snapshot));
+  lanes *L = NULL;
+  double best = 0, t;
+  uint64_t insns = 0;
+  unsigned int c;
+  int run, i, k, l, res, wrong = 0;
+
+  for (run = 0; run < runs; run++) {
+    if (L) lanes_free(L);
+    L = lanes_new(n, &boot);
+    for (l = 0; l < n; l++) {
+      lane_start(l);
+      cpu_save(want);
+      lanes_set(L, l, want);
+    }
+    insns = 0;
+    t = timer_start();
+    for (i = 0; i < repeat; i++) {
+      for (c = 0; c < sizeof(text); c++) {
+        for (l = 0; l < n; l++)
+          L->io[l].IN[KEY_PORT] = KEY_DOWN(KEY_CY(text[(c + l) % sizeof(text)]));
+        insns += lanes_tick(L, TICK_BUDGET);
+        for (l = 0; l < n; l++) L->io[l].IN[KEY_PORT] = KEY_UP;
+        for (k = 0; k < KEY_RELEASE_TICKS; k++) insns += lanes_tick(L, TICK_BUDGET);
+        for (l = 0; l < n; l++)
+          if (lane_failed(L, l)) {
+            fprintf(stderr, "lanes: lane %d fell over at chord %u.\n", l, c);
+            exit(1);
+          }
+      }
+    }
+    t = timer_stop(t);
+    if (!run || t < best) best = t;
+  }
+
+  for (l = 0; l < n; l++) {
+    lane_start(l);
+    for (i = 0; i < repeat; i++)
+      for (c = 0; c < sizeof(text); c++)
+        if ((res = key_chord(KEY_CY(text[(c + l) % sizeof(text)]), TICK_BUDGET)) != KEY_OK)
+          chord_failed("lanes", c, res);
+    cpu_save(want);
+    lanes_get(L, l, got);
+    if (!same_machine(want, got)) {
+      fprintf(stderr, "Lane %d differs from cpu_cycle().\n", l);
+      wrong++;
+    }
+  }
+
+  report("lanes", "insn", insns, best);
+  printf("  %d lanes, %.1f lanes per opcode issued, %.1f%% one lane at a time\n",
+         n, (double)L->insns / L->steps, 100.0 * L->single / L->insns);
+  /* Every opcode issued to all of them: the splitting and regrouping
+     that the check is for never happened */
+  if (n > 1 && L->insns == L->steps * n) {
+    fprintf(stderr, "Lanes never diverged.\n");
+    wrong++;
+  }
+  lanes_free(L);
+  free(want);
+  free(got);
+  return wrong;
+}
+
+
+static void bench_snapshot(int ops) {
+  cpu_snapshot *s = (cpu_snapshot *)malloc(sizeof(cpu_snapshot));
+  double best_save = 0, best_restore = 0, t;
+  int run, i;
+
+  cpu_restore(&boot);
+  for (run = 0; run < runs; run++) {
+    t = timer_start();
+    for (i = 0; i < ops; i++) cpu_save(s);
+    t = timer_stop(t);
+    if (!run || t < best_save) best_save = t;
+  }
+  report("save", "op", ops, best_save);
+
+  for (run = 0; run < runs; run++) {
+    t = timer_start();
+    for (i = 0; i < ops; i++) cpu_restore(s);
+    t = timer_stop(t);
+    if (!run || t < best_restore) best_restore = t;
+  }
+  free(s);
+  report("restore", "op", ops, best_restore);
+}
+
+
+/* Results files */
+
+static void save_results(const char *filename) {
+  FILE *f = fopen(filename, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot write results \"%s\".\n", filename);
+    exit(1);
+  }
+  int i, k;
+  fprintf(f, "# name\tunit\tcount\ttotal_ns\tns_per_unit"
+          "\tcycles\tinsns\tbranch_misses\tcache_misses\ttask_ns (host, per unit)\n");
+  for (i = 0; i < n_results; i++) {
+    fprintf(f, "%s\t%s\t%llu\t%.0f\t%.3f", results[i].name, results[i].unit,
+            (unsigned long long)results[i].count, results[i].ns,
+            results[i].ns / results[i].count);
+    for (k = 0; k < PERF_COUNTERS; k++) {
+      if (results[i].perf.valid[k])
+        fprintf(f, "\t%.4f", (double)results[i].perf.value[k] / (results[i].count * runs));
+      else
+        fprintf(f, "\t-");
+    }
+    fprintf(f, "\n");
+  }
+  fclose(f);
+}
+
+
+/* Returns the number of benchmarks slower than the baseline by more
+   than threshold percent */
+static int compare_results(const char *filename, double threshold) {
+  FILE *f = fopen(filename, "r");
+  char line[256], name[NAME_MAX], unit[8];
+  double old_per, new_per, change;
+  int i, slower = 0;
+
+  if (f == NULL) {
+    fprintf(stderr, "Cannot read baseline \"%s\".\n", filename);
+    exit(1);
+  }
+  printf("\nAgainst %s:\n", filename);
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%31s %7s %*s %*s %lf", name, unit, &old_per) != 3) continue;
+    for (i = 0; i < n_results && strcmp(results[i].name, name); i++);
+    if (i == n_results) continue;
+    new_per = results[i].ns / results[i].count;
+    change = 100.0 * (new_per - old_per) / old_per;
+    printf("%-12s %8.2f -> %8.2f ns/%s  %+6.1f%%%s\n", name, old_per, new_per,
+           unit, change, change > threshold ? "  SLOWER" : "");
+    if (change > threshold) slower++;
+  }
+  fclose(f);
+  return slower;
+}
+
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-r runs] [-l lanes] [-P] [-o results] [-c baseline [-t percent]] [rom]\n",
+          prog);
+  exit(1);
+}
+
+
+int main(int argc, char **argv) {
+  int c;
+  char *rom = (char *)"microwriter.rom", *out = NULL, *baseline = NULL;
+  double threshold = 10;
+  int n_lanes = 64, wrong = 0;
+
+  while ((c = getopt(argc, argv, "r:l:Po:c:t:")) != -1) {
+    switch (c) {
+    case 'r': runs = atoi(optarg); break;
+    case 'l': n_lanes = atoi(optarg); break;
+    case 'P': use_perf = 1; break;
+    case 'o': out = optarg; break;
+    case 'c': baseline = optarg; break;
+    case 't': threshold = atof(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind < argc) rom = argv[optind];
+  if (runs < 1) runs = 1;
+
+  if (use_perf && !perf_open())
+    fprintf(stderr, "No performance counters available; timing only.\n");
+
+  ram_init();
+
+  bench_class("reg", prog_reg, sizeof(prog_reg), 20000000);
+  bench_class("mem", prog_mem, sizeof(prog_mem), 20000000);
+  bench_class("branch", prog_branch, sizeof(prog_branch), 20000000);
+  bench_class("long", prog_long, sizeof(prog_long), 20000000);
+  bench_class("ctl", prog_ctl, sizeof(prog_ctl), 20000000);
+  bench_boot(rom, 500);
+  bench_chords(100);
+  wrong = check_display();
+  wrong += bench_engine("fused", start_fuse, fuse_stop, &fuse_insns, 100);
+  wrong += bench_engine("aot", aot_start, aot_stop, &aot_insns, 100);
+  bench_idle(20000);
+  if (n_lanes) wrong += bench_lanes(n_lanes, 2);
+  bench_snapshot(20000);
+
+  if (out) save_results(out);
+  c = baseline ? compare_results(baseline, threshold) : 0;
+
+  if (use_perf) perf_close();
+  ram_free();
+  return c || wrong ? 1 : 0;
+}
@@ -0,0 +1,86 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "disasm.h"
+
+#include <string.h>
+#include <time.h>
+
+/* Passes over the ROM when timing (-b) */
+#define BENCH_PASSES            1000
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-l listing] [-b] rom\n", prog);
+  exit(1);
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Linear sweep of the image into buf; returns instruction count */
+long sweep(const uint8_t *rom, long size, char *line, int print) {
+  long addr = 0, n = 0;
+  uint8_t code[3];
+  const char *label;
+  while (addr < size) {
+    code[0] = rom[addr];
+    code[1] = (addr + 1 < size) ? rom[addr + 1] : 0;
+    code[2] = (addr + 2 < size) ? rom[addr + 2] : 0;
+    if (print) {
+      label = dis_label(addr);
+      if (label) printf("%s:\n", label);
+    }
+    addr += dis_format(addr, code, line);
+    if (print) puts(line);
+    n++;
+  }
+  return n;
+}
+
+int main(int argc, char **argv) {
+  int c, bench = 0, i;
+  char *lst = NULL;
+  char line[DIS_MAX];
+  uint8_t *rom;
+  long size, n = 0;
+  double t;
+  FILE *f;
+
+  while ((c = getopt(argc, argv, "l:b")) != -1) {
+    switch (c) {
+    case 'l': lst = optarg; break;
+    case 'b': bench = 1; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind >= argc) usage(argv[0]);
+
+  if (lst && dis_load_lst(lst) < 0) {
+    fprintf(stderr, "Cannot open listing \"%s\".\n", lst);
+    exit(1);
+  }
+
+  f = fopen(argv[optind], "r");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open ROM image \"%s\".\n", argv[optind]);
+    exit(1);
+  }
+  rom = (uint8_t *)malloc(MEM_BYTES);
+  size = fread(rom, 1, MEM_BYTES, f);
+  fclose(f);
+
+  if (bench) {
+    t = now();
+    for (i = 0; i < BENCH_PASSES; i++) n = sweep(rom, size, line, 0);
+    t = (now() - t) / BENCH_PASSES;
+    printf("%ld bytes, %ld instructions: %.1f us per pass (%.1f ns/insn)\n",
+           size, n, t * 1e6, t * 1e9 / n);
+  } else {
+    sweep(rom, size, line, 1);
+  }
+
+  free(rom);
+  return 0;
+}
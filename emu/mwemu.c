@@ -1,18 +1,346 @@
 #include "mwemu.h"
 #include "1802.h"
+#include "gdbstub.h"
+#include "disasm.h"
+#include "prof.h"
+#include "cov.h"
+#include "fuse.h"
+#include "aot.h"
+#include "perfctr.h"
+#include "metrics.h"
+#include "bootcache.h"
+#include "nvram.h"
+#include "export.h"
+#include "beep.h"
+#include "serial.h"
+#include "rewind.h"
+#include "statehash.h"
+#include "keys.h"
+
+#include <string.h>
+#include <signal.h>
+
+/* Metrics are published this often, in instructions (a power of two) */
+#define METRICS_EVERY           65536
+
+/* Instructions the firmware gets to reach its first IDL with -b */
+#define BOOT_BUDGET             1000000
+
+/* How often a battery-backed RAM file is checkpointed (see nvram.h) */
+#define CHECKPOINT_MS           10000
+
+/* Machine cycles between state hashes with -H: an emulated millisecond */
+#define HASH_CYCLES             (BEEP_CYCLES_HZ / 1000)
+
+static volatile sig_atomic_t interrupted;
+static int show_lcd;
+static uint64_t lcd_shown;
+static int typing;
+static FILE *hash_log;
+static uint64_t hash_due = UINT64_MAX;
+
+static void on_signal(int sig) {
+  (void)sig;
+  interrupted = 1;
+}
+
+
+/* Print the rows of the display that changed since last time */
+static void lcd_poll() {
+  char text[LCD_COLS + 1];
+  uint32_t dirty;
+  int y;
+  lcd_shown = lcd.frame;
+  if (!show_lcd || !(dirty = lcd_take_dirty())) return;
+  for (y = 0; y < LCD_ROWS; y++) {
+    if (!(dirty >> y & 1)) continue;
+    lcd_text(y, text);
+    printf("LCD %d: |%s|\n", y, text);
+  }
+}
+
+
+/* Log the state's hash, and when to next */
+static void hash_poll() {
+  fprintf(hash_log, "%llu %016llx\n", (unsigned long long)cpu_cycles,
+          (unsigned long long)state_hash());
+  hash_due = (cpu_cycles / HASH_CYCLES + 1) * HASH_CYCLES;
+}
+
+
+/* Run for steps instructions, or until a signal if steps is 0; with
+   to_idle, only until the CPU is idle */
+static long run(long steps, int to_idle) {
+  long i;
+  for (i = 0; (!steps || i < steps) && !interrupted && !(to_idle && r.IDLE); i++) {
+    cpu_cycle();
+    if (typing) typing = key_poll();
+    if (cpu_cycles >= hash_due) hash_poll();
+    /* Every frame, once the firmware has finished drawing it */
+    if (show_lcd && lcd.frame != lcd_shown && r.IDLE) lcd_poll();
+    if (!(i & (METRICS_EVERY - 1))) {
+      metrics_poll();
+      nvram_poll();
+      export_poll();
+      beep_clock(totals.cycles);
+      serial_poll();
+    }
+  }
+  metrics_poll();
+  lcd_poll();
+  return i;
+}
+
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-g port|socket] [-n steps] [-t level] [-l listing]\n"
+          "       [-p profile] [-G ngrams] [-c coverage] [-P] [-S stats_file]\n"
+          "       [-U stats_socket] [-f] [-a] [-b] [-B ram_file]\n"
+          "       [-E export_file [-e addr,bytes]] [-k chords] [-D] [-A audio_file]\n"
+          "       [-T serial_file|pty] [-R history_mb] [-H hash_file] [rom]\n"
+          "-n 0 runs until interrupted. -f fuses common instruction sequences\n"
+          "(see fuse.h), -a runs the ROM's translation if this is mwemu-aot\n"
+          "(see aot.h): a step may then run several instructions. -b starts\n"
+          "from the firmware's first IDL, restored from a cache in $MWEMU_CACHE\n"
+          "or ~/.cache/mwemu when this ROM has been booted before. -B keeps\n"
+          "RAM in ram_file from one session to the next. -E streams the text\n"
+          "in RAM at addr (hex) to export_file as it changes (see export.h).\n"
+          "-k types chords as cyemu.js numbers them (\"12,56,10\"; hex needs\n"
+          "0x) once the firmware is idle, setting RAM up first if it never\n"
+          "was (see keys.h).\n"
+          "-D prints the display whenever it changes. -A writes the beeper's\n"
+          "sound to audio_file (see beep.h). -T sends what the firmware prints\n"
+          "to serial_file, or to a new pseudo-terminal (see serial.h). -R keeps\n"
+          "up to history_mb megabytes of history for the debugger to go back\n"
+          "through (see rewind.h). -H writes a hash of memory and registers\n"
+          "to hash_file every emulated millisecond, for comparing runs made\n"
+          "the same way (see statehash.h).\n", prog);
+  exit(1);
+}
 
 int main(int argc, char **argv) {
-  int i;
+  int c, n;
+  long steps = 10000;
+  char *gdb_spec = NULL;
+  char *lst = NULL;
+  char *prof_file = NULL;
+  char *cov_file = NULL;
+  char *ngram_file = NULL;
+  char *stats_file = NULL;
+  char *stats_socket = NULL;
+  char *ram_file = NULL;
+  char *export_file = NULL;
+  char *audio_file = NULL;
+  char *serial_file = NULL;
+  char *hash_file = NULL;
+  long history_mb = 0;
+  unsigned int export_addr = EXPORT_ADDR, export_bytes = EXPORT_BYTES;
+  int use_perf = 0;
+  int use_fuse = 0;
+  int use_aot = 0;
+  int use_boot = 0;
+  long boot_steps = 0, idle_steps = 0;
+  perf_counts boot_perf, idle_perf;
+  FILE *f;
+  char *rom = (char *)"microwriter.rom";
+
+  /* Full trace unless told otherwise */
+  trace = 2;
+
+  while ((c = getopt(argc, argv, "g:n:t:l:p:G:c:PS:U:fabB:E:e:k:DA:T:R:H:")) != -1) {
+    switch (c) {
+    case 'g': gdb_spec = optarg; break;
+    case 'n': steps = atol(optarg); break;
+    case 't': trace = atoi(optarg); break;
+    case 'l': lst = optarg; break;
+    case 'p': prof_file = optarg; break;
+    case 'G': ngram_file = optarg; break;
+    case 'c': cov_file = optarg; break;
+    case 'P': use_perf = 1; break;
+    case 'S': stats_file = optarg; break;
+    case 'U': stats_socket = optarg; break;
+    case 'f': use_fuse = 1; break;
+    case 'a': use_aot = 1; break;
+    case 'b': use_boot = 1; break;
+    case 'B': ram_file = optarg; break;
+    case 'E': export_file = optarg; break;
+    case 'k':
+      if ((n = key_type(optarg))) {
+        fprintf(stderr, "Chord %d of \"%s\" isn't a number from 1 to 63 "
+                "(hex needs 0x).\n", n, optarg);
+        exit(1);
+      }
+      typing = 1;
+      break;
+    case 'D': show_lcd = 1; break;
+    case 'A': audio_file = optarg; break;
+    case 'T': serial_file = optarg; break;
+    case 'R': history_mb = atol(optarg); break;
+    case 'H': hash_file = optarg; break;
+    case 'e':
+      if (sscanf(optarg, "%x,%u", &export_addr, &export_bytes) != 2 ||
+          export_addr + export_bytes > MEM_BYTES) usage(argv[0]);
+      break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind < argc) rom = argv[optind];
+
+  if (lst && dis_load_lst(lst) < 0) {
+    fprintf(stderr, "Cannot open listing \"%s\".\n", lst);
+    exit(1);
+  }
 
   ram_init();
+  if (ram_file) {
+    c = nvram_open(ram_file, CHECKPOINT_MS);
+    if (c < 0) {
+      fprintf(stderr, "Cannot use \"%s\" as RAM.\n", ram_file);
+      exit(1);
+    }
+    if (c) fprintf(stderr, "\"%s\" wasn't closed; RAM is from its last checkpoint.\n",
+                   ram_file);
+  }
   cpu_reset();
-  load_rom("microwriter.rom");
-  
-  for (i = 0; i < 10000; i++) {
-    cpu_cycle();
+  load_rom(rom);
+  key_idle();
+
+  if (prof_file) prof_start();
+  if (ngram_file) prof_ngram_start();
+  if (cov_file) cov_start();
+  /* The debugger single-steps instructions */
+  if (use_fuse && !gdb_spec) fuse_start();
+  if (use_aot && !gdb_spec && !aot_start())
+    fprintf(stderr, "No translation of this ROM here; interpreting.\n");
+  if (serial_file) {
+    if (serial_open(serial_file, 0)) {
+      fprintf(stderr, "Cannot open serial output \"%s\".\n", serial_file);
+      exit(1);
+    }
+    if (serial_name()) fprintf(stderr, "Serial port on %s\n", serial_name());
+  }
+  if (audio_file && beep_start(audio_file)) {
+    fprintf(stderr, "Cannot write audio to \"%s\".\n", audio_file);
+    exit(1);
+  }
+  /* The debugger starts from reset */
+  if (use_boot && !gdb_spec) {
+    c = boot_cached(boot_cache_dir(), BOOT_BUDGET);
+    if (c < 0) {
+      fprintf(stderr, "Firmware never went idle during boot.\n");
+      exit(1);
+    }
+    printf("%s at %04X after %llu cycles.\n", c ? "Restored boot" : "Booted",
+           PC(), (unsigned long long)cpu_cycles);
+  }
+
+  if (hash_file) {
+    hash_log = strcmp(hash_file, "-") ? fopen(hash_file, "w") : stdout;
+    if (hash_log == NULL) {
+      fprintf(stderr, "Cannot write hashes to \"%s\".\n", hash_file);
+      exit(1);
+    }
+    hash_poll();
+  }
+
+  if (export_file && export_open(export_file, export_addr, export_bytes)) {
+    fprintf(stderr, "Cannot export to \"%s\".\n", export_file);
+    exit(1);
+  }
+
+  if (stats_file || stats_socket) {
+    metrics_register(gdb_spec ? "gdb" : "mwemu");
+    if (stats_socket && metrics_export_socket(stats_socket)) {
+      fprintf(stderr, "Cannot listen on \"%s\".\n", stats_socket);
+      exit(1);
+    }
+    if (stats_file && metrics_export_file(stats_file, 1000)) {
+      fprintf(stderr, "Cannot export metrics to \"%s\".\n", stats_file);
+      exit(1);
+    }
+  }
+  if (!steps || stats_file || stats_socket || ram_file) {
+    /* Stop cleanly, so reports get written and the socket removed */
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+  }
+
+  if (gdb_spec) {
+    /* The debugger drives the CPU; no step limit */
+    if (history_mb && rewind_start((size_t)history_mb << 20)) {
+      fprintf(stderr, "%ld MB won't hold any history.\n", history_mb);
+      exit(1);
+    }
+    gdb_open(gdb_spec);
+    gdb_serve();
+    rewind_stop();
+  } else if (use_perf) {
+    /* Host counters for the boot, and for the rest of the run */
+    memset(&boot_perf, 0, sizeof(boot_perf));
+    memset(&idle_perf, 0, sizeof(idle_perf));
+    if (!perf_open())
+      fprintf(stderr, "No performance counters available.\n");
+    perf_begin();
+    boot_steps = run(steps, 1);
+    perf_end(&boot_perf);
+    perf_begin();
+    if (!steps || boot_steps < steps)
+      idle_steps = run(steps ? steps - boot_steps : 0, 0);
+    perf_end(&idle_perf);
+    perf_close();
+    perf_print(stdout, "boot", &boot_perf, boot_steps, "insn");
+    perf_print(stdout, "idle", &idle_perf, idle_steps, "step");
+  } else {
+    run(steps, 0);
+  }
+  if (hash_log) {
+    hash_poll();
+    if (hash_log != stdout) fclose(hash_log);
+  }
+  metrics_stop();
+  export_close();
+  beep_stop();
+  serial_close();
+  if (beep_dropped)
+    fprintf(stderr, "%llu changes of Q lost.\n", (unsigned long long)beep_dropped);
+
+  if (cpu_fuse) {
+    fuse_stop();
+    fuse_report(stdout);
+  }
+  if (cpu_aot) {
+    aot_stop();
+    printf("%llu of %llu instructions translated\n",
+           (unsigned long long)aot_insns, (unsigned long long)totals.insns);
+  }
+
+  if (prof_file) {
+    f = strcmp(prof_file, "-") ? fopen(prof_file, "w") : stdout;
+    if (f == NULL) {
+      fprintf(stderr, "Cannot write profile \"%s\".\n", prof_file);
+      exit(1);
+    }
+    prof_report(f, 20);
+    if (f != stdout) fclose(f);
+  }
+
+  if (ngram_file) {
+    f = strcmp(ngram_file, "-") ? fopen(ngram_file, "w") : stdout;
+    if (f == NULL) {
+      fprintf(stderr, "Cannot write n-grams \"%s\".\n", ngram_file);
+      exit(1);
+    }
+    prof_ngram_report(f, 30);
+    if (f != stdout) fclose(f);
+  }
+
+  if (cov_file && cov_save(cov_file)) {
+    fprintf(stderr, "Cannot write coverage map \"%s\".\n", cov_file);
+    exit(1);
   }
 
   printf("Done.\n");
+  nvram_close();
   ram_free();
 
   return 0;
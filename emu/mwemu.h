@@ -8,7 +8,14 @@
 #include <ctype.h>
 
 #define MEM_BYTES                65536
-#define MEM_MASK                0x2FFF
+#define MEM_MASK                0xFFFF
+
+/* The firmware ROM sits at the bottom of the address space, and 8K of
+   RAM at 4000 (the firmware clears it up to 6000). Nothing else is
+   decoded. */
+#define ROM_BYTES               8192
+#define RAM_START               0x4000
+#define RAM_END                 0x6000
 
 /* SDL TV */
 // #define VIDEO_WIDTH		1024
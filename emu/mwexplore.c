@@ -0,0 +1,422 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "disasm.h"
+#include "bootcache.h"
+#include "statehash.h"
+#include "keys.h"
+
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/*
+  Breadth-first exploration of what short chord sequences do to the
+  firmware.
+
+  Chords are typed as keys.h describes: after each interrupt the
+  firmware must get back to IDL, with interrupts enabled, within the
+  instruction budget, or that is a hang. Writes into ROM and execution
+  outside ROM are crashes.
+
+  Level 0 is the booted machine, with the chords given by -p typed
+  (from cold RAM, ten letters without a space crash the firmware: see
+  keys.h, and -p lets a short search start near that); level d + 1 is every state that one
+  more chord (of CyChordTable's 31, plain or with Cmd) takes a level d
+  state to and that wasn't seen before. States are told apart by
+  state_hash() (see statehash.h), in a hash set all workers share:
+  inserting is a compare-and-swap into an open-addressed table, so
+  whoever gets there first owns a state and nobody waits. A level
+  holds chord sequences, not machines: a worker replays a sequence from
+  the boot snapshot once, then tries every chord from there.
+
+  A dead state is one that no chord changes.
+
+  Workers are forked processes, one per core, taking states off the
+  level in turn; each level is a new set of them.
+*/
+
+#define DEPTH_MAX               7
+#define PREFIX_MAX              64
+#define JOBS_MAX                256
+#define BOOT_BUDGET             1000000
+
+/* Reproducers printed for dead states, at most */
+#define DEAD_SHOWN              20
+
+/* Outcomes of one chord, by KEY_ code */
+static const char *run_names[] = {"ok", "hang", "romwrite", "badpc"};
+
+/* Chords of CyChordTable in cyemu.js (without the Cmd bit), which is
+   how paths hold them; key_chord() gets them through KEY_CY() */
+static const uint8_t chords[] =
+  {12, 56, 10, 14, 4, 30, 48, 34, 6, 50, 18, 38, 60, 24, 8, 62,
+   40, 22, 16, 20, 32, 36, 54, 58, 26, 42, 2, 28, 52, 44, 46};
+
+#define CHORDS                  (2 * (int)sizeof(chords))
+
+typedef struct _explore_path {
+  uint8_t len;
+  uint8_t chord[DEPTH_MAX];
+} explore_path;
+
+/* One cache line per worker, so counters don't bounce between cores */
+typedef struct _explore_stats {
+  uint64_t execs;
+  uint64_t states;
+  uint64_t hangs;
+  uint64_t crashes;
+  uint64_t dead;
+  uint8_t pad[24];
+} explore_stats;
+
+typedef struct _explore_shared {
+  uint8_t seen[4][MEM_BYTES / 8]; /* Unique (outcome, PC) already shown */
+  explore_stats stats[JOBS_MAX];
+  uint32_t next;      /* The next state of this level to expand */
+  uint32_t n_level[2];
+  uint32_t dead_shown;
+  volatile int full;  /* Some state didn't fit */
+} explore_shared;
+
+static explore_shared *sh;
+
+/* The set of state hashes, 0 marking a free slot */
+static uint64_t *set;
+static uint64_t set_mask;
+
+/* This level's states and the next's */
+static explore_path *level[2];
+static uint32_t level_max;
+
+static cpu_snapshot boot;
+static long budget = 200000;
+
+/* What -p typed after boot, to print ahead of every path */
+static char prefix[PREFIX_MAX * 3 + 1];
+
+
+static uint8_t chord_of(int c) {
+  return chords[c % sizeof(chords)] | (c / sizeof(chords));
+}
+
+
+static void *shared(size_t bytes) {
+  void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  return p;
+}
+
+
+/* Add a state. Returns 1 if it is new, 0 if it was there, -1 if the set
+   is full. */
+static int insert(uint64_t h) {
+  uint64_t i, old;
+  if (!h) h = 1;
+  for (i = h; i < h + set_mask + 1; i++) {
+    old = __atomic_load_n(&set[i & set_mask], __ATOMIC_RELAXED);
+    if (old == h) return 0;
+    if (old) continue;
+    old = 0;
+    if (__atomic_compare_exchange_n(&set[i & set_mask], &old, h, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return 1;
+    if (old == h) return 0;
+  }
+  return -1;
+}
+
+
+static void format_path(char *out, const explore_path *p) {
+  int i;
+  out += sprintf(out, "%s", prefix);
+  for (i = 0; i < p->len; i++)
+    out += sprintf(out, i || *prefix ? " %d" : "%d", p->chord[i]);
+}
+
+
+/* Chords ("12,56,10") into chord, at most max of them. Returns how many,
+   or -1 if one isn't a CyChordTable chord, having said which. */
+static int parse_chords(const char *text, uint8_t *chord, int max) {
+  const char *s = text;
+  char *end;
+  long c;
+  int n;
+
+  for (n = 0; *s; n++) {
+    c = strtol(s, &end, 0);
+    if (end == s || c < 1 || c > 63 || (*end && *end != ',' && *end != ' ')) {
+      fprintf(stderr, "Chord %d of \"%s\" isn't a number from 1 to 63.\n",
+              n + 1, text);
+      return -1;
+    }
+    if (n == max) {
+      fprintf(stderr, "\"%s\" has more than %d chords.\n", text, max);
+      return -1;
+    }
+    chord[n] = c;
+    s = end + (*end != 0);
+  }
+  return n;
+}
+
+
+/* Execution */
+
+/* From boot, type the chords of p. Returns how far that got. */
+static int replay(const explore_path *p) {
+  int i, res;
+  cpu_restore(&boot);
+  for (i = 0; i < p->len; i++)
+    if ((res = key_chord(KEY_CY(p->chord[i]), budget))) return res;
+  return KEY_OK;
+}
+
+
+static void boot_machine(const char *rom, const char *chords) {
+  uint8_t chord[PREFIX_MAX];
+  char *out = prefix;
+  int i, n = 0, res;
+
+  if (chords && (n = parse_chords(chords, chord, PREFIX_MAX)) < 0) exit(1);
+  ram_init();
+  cpu_reset();
+  load_rom((char *)rom);
+  key_idle();
+  /* Run to the first IDL: the firmware is ready for input */
+  if (boot_cached(boot_cache_dir(), BOOT_BUDGET) < 0 || !r.IE) {
+    fprintf(stderr, "Firmware never went idle during boot.\n");
+    exit(1);
+  }
+  for (i = 0; i < n; i++) {
+    out += sprintf(out, i ? " %d" : "%d", chord[i]);
+    if ((res = key_chord(KEY_CY(chord[i]), budget))) {
+      printf("%s at %.4x after %s, before exploring.\n", run_names[res], PC(),
+             prefix);
+      exit(1);
+    }
+  }
+  cpu_save(&boot);
+}
+
+
+/* Workers */
+
+static void record(int worker, int res, const explore_path *p) {
+  explore_stats *st = &sh->stats[worker];
+  char sym[DIS_LABEL_MAX + 8], text[sizeof(prefix) + DEPTH_MAX * 3];
+  uint16_t pc = PC();
+  uint8_t bit = 1 << (pc & 7);
+
+  if (res == KEY_HANG) st->hangs++; else st->crashes++;
+  /* Show one reproducer per outcome and PC */
+  if (__atomic_fetch_or(&sh->seen[res][pc >> 3], bit, __ATOMIC_RELAXED) & bit)
+    return;
+  dis_symbolize(pc, sym);
+  format_path(text, p);
+  printf("[w%d] %s at %s after %s\n", worker, run_names[res], sym, text);
+  fflush(stdout);
+}
+
+
+/* Try every chord in the state p leads to */
+static void expand(int worker, const explore_path *p, int next) {
+  static cpu_snapshot parent;
+  explore_stats *st = &sh->stats[worker];
+  state_hashes hashes;
+  explore_path child;
+  char text[sizeof(prefix) + DEPTH_MAX * 3];
+  uint64_t here, h;
+  uint32_t slot;
+  int c, res, same = 0;
+
+  /* It got here before, so it will again */
+  replay(p);
+  cpu_save(&parent);
+  state_hash_save(&hashes);
+  here = state_hash();
+
+  child = *p;
+  child.len++;
+  for (c = 0; c < CHORDS && !sh->full; c++) {
+    if (c) {
+      cpu_restore(&parent);
+      state_hash_load(&hashes);
+    }
+    child.chord[p->len] = chord_of(c);
+    res = key_chord(KEY_CY(child.chord[p->len]), budget);
+    st->execs++;
+    if (res != KEY_OK) {
+      record(worker, res, &child);
+      continue;
+    }
+    if ((h = state_hash()) == here) {
+      same++;
+      continue;
+    }
+    switch (insert(h)) {
+    case 1:
+      st->states++;
+      slot = __atomic_fetch_add(&sh->n_level[next], 1, __ATOMIC_RELAXED);
+      if (slot < level_max) level[next][slot] = child;
+      else sh->full = 1;
+      break;
+    case -1:
+      sh->full = 1;
+      break;
+    }
+  }
+
+  if (same < CHORDS) return;
+  st->dead++;
+  if (__atomic_fetch_add(&sh->dead_shown, 1, __ATOMIC_RELAXED) >= DEAD_SHOWN) return;
+  format_path(text, p);
+  printf("[w%d] dead after %s\n", worker, *text ? text : "boot");
+  fflush(stdout);
+}
+
+
+static void worker(int id, int cur) {
+  uint32_t i;
+  while (!sh->full) {
+    i = __atomic_fetch_add(&sh->next, 1, __ATOMIC_RELAXED);
+    if (i >= sh->n_level[cur]) break;
+    expand(id, &level[cur][i], !cur);
+  }
+}
+
+
+static void totals_of(int jobs, explore_stats *t) {
+  int i;
+  memset(t, 0, sizeof(*t));
+  for (i = 0; i < jobs; i++) {
+    t->execs += sh->stats[i].execs;
+    t->states += sh->stats[i].states;
+    t->hangs += sh->stats[i].hangs;
+    t->crashes += sh->stats[i].crashes;
+    t->dead += sh->stats[i].dead;
+  }
+}
+
+
+/* Replay one sequence ("12,56,10") with a full trace */
+static int replay_text(const char *text) {
+  explore_path p;
+  int n, res;
+
+  if ((n = parse_chords(text, p.chord, DEPTH_MAX)) < 0) exit(1);
+  p.len = n;
+  trace = 1;
+  res = replay(&p);
+  printf("Result: %s at %.4x, state %016llx\n", run_names[res], PC(),
+         (unsigned long long)state_hash());
+  return res;
+}
+
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-j jobs] [-d depth] [-b budget] [-s states] "
+          "[-l listing] [-p chords] [-r chords] [rom]\n"
+          "Chords are numbered as in cyemu.js (\"12,56,10\"); -p types some\n"
+          "after boot, for the search (or -r's replay) to start from.\n", prog);
+  exit(1);
+}
+
+
+int main(int argc, char **argv) {
+  int c, d, i, running, cur = 0, depth = 3, jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  long states = 1 << 22;
+  char *rom = (char *)"microwriter.rom", *lst = NULL, *input = NULL;
+  char *start = NULL;
+  explore_stats before, after;
+  struct timespec ts;
+  double t0, t1;
+  pid_t pid;
+
+  while ((c = getopt(argc, argv, "j:d:b:s:l:p:r:")) != -1) {
+    switch (c) {
+    case 'j': jobs = atoi(optarg); break;
+    case 'd': depth = atoi(optarg); break;
+    case 'b': budget = atol(optarg); break;
+    case 's': states = atol(optarg); break;
+    case 'l': lst = optarg; break;
+    case 'p': start = optarg; break;
+    case 'r': input = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind < argc) rom = argv[optind];
+  if (jobs < 1) jobs = 1;
+  if (jobs > JOBS_MAX) jobs = JOBS_MAX;
+  if (depth < 1 || depth > DEPTH_MAX || states < 1) usage(argv[0]);
+  if (lst && dis_load_lst(lst) < 0) {
+    fprintf(stderr, "Cannot open listing \"%s\".\n", lst);
+    exit(1);
+  }
+
+  boot_machine(rom, start);
+  if (input) return replay_text(input);
+
+  /* At most half full, so that probes stay short */
+  for (set_mask = 1; set_mask < (uint64_t)states * 2; set_mask <<= 1);
+  level_max = states;
+  set = (uint64_t *)shared((set_mask--) * sizeof(uint64_t));
+  level[0] = (explore_path *)shared(level_max * sizeof(explore_path));
+  level[1] = (explore_path *)shared(level_max * sizeof(explore_path));
+  sh = (explore_shared *)shared(sizeof(explore_shared));
+
+  insert(state_hash());
+  level[0][0].len = 0;
+  sh->n_level[0] = 1;
+  printf("Booted in %llu cycles; %d chords; %d workers.\n",
+         (unsigned long long)boot.cycles, CHORDS, jobs);
+  fflush(stdout);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  t0 = ts.tv_sec + ts.tv_nsec * 1e-9;
+  totals_of(jobs, &before);
+  after = before;
+  for (d = 1; d <= depth && sh->n_level[cur] && !sh->full; d++) {
+    sh->next = 0;
+    sh->n_level[!cur] = 0;
+    for (i = 0; i < jobs; i++) {
+      pid = fork();
+      if (pid < 0) {
+        perror("fork");
+        exit(1);
+      }
+      if (pid == 0) {
+        worker(i, cur);
+        _exit(0);
+      }
+    }
+    for (running = jobs; running > 0; running--) waitpid(-1, NULL, 0);
+
+    totals_of(jobs, &after);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t1 = ts.tv_sec + ts.tv_nsec * 1e-9;
+    printf("depth %d: %u states expanded, %llu new, %llu dead, %llu hangs, "
+           "%llu crashes (%.0f chords/s)\n", d, sh->n_level[cur],
+           (unsigned long long)(after.states - before.states),
+           (unsigned long long)(after.dead - before.dead),
+           (unsigned long long)(after.hangs - before.hangs),
+           (unsigned long long)(after.crashes - before.crashes),
+           (after.execs - before.execs) / (t1 - t0 + 1e-9));
+    fflush(stdout);
+    before = after;
+    t0 = t1;
+    cur = !cur;
+  }
+  if (sh->full)
+    printf("Stopped: more than %ld states (see -s).\n", states);
+  printf("%llu unique states, %llu dead, %llu hangs, %llu crashes.\n",
+         (unsigned long long)after.states + 1, (unsigned long long)after.dead,
+         (unsigned long long)after.hangs, (unsigned long long)after.crashes);
+
+  ram_free();
+  return 0;
+}
@@ -0,0 +1,507 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "disasm.h"
+#include "bootcache.h"
+#include "keys.h"
+
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*
+  Coverage-guided fuzzer for the firmware's input handling.
+
+  An input is a sequence of 4-byte events:
+    byte 0: the inputs are held for 1 + (byte & 3) interrupts
+    byte 1: EF1..EF4 in the low nibble, set where they differ from idle
+    byte 2: input port (1..7) whose latch gets byte 3
+    byte 3: value; on the key port, the keys down in port bits (see
+            keys.h), usually a chord of CyChordTable
+  Keys are typed as key_chord() types them: down, active low, for the
+  event's interrupts, then up for KEY_RELEASE_TICKS. Every run starts
+  with the keys up and the serial line idle (key_idle()).
+  The firmware waits in IDL between interrupts. After each interrupt it must
+  get back to IDL, with interrupts enabled, within the instruction budget,
+  or the input is a hang.
+  Writes into ROM and execution outside ROM are crashes.
+
+  Feedback is AFL-style edge coverage (taken control transfers, with
+  bucketed hit counts). Workers are forked processes, one per core, sharing
+  the virgin map and the corpus through anonymous shared memory.
+*/
+
+#define MAP_SIZE                65536
+#define INPUT_MAX               256
+#define EVENT_BYTES             4
+#define CORPUS_MAX              8192
+#define JOBS_MAX                256
+#define BOOT_BUDGET             1000000
+
+/* Outcomes of one input */
+#define RUN_OK                  0
+#define RUN_HANG                1
+#define RUN_ROM_WRITE           2
+#define RUN_BAD_PC              3
+
+static const char *run_names[] = {"ok", "hang", "romwrite", "badpc"};
+
+typedef struct _fuzz_entry {
+  volatile uint32_t len; /* Written last: nonzero means data is complete */
+  uint8_t data[INPUT_MAX];
+} fuzz_entry;
+
+/* One cache line per worker, so counters don't bounce between cores */
+typedef struct _fuzz_stats {
+  uint64_t execs;
+  uint64_t hangs;
+  uint64_t crashes;
+  uint64_t finds;
+  uint8_t pad[32];
+} fuzz_stats;
+
+typedef struct _fuzz_shared {
+  uint8_t virgin[MAP_SIZE];
+  uint8_t seen[4][MEM_BYTES / 8]; /* Unique (outcome, PC) already saved */
+  fuzz_stats stats[JOBS_MAX];
+  volatile int stop;
+  uint32_t n_corpus;
+  fuzz_entry corpus[CORPUS_MAX];
+} fuzz_shared;
+
+
+/* Chords of CyChordTable in cyemu.js (without the Cmd bit); KEY_CY()
+   makes port bits of them */
+static const uint8_t chords[] =
+  {12, 56, 10, 14, 4, 30, 48, 34, 6, 50, 18, 38, 60, 24, 8, 62,
+   40, 22, 16, 20, 32, 36, 54, 58, 26, 42, 2, 28, 52, 44, 46};
+
+static fuzz_shared *sh;
+static cpu_snapshot boot;
+static uint8_t trace_bits[MAP_SIZE];
+static uint8_t bucket[256];
+static long budget = 200000;
+static const char *out_dir = "fuzz_out";
+static uint64_t rng;
+
+
+/* Helpers */
+
+static uint32_t rnd(uint32_t n) {
+  /* xorshift64* */
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+  return (uint32_t)((rng * 0x2545F4914F6CDD1DULL) >> 32) % n;
+}
+
+
+static void init_buckets() {
+  int i;
+  for (i = 0; i < 256; i++) {
+    if (i <= 3) bucket[i] = i ? (1 << (i - 1)) : 0;
+    else if (i <= 7) bucket[i] = 8;
+    else if (i <= 15) bucket[i] = 16;
+    else if (i <= 31) bucket[i] = 32;
+    else if (i <= 127) bucket[i] = 64;
+    else bucket[i] = 128;
+  }
+}
+
+
+/* Execution */
+
+/* One instruction, recording taken control transfers */
+static int step() {
+  uint16_t pc = PC(), npc;
+  uint8_t code = mem_fetch(pc);
+  uint8_t *b;
+
+  cpu_cycle();
+  npc = PC();
+  if (npc != (uint16_t)(pc + dis_length(code))) {
+    b = &trace_bits[((pc * 0x9E37u) ^ npc) & (MAP_SIZE - 1)];
+    if (*b != 0xFF) (*b)++;
+  }
+  if (npc >= ROM_BYTES) return RUN_BAD_PC;
+  if (rom_writes) return RUN_ROM_WRITE;
+  return RUN_OK;
+}
+
+
+/* One interrupt, and back to IDL */
+static int tick() {
+  long n;
+  int res;
+
+  /* Idle with interrupts off: nothing can ever wake it */
+  if (!r.IE) return RUN_HANG;
+  io.INT = 1;
+  cpu_cycle();
+  io.INT = 0;
+  for (n = 0; n < budget && !r.IDLE; n++)
+    if ((res = step())) return res;
+  return n == budget ? RUN_HANG : RUN_OK;
+}
+
+
+static int run_input(const uint8_t *in, int len) {
+  int e, t, ticks, port, res;
+
+  cpu_restore(&boot);
+  memset(trace_bits, 0, MAP_SIZE);
+
+  for (e = 0; e + EVENT_BYTES <= len; e += EVENT_BYTES) {
+    io.EF1 = in[e + 1] & 1;
+    io.EF2 = !((in[e + 1] >> 1) & 1);
+    io.EF3 = (in[e + 1] >> 2) & 1;
+    io.EF4 = (in[e + 1] >> 3) & 1;
+    port = in[e + 2] & 7;
+    io.IN[port] = port == KEY_PORT ? KEY_DOWN(in[e + 3]) : in[e + 3];
+
+    ticks = 1 + (in[e] & 3);
+    for (t = 0; t < ticks; t++)
+      if ((res = tick())) return res;
+    if (port != KEY_PORT) continue;
+    io.IN[KEY_PORT] = KEY_UP;
+    for (t = 0; t < KEY_RELEASE_TICKS; t++)
+      if ((res = tick())) return res;
+  }
+  return RUN_OK;
+}
+
+
+/* Did the last run reach anything the virgin map hasn't seen? */
+static int new_coverage() {
+  int i, found = 0;
+  uint8_t t;
+  for (i = 0; i < MAP_SIZE; i++) {
+    if (!trace_bits[i]) continue;
+    t = bucket[trace_bits[i]];
+    if (t & sh->virgin[i]) {
+      __atomic_and_fetch(&sh->virgin[i], (uint8_t)~t, __ATOMIC_RELAXED);
+      found = 1;
+    }
+  }
+  return found;
+}
+
+
+static void boot_machine(const char *rom) {
+  ram_init();
+  cpu_reset();
+  load_rom((char *)rom);
+  key_idle();
+  /* Run to the first IDL: the firmware is ready for input */
+  if (boot_cached(boot_cache_dir(), BOOT_BUDGET) < 0 || !r.IE) {
+    fprintf(stderr, "Firmware never went idle during boot.\n");
+    exit(1);
+  }
+  cpu_save(&boot);
+}
+
+
+/* Corpus and findings */
+
+static void save_input(const char *kind, int worker, uint64_t id,
+                       const uint8_t *in, int len) {
+  char name[4096];
+  FILE *f;
+  snprintf(name, sizeof(name), "%s/%s/w%d_%06llu", out_dir, kind, worker,
+           (unsigned long long)id);
+  f = fopen(name, "w");
+  if (f == NULL) return;
+  fwrite(in, 1, len, f);
+  fclose(f);
+}
+
+
+static void add_corpus(const uint8_t *in, int len) {
+  uint32_t slot = __atomic_fetch_add(&sh->n_corpus, 1, __ATOMIC_RELAXED);
+  if (slot >= CORPUS_MAX) return;
+  memcpy(sh->corpus[slot].data, in, len);
+  __atomic_store_n(&sh->corpus[slot].len, len, __ATOMIC_RELEASE);
+}
+
+
+/* Pick any complete corpus entry */
+static int pick_corpus(uint8_t *in) {
+  uint32_t n = sh->n_corpus, len, i;
+  if (n > CORPUS_MAX) n = CORPUS_MAX;
+  if (!n) return 0;
+  do {
+    i = rnd(n);
+    len = __atomic_load_n(&sh->corpus[i].len, __ATOMIC_ACQUIRE);
+  } while (!len);
+  memcpy(in, sh->corpus[i].data, len);
+  return len;
+}
+
+
+/* Mutation */
+
+/* In port bits */
+static uint8_t random_chord() {
+  return KEY_CY(chords[rnd(sizeof(chords))] | rnd(2));
+}
+
+
+static void random_event(uint8_t *ev) {
+  ev[0] = rnd(4) ? 0 : rnd(4);
+  ev[1] = rnd(4) ? 0 : rnd(16);
+  ev[2] = rnd(4) ? KEY_PORT : 1 + rnd(7);
+  ev[3] = rnd(8) ? random_chord() : rnd(256);
+}
+
+
+static int mutate(uint8_t *in, int len) {
+  int i, n = 1 + rnd(8), e, events;
+  uint8_t other[INPUT_MAX];
+  int olen;
+
+  for (i = 0; i < n; i++) {
+    events = len / EVENT_BYTES;
+    e = events ? rnd(events) * EVENT_BYTES : 0;
+    switch (rnd(8)) {
+    case 0: /* Flip a bit */
+      if (len) in[rnd(len)] ^= 1 << rnd(8);
+      break;
+    case 1: /* Random byte */
+      if (len) in[rnd(len)] = rnd(256);
+      break;
+    case 2: /* Another chord */
+      if (len) in[e + 3] = random_chord();
+      break;
+    case 3: /* Insert an event */
+      if (len + EVENT_BYTES <= INPUT_MAX) {
+        memmove(in + e + EVENT_BYTES, in + e, len - e);
+        random_event(in + e);
+        len += EVENT_BYTES;
+      }
+      break;
+    case 4: /* Delete an event */
+      if (events > 1) {
+        memmove(in + e, in + e + EVENT_BYTES, len - e - EVENT_BYTES);
+        len -= EVENT_BYTES;
+      }
+      break;
+    case 5: /* Repeat an event */
+      if (len && len + EVENT_BYTES <= INPUT_MAX) {
+        memmove(in + e + EVENT_BYTES, in + e, len - e);
+        len += EVENT_BYTES;
+      }
+      break;
+    case 6: /* Toggle EF lines, or hold longer */
+      if (len) in[e + rnd(2)] ^= 1 << rnd(4);
+      break;
+    case 7: /* Splice with another corpus entry */
+      olen = pick_corpus(other);
+      /* Our events up to e, then a prefix of the other input */
+      if (olen >= EVENT_BYTES) {
+        olen = (1 + rnd(olen / EVENT_BYTES)) * EVENT_BYTES;
+        if (e + olen <= INPUT_MAX) {
+          memcpy(in + e, other, olen);
+          len = e + olen;
+        }
+      }
+      break;
+    }
+  }
+  return len;
+}
+
+
+/* Workers */
+
+static void record(int worker, int res, const uint8_t *in, int len) {
+  fuzz_stats *st = &sh->stats[worker];
+  uint16_t pc = PC();
+  uint8_t bit = 1 << (pc & 7);
+
+  if (res == RUN_HANG) st->hangs++; else st->crashes++;
+  /* Keep one reproducer per outcome and PC */
+  if (__atomic_fetch_or(&sh->seen[res][pc >> 3], bit, __ATOMIC_RELAXED) & bit)
+    return;
+  save_input(res == RUN_HANG ? "hangs" : "crashes", worker,
+             (res << 16) | pc, in, len);
+  fprintf(stderr, "[w%d] %s at %.4x (%d events)\n", worker, run_names[res],
+          pc, len / EVENT_BYTES);
+}
+
+
+static void worker(int id, long execs) {
+  uint8_t in[INPUT_MAX];
+  fuzz_stats *st = &sh->stats[id];
+  int len, res;
+  long i;
+
+  rng = 0x9E3779B97F4A7C15ULL ^ ((uint64_t)id << 32) ^ time(NULL) ^ getpid();
+
+  for (i = 0; (execs <= 0 || i < execs) && !sh->stop; i++) {
+    len = pick_corpus(in);
+    if (!len) {
+      random_event(in);
+      len = EVENT_BYTES;
+    }
+    len = mutate(in, len);
+    if (len < EVENT_BYTES) continue;
+
+    res = run_input(in, len);
+    st->execs++;
+    if (res != RUN_OK) {
+      record(id, res, in, len);
+    } else if (new_coverage()) {
+      st->finds++;
+      add_corpus(in, len);
+      save_input("queue", id, st->finds, in, len);
+    }
+  }
+}
+
+
+static void seed_corpus() {
+  uint8_t in[INPUT_MAX];
+  unsigned int i;
+  /* Every chord of the table, plain and with Cmd, on every input port */
+  for (i = 0; i < sizeof(chords) * 2 * 7; i++) {
+    in[0] = 0;
+    in[1] = 0;
+    in[2] = 1 + i % 7;
+    in[3] = KEY_CY(chords[(i / 7) % sizeof(chords)] | (i / 7 / sizeof(chords)));
+    if (run_input(in, EVENT_BYTES) == RUN_OK && new_coverage())
+      add_corpus(in, EVENT_BYTES);
+  }
+}
+
+
+static void stop_handler(int sig) {
+  (void)sig;
+  sh->stop = 1;
+}
+
+
+static void status(int jobs, double t0) {
+  uint64_t execs = 0, hangs = 0, crashes = 0, finds = 0;
+  struct timespec ts;
+  int i;
+  for (i = 0; i < jobs; i++) {
+    execs += sh->stats[i].execs;
+    hangs += sh->stats[i].hangs;
+    crashes += sh->stats[i].crashes;
+    finds += sh->stats[i].finds;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  printf("execs %llu (%.0f/s), corpus %u, finds %llu, hangs %llu, crashes %llu\n",
+         (unsigned long long)execs, execs / (ts.tv_sec + ts.tv_nsec * 1e-9 - t0 + 1e-9),
+         sh->n_corpus < CORPUS_MAX ? sh->n_corpus : CORPUS_MAX,
+         (unsigned long long)finds, (unsigned long long)hangs,
+         (unsigned long long)crashes);
+  fflush(stdout);
+}
+
+
+/* Replay one saved input with a full trace */
+static int replay(const char *filename) {
+  uint8_t in[INPUT_MAX];
+  int len, res;
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot open input \"%s\".\n", filename);
+    exit(1);
+  }
+  len = fread(in, 1, INPUT_MAX, f);
+  fclose(f);
+  trace = 1;
+  res = run_input(in, len);
+  printf("Result: %s at %.4x\n", run_names[res], PC());
+  return res;
+}
+
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-j jobs] [-n execs] [-b budget] [-o outdir] "
+          "[-l listing] [-r input] [rom]\n", prog);
+  exit(1);
+}
+
+
+int main(int argc, char **argv) {
+  int c, i, running, jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  long execs = 0;
+  char *rom = (char *)"microwriter.rom", *lst = NULL, *input = NULL;
+  char dir[4096];
+  const char *subdirs[] = {"queue", "hangs", "crashes"};
+  struct timespec ts;
+  double t0;
+  pid_t pid;
+
+  while ((c = getopt(argc, argv, "j:n:b:o:l:r:")) != -1) {
+    switch (c) {
+    case 'j': jobs = atoi(optarg); break;
+    case 'n': execs = atol(optarg); break;
+    case 'b': budget = atol(optarg); break;
+    case 'o': out_dir = optarg; break;
+    case 'l': lst = optarg; break;
+    case 'r': input = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind < argc) rom = argv[optind];
+  if (jobs < 1) jobs = 1;
+  if (jobs > JOBS_MAX) jobs = JOBS_MAX;
+  if (lst && dis_load_lst(lst) < 0) {
+    fprintf(stderr, "Cannot open listing \"%s\".\n", lst);
+    exit(1);
+  }
+
+  sh = (fuzz_shared *)mmap(NULL, sizeof(fuzz_shared), PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (sh == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  memset(sh->virgin, 0xFF, MAP_SIZE);
+  init_buckets();
+  boot_machine(rom);
+
+  if (input) return replay(input);
+
+  mkdir(out_dir, 0755);
+  for (i = 0; i < 3; i++) {
+    snprintf(dir, sizeof(dir), "%s/%s", out_dir, subdirs[i]);
+    mkdir(dir, 0755);
+  }
+
+  seed_corpus();
+  printf("Booted in %llu cycles; %u seed inputs; %d workers.\n",
+         (unsigned long long)boot.cycles, sh->n_corpus, jobs);
+
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+
+  /* Split the exec budget between the workers */
+  for (i = 0; i < jobs; i++) {
+    pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(1);
+    }
+    if (pid == 0) {
+      worker(i, execs ? (execs + jobs - 1) / jobs : 0);
+      _exit(0);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  t0 = ts.tv_sec + ts.tv_nsec * 1e-9;
+  for (running = jobs; running > 0;) {
+    sleep(1);
+    while (running > 0 && waitpid(-1, NULL, WNOHANG) > 0) running--;
+    status(jobs, t0);
+  }
+
+  ram_free();
+  return 0;
+}
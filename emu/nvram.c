@@ -0,0 +1,172 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "nvram.h"
+
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RAM_BYTES               (MEM_BYTES - ROM_BYTES)
+
+/* Dirty pages are handed to the kernel this often */
+#define SYNC_NS                 1000000000LL
+
+static int fd = -1;
+static char ckpt_path[4096];
+static int64_t checkpoint_ns;
+static int64_t last_sync, last_checkpoint;
+
+
+static int64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static void header(uint8_t *page, int clean) {
+  nvram_header h;
+  memset(page, 0, NVRAM_HEADER_BYTES);
+  memcpy(h.magic, NVRAM_MAGIC, 8);
+  h.ram_bytes = RAM_BYTES;
+  h.clean = clean;
+  memcpy(page, &h, sizeof(h));
+}
+
+
+static int valid(const nvram_header *h) {
+  return !memcmp(h->magic, NVRAM_MAGIC, 8) && h->ram_bytes == RAM_BYTES;
+}
+
+
+static int set_clean(int clean) {
+  uint8_t page[NVRAM_HEADER_BYTES];
+  header(page, clean);
+  if (pwrite(fd, page, sizeof(nvram_header), 0) != sizeof(nvram_header)) return -1;
+  return fdatasync(fd);
+}
+
+
+static int write_all(int f, const uint8_t *data, size_t len) {
+  ssize_t n;
+  while (len) {
+    if ((n = write(f, data, len)) <= 0) return -1;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+/* RAM from the last checkpoint, straight into the mapping */
+static int load_checkpoint() {
+  nvram_header h;
+  int f, ok;
+  if ((f = open(ckpt_path, O_RDONLY)) < 0) return -1;
+  ok = pread(f, &h, sizeof(h), 0) == sizeof(h) && valid(&h) &&
+    pread(f, mem + ROM_BYTES, RAM_BYTES, NVRAM_HEADER_BYTES) == RAM_BYTES;
+  close(f);
+  return ok ? 0 : -1;
+}
+
+
+int nvram_open(const char *filename, int checkpoint_ms) {
+  nvram_header h;
+  struct stat st;
+  int recover = 0;
+
+  snprintf(ckpt_path, sizeof(ckpt_path), "%s.ckpt", filename);
+  if ((fd = open(filename, O_RDWR | O_CREAT, 0644)) < 0) return -1;
+  if (fstat(fd, &st)) goto fail;
+  if (st.st_size == 0) {
+    /* New: cleared RAM */
+    if (ftruncate(fd, NVRAM_HEADER_BYTES + RAM_BYTES)) goto fail;
+  } else if (st.st_size != NVRAM_HEADER_BYTES + RAM_BYTES ||
+             pread(fd, &h, sizeof(h), 0) != sizeof(h) || !valid(&h)) {
+    goto fail;
+  } else {
+    recover = !h.clean;
+  }
+
+  /* ROM_BYTES is a whole number of pages */
+  if (mmap(mem + ROM_BYTES, RAM_BYTES, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, fd, NVRAM_HEADER_BYTES) == MAP_FAILED)
+    goto fail;
+  /* Without a checkpoint, what was written before is the best there is */
+  if (recover) recover = !load_checkpoint();
+  mem_touch_all();
+  if (set_clean(0)) {
+    nvram_close();
+    return -1;
+  }
+
+  checkpoint_ns = (int64_t)checkpoint_ms * 1000000LL;
+  last_sync = last_checkpoint = now_ns();
+  return recover;
+
+ fail:
+  close(fd);
+  fd = -1;
+  return -1;
+}
+
+
+void nvram_poll() {
+  int64_t t;
+  if (fd < 0) return;
+  t = now_ns();
+  if (t - last_sync >= SYNC_NS) {
+    msync(mem + ROM_BYTES, RAM_BYTES, MS_ASYNC);
+    last_sync = t;
+  }
+  /* Only between interrupts, when the firmware has finished with RAM */
+  if (checkpoint_ns && r.IDLE && t - last_checkpoint >= checkpoint_ns) {
+    nvram_checkpoint();
+    last_checkpoint = t;
+  }
+}
+
+
+int nvram_checkpoint() {
+  uint8_t page[NVRAM_HEADER_BYTES];
+  char tmp[4200];
+  int f, ok;
+
+  if (fd < 0) return -1;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", ckpt_path);
+  if ((f = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) return -1;
+  header(page, 1);
+  ok = !write_all(f, page, sizeof(page)) &&
+    !write_all(f, mem + ROM_BYTES, RAM_BYTES) && !fsync(f);
+  ok = !close(f) && ok;
+  if (ok) ok = !rename(tmp, ckpt_path);
+  if (!ok) unlink(tmp);
+  return ok ? 0 : -1;
+}
+
+
+void nvram_close() {
+  uint8_t *copy;
+  if (fd < 0) return;
+  msync(mem + ROM_BYTES, RAM_BYTES, MS_SYNC);
+  set_clean(1);
+
+  /* Put ordinary memory back under the same contents */
+  copy = (uint8_t *)malloc(RAM_BYTES);
+  if (!copy) {
+    fprintf(stderr, "Couldn't allocate memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(copy, mem + ROM_BYTES, RAM_BYTES);
+  if (mmap(mem + ROM_BYTES, RAM_BYTES, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+    fprintf(stderr, "Couldn't allocate memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(mem + ROM_BYTES, copy, RAM_BYTES);
+  free(copy);
+  close(fd);
+  fd = -1;
+}
@@ -0,0 +1,52 @@
+#ifndef _nvram_h_
+#define _nvram_h_
+
+#include <stdint.h>
+
+/*
+  Battery-backed RAM.
+
+  nvram_open() maps a file over the RAM part of mem (everything above
+  the ROM), so what the firmware stores there is in the file with no
+  extra work on the store paths, and is there again next session.
+
+  A run loop calls nvram_poll() every few thousand instructions. Once a
+  second it starts writing dirty pages back (msync with MS_ASYNC); every
+  checkpoint interval, at a moment the CPU is idle waiting for an
+  interrupt and so not half way through updating anything, it writes a
+  copy of RAM to <file>.ckpt, synced and renamed into place.
+
+  The file's header says whether it was closed cleanly. If not (the
+  emulator was killed, or the host went down) nvram_open() takes RAM
+  from the last checkpoint instead, when there is one.
+
+  On disk: a page with an nvram_header, then MEM_BYTES - ROM_BYTES of
+  RAM. Checkpoints have the same layout.
+*/
+
+#define NVRAM_MAGIC             "CYNVRAM1"
+#define NVRAM_HEADER_BYTES      4096
+
+typedef struct _nvram_header {
+  char magic[8];
+  uint32_t ram_bytes;
+  /* Set by nvram_close(), cleared while the file is in use */
+  uint32_t clean;
+} nvram_header;
+
+/* Map filename over RAM, creating it if need be, and checkpoint every
+   checkpoint_ms (0 for never). mem must have come from ram_init().
+   Returns 0 on success, 1 if RAM was recovered from the checkpoint,
+   -1 if the file can't be used. */
+int nvram_open(const char *filename, int checkpoint_ms);
+
+void nvram_poll();
+
+/* Write a checkpoint now; returns 0 on success */
+int nvram_checkpoint();
+
+/* Write everything back and mark the file clean; RAM is then ordinary
+   memory again, holding the same contents */
+void nvram_close();
+
+#endif
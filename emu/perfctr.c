@@ -0,0 +1,93 @@
+#include "perfctr.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+  const char *name;
+} events[PERF_COUNTERS] = {
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "insns"},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "br-miss"},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-miss"},
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "ns"}
+};
+
+static int fds[PERF_COUNTERS] = {-1, -1, -1, -1, -1};
+
+
+int perf_open() {
+  struct perf_event_attr attr;
+  int i, n = 0;
+
+  for (i = 0; i < PERF_COUNTERS; i++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = 1;
+    /* User space only: works under perf_event_paranoid 2 */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    /* For scaling when the PMU multiplexes */
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fds[i] >= 0) n++;
+  }
+  return n;
+}
+
+
+void perf_close() {
+  int i;
+  for (i = 0; i < PERF_COUNTERS; i++) {
+    if (fds[i] >= 0) close(fds[i]);
+    fds[i] = -1;
+  }
+}
+
+
+void perf_begin() {
+  int i;
+  for (i = 0; i < PERF_COUNTERS; i++) {
+    if (fds[i] < 0) continue;
+    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+
+void perf_end(perf_counts *c) {
+  uint64_t buf[3]; /* value, time enabled, time running */
+  int i;
+
+  for (i = 0; i < PERF_COUNTERS; i++)
+    if (fds[i] >= 0) ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+  for (i = 0; i < PERF_COUNTERS; i++) {
+    if (fds[i] < 0 || read(fds[i], buf, sizeof(buf)) != sizeof(buf) || !buf[2])
+      continue;
+    if (buf[2] < buf[1]) buf[0] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+    c->value[i] += buf[0];
+    c->valid[i] = 1;
+  }
+}
+
+
+void perf_print(FILE *f, const char *phase, const perf_counts *c,
+                uint64_t count, const char *unit) {
+  int i;
+  fprintf(f, "%-10s %10llu %-5s", phase, (unsigned long long)count, unit);
+  for (i = 0; i < PERF_COUNTERS; i++) {
+    if (c->valid[i] && count)
+      fprintf(f, "  %8.3f %s", (double)c->value[i] / count, events[i].name);
+    else
+      fprintf(f, "  %8s %s", "n/a", events[i].name);
+  }
+  fprintf(f, "  (host, per %s)\n", unit);
+}
@@ -0,0 +1,41 @@
+#ifndef _perfctr_h_
+#define _perfctr_h_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+  Host performance counters (perf_event_open) around parts of an
+  emulator run, for telling dispatch mispredicts from cache misses from
+  plain instruction count when a benchmark gets slower. Counters the host
+  doesn't offer (no PMU in a VM, perf_event_paranoid) read as missing
+  and the rest still work.
+*/
+
+#define PERF_CYCLES             0
+#define PERF_INSTRUCTIONS       1
+#define PERF_BRANCH_MISSES      2
+#define PERF_CACHE_MISSES       3
+#define PERF_TASK_CLOCK         4 /* Software: ns on the CPU */
+#define PERF_COUNTERS           5
+
+/* Totals for one phase; valid[] says which counters were really read */
+typedef struct _perf_counts {
+  uint64_t value[PERF_COUNTERS];
+  int valid[PERF_COUNTERS];
+} perf_counts;
+
+/* Returns the number of counters that could be opened */
+int perf_open();
+void perf_close();
+
+/* Count from perf_begin() to perf_end(), adding into c */
+void perf_begin();
+void perf_end(perf_counts *c);
+
+/* One line per phase: each counter per unit of emulated work (usually
+   "insn": host cycles per emulated instruction and so on) */
+void perf_print(FILE *f, const char *phase, const perf_counts *c,
+                uint64_t count, const char *unit);
+
+#endif
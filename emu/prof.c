@@ -0,0 +1,317 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "disasm.h"
+#include "prof.h"
+
+#include <string.h>
+
+/* Call edge table: open addressing, power of two */
+#define EDGE_SLOTS              4096
+
+#define EDGE_CALL               1 /* SCRT call through the call register */
+#define EDGE_SEP                2 /* Direct SEP to another register */
+
+/* N-gram table: open addressing, power of two */
+#define NGRAM_SLOTS             16384
+#define NGRAM_MAX               4
+
+typedef struct _prof_edge {
+  uint16_t from;
+  uint16_t to;
+  uint8_t kind;
+  uint64_t count;
+} prof_edge;
+
+
+int prof_pc_reg = 3;
+int prof_call_reg = 4;
+int prof_ret_reg = 5;
+
+static uint64_t counts[MEM_BYTES];
+static uint64_t cycles[MEM_BYTES];
+
+static prof_edge edges[EDGE_SLOTS];
+static int n_edges;
+static uint64_t edges_dropped;
+
+typedef struct _prof_ngram_entry {
+  uint32_t codes;               /* Opcodes, the last in the low byte */
+  uint8_t n;
+  uint16_t first;               /* Where it was first seen */
+  uint64_t count;
+} prof_ngram_entry;
+
+
+static prof_ngram_entry ngrams[NGRAM_SLOTS];
+static int n_ngrams;
+static uint64_t ngrams_dropped;
+
+/* The current straight-line run: its last opcodes, where they were, and
+   where it continues if nothing jumps */
+static uint32_t run_codes;
+static uint16_t run_pcs[NGRAM_MAX];
+static int run_len;
+static uint16_t run_next;
+
+/* For the report's sorts */
+static uint64_t *sort_key;
+
+
+void prof_start() {
+  cpu_hooks |= HOOK_PROFILE;
+}
+
+
+void prof_stop() {
+  cpu_hooks &= ~HOOK_PROFILE;
+}
+
+
+void prof_reset() {
+  memset(counts, 0, sizeof(counts));
+  memset(cycles, 0, sizeof(cycles));
+  memset(edges, 0, sizeof(edges));
+  n_edges = 0;
+  edges_dropped = 0;
+}
+
+
+static void add_edge(uint16_t from, uint16_t to, uint8_t kind) {
+  uint32_t key = ((uint32_t)from << 16) | to;
+  unsigned int i = (key * 2654435761u) >> 20;
+  prof_edge *e;
+
+  for (;;) {
+    i &= EDGE_SLOTS - 1;
+    e = &edges[i];
+    if (!e->count) break;
+    if (e->from == from && e->to == to) {
+      e->count++;
+      return;
+    }
+    i++;
+  }
+  /* Keep the table sparse enough that probes stay short */
+  if (n_edges >= EDGE_SLOTS * 3 / 4) {
+    edges_dropped++;
+    return;
+  }
+  e->from = from;
+  e->to = to;
+  e->kind = kind;
+  e->count = 1;
+  n_edges++;
+}
+
+
+void prof_insn(uint16_t pc, uint8_t code) {
+  int n;
+
+  counts[pc]++;
+  cycles[pc] += OP_CYCLES(code);
+
+  if ((code & 0xF0) != 0xD0) return;
+
+  /* SEP has already run, so R(N) is the new program counter */
+  n = code & 0xF;
+  if (n == prof_call_reg) {
+    add_edge(pc, (mem_fetch(pc + 1) << 8) | mem_fetch(pc + 2), EDGE_CALL);
+  } else if (n != prof_pc_reg && n != prof_ret_reg) {
+    add_edge(pc, r.R[n], EDGE_SEP);
+  }
+}
+
+
+/* N-grams */
+
+void prof_ngram_start() {
+  run_len = 0;
+  cpu_hooks |= HOOK_NGRAM;
+}
+
+
+void prof_ngram_stop() {
+  cpu_hooks &= ~HOOK_NGRAM;
+}
+
+
+static void add_ngram(uint32_t codes, int n, uint16_t first) {
+  unsigned int i = ((codes ^ (n << 29)) * 2654435761u) >> 18;
+  prof_ngram_entry *e;
+
+  for (;;) {
+    i &= NGRAM_SLOTS - 1;
+    e = &ngrams[i];
+    if (!e->count) break;
+    if (e->codes == codes && e->n == n) {
+      e->count++;
+      return;
+    }
+    i++;
+  }
+  if (n_ngrams >= NGRAM_SLOTS * 3 / 4) {
+    ngrams_dropped++;
+    return;
+  }
+  e->codes = codes;
+  e->n = n;
+  e->first = first;
+  e->count = 1;
+  n_ngrams++;
+}
+
+
+void prof_ngram(uint16_t pc, uint8_t code) {
+  int i, n;
+
+  if (pc != run_next) run_len = 0;
+  for (i = 0; i < NGRAM_MAX - 1; i++) run_pcs[i] = run_pcs[i + 1];
+  run_pcs[NGRAM_MAX - 1] = pc;
+  run_codes = (run_codes << 8) | code;
+  if (run_len < NGRAM_MAX) run_len++;
+  run_next = pc + dis_length(code);
+
+  for (n = 2; n <= run_len; n++)
+    add_ngram(n == 4 ? run_codes : run_codes & ((1u << (8 * n)) - 1), n,
+              run_pcs[NGRAM_MAX - n]);
+}
+
+
+/* Dispatches saved by fusing each n-gram into one operation */
+static uint64_t ngram_saving(const prof_ngram_entry *e) {
+  return e->count * (e->n - 1);
+}
+
+
+static int by_saving_desc(const void *a, const void *b) {
+  uint64_t ka = ngram_saving((const prof_ngram_entry *)a);
+  uint64_t kb = ngram_saving((const prof_ngram_entry *)b);
+  return (ka < kb) - (ka > kb);
+}
+
+
+void prof_ngram_report(FILE *f, int top) {
+  static prof_ngram_entry sorted[NGRAM_SLOTS];
+  char sym[DIS_LABEL_MAX + 8], seq[80], op[16];
+  int i, k, n, len;
+  uint8_t code;
+
+  for (n = 0, i = 0; i < NGRAM_SLOTS; i++)
+    if (ngrams[i].count) sorted[n++] = ngrams[i];
+  qsort(sorted, n, sizeof(sorted[0]), by_saving_desc);
+
+  fprintf(f, "Opcode n-grams (%d", n);
+  if (ngrams_dropped) fprintf(f, ", %llu dropped", (unsigned long long)ngrams_dropped);
+  fprintf(f, "), by dispatches saved if fused:\n");
+  fprintf(f, "  %12s %12s  first %-16s sequence\n", "count", "saved", "");
+  for (i = 0; i < n && i < top; i++) {
+    len = 0;
+    for (k = sorted[i].n - 1; k >= 0; k--) {
+      code = sorted[i].codes >> (8 * k);
+      if (Tabula[code].fmt == OPF_REG)
+        snprintf(op, sizeof(op), "%s R%X", Tabula[code].name, code & 0xF);
+      else if (Tabula[code].fmt == OPF_PORT)
+        snprintf(op, sizeof(op), "%s %d", Tabula[code].name, code & 0x7);
+      else
+        snprintf(op, sizeof(op), "%s", Tabula[code].name);
+      len += snprintf(seq + len, sizeof(seq) - len, "%s%s", op, k ? "; " : "");
+    }
+    dis_symbolize(sorted[i].first, sym);
+    fprintf(f, "  %12llu %12llu  %.4x %-16s %s\n",
+            (unsigned long long)sorted[i].count,
+            (unsigned long long)ngram_saving(&sorted[i]), sorted[i].first, sym, seq);
+  }
+}
+
+
+/* Report */
+
+static int by_key_desc(const void *a, const void *b) {
+  uint64_t ka = sort_key[*(const uint32_t *)a];
+  uint64_t kb = sort_key[*(const uint32_t *)b];
+  return (ka < kb) - (ka > kb);
+}
+
+
+static int by_edge_count_desc(const void *a, const void *b) {
+  uint64_t ka = ((const prof_edge *)a)->count;
+  uint64_t kb = ((const prof_edge *)b)->count;
+  return (ka < kb) - (ka > kb);
+}
+
+
+void prof_report(FILE *f, int top) {
+  static uint64_t label_counts[MEM_BYTES], label_cycles[MEM_BYTES];
+  static uint32_t order[MEM_BYTES];
+  static prof_edge sorted[EDGE_SLOTS];
+  char sym[DIS_LABEL_MAX + 8], to_sym[DIS_LABEL_MAX + 8];
+  uint64_t insns = 0, total = 0;
+  uint32_t addr;
+  int i, n;
+  uint16_t base;
+
+  memset(label_counts, 0, sizeof(label_counts));
+  memset(label_cycles, 0, sizeof(label_cycles));
+  for (addr = 0; addr < MEM_BYTES; addr++) {
+    if (!counts[addr]) continue;
+    insns += counts[addr];
+    total += cycles[addr];
+    base = dis_nearest(addr);
+    label_counts[base] += counts[addr];
+    label_cycles[base] += cycles[addr];
+  }
+  if (!total) total = 1;
+
+  fprintf(f, "Profile: %llu instructions, %llu machine cycles\n\n",
+          (unsigned long long)insns, (unsigned long long)total);
+
+  /* By address */
+  for (n = 0, addr = 0; addr < MEM_BYTES; addr++)
+    if (counts[addr]) order[n++] = addr;
+  sort_key = cycles;
+  qsort(order, n, sizeof(order[0]), by_key_desc);
+
+  fprintf(f, "Hot spots by address:\n");
+  fprintf(f, "  addr  %-16s %12s %12s  %%cyc\n", "symbol", "count", "cycles");
+  for (i = 0; i < n && i < top; i++) {
+    addr = order[i];
+    dis_symbolize(addr, sym);
+    fprintf(f, "  %.4x  %-16s %12llu %12llu %5.1f\n", addr, sym,
+            (unsigned long long)counts[addr], (unsigned long long)cycles[addr],
+            100.0 * cycles[addr] / total);
+  }
+
+  /* By label */
+  for (n = 0, addr = 0; addr < MEM_BYTES; addr++)
+    if (label_counts[addr]) order[n++] = addr;
+  sort_key = label_cycles;
+  qsort(order, n, sizeof(order[0]), by_key_desc);
+
+  fprintf(f, "\nHot spots by label:\n");
+  fprintf(f, "  addr  %-16s %12s %12s  %%cyc\n", "label", "count", "cycles");
+  for (i = 0; i < n && i < top; i++) {
+    addr = order[i];
+    dis_symbolize(addr, sym);
+    fprintf(f, "  %.4x  %-16s %12llu %12llu %5.1f\n", addr, sym,
+            (unsigned long long)label_counts[addr],
+            (unsigned long long)label_cycles[addr],
+            100.0 * label_cycles[addr] / total);
+  }
+
+  /* Call edges */
+  for (n = 0, i = 0; i < EDGE_SLOTS; i++)
+    if (edges[i].count) sorted[n++] = edges[i];
+  qsort(sorted, n, sizeof(sorted[0]), by_edge_count_desc);
+
+  fprintf(f, "\nCall edges (%d", n);
+  if (edges_dropped) fprintf(f, ", %llu dropped", (unsigned long long)edges_dropped);
+  fprintf(f, "):\n");
+  for (i = 0; i < n && i < top; i++) {
+    dis_symbolize(sorted[i].from, sym);
+    dis_symbolize(sorted[i].to, to_sym);
+    fprintf(f, "  %12llu  %-4s %.4x %-16s -> %.4x %s\n",
+            (unsigned long long)sorted[i].count,
+            sorted[i].kind == EDGE_CALL ? "call" : "sep",
+            sorted[i].from, sym, sorted[i].to, to_sym);
+  }
+}
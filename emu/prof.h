@@ -0,0 +1,49 @@
+#ifndef _prof_h_
+#define _prof_h_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+  Exact execution profiler. Counts every executed instruction and its
+  machine cycles in flat per-address arrays, and records call edges from
+  SEP: the ROM uses the standard call/return technique (SCRT) with R3 as
+  the program counter, R4 pointing at CALL and R5 at RETURN, the callee
+  address following the SEP R4 inline. Other SEPs (SEP R7 etc.) are
+  direct subroutine calls.
+
+  Off unless HOOK_PROFILE is set in cpu_hooks (prof_start/prof_stop).
+*/
+
+/* Registers of the SCRT convention; set prof_call_reg to -1 to disable */
+extern int prof_pc_reg;
+extern int prof_call_reg;
+extern int prof_ret_reg;
+
+void prof_start();
+void prof_stop();
+void prof_reset();
+
+/* Called by cpu_cycle() after executing the opcode at pc */
+void prof_insn(uint16_t pc, uint8_t code);
+
+/* Hot spots by address and by label, and the call edges; top N of each */
+void prof_report(FILE *f, int top);
+
+/*
+  Opcode n-grams: how often each run of two to four opcodes executes
+  back to back with no jump in between (a branch not taken doesn't
+  count as one). Ranked by the dispatches fusing the run into one
+  operation would save, to pick what fuse.c should recognize.
+
+  Off unless HOOK_NGRAM is set in cpu_hooks.
+*/
+void prof_ngram_start();
+void prof_ngram_stop();
+
+/* Called by cpu_cycle() after executing the opcode at pc */
+void prof_ngram(uint16_t pc, uint8_t code);
+
+void prof_ngram_report(FILE *f, int top);
+
+#endif
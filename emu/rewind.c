@@ -0,0 +1,361 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "rewind.h"
+
+#include <string.h>
+#include <stddef.h>
+
+#define PAGES                   (MEM_BYTES / REWIND_PAGE)
+
+/* A stored page: its number, then its bytes */
+#define PAGE_RECORD             (1 + REWIND_PAGE)
+
+/* The snapshot up to the memory: registers, I/O, display and counters */
+#define HEAD_BYTES              offsetof(cpu_snapshot, mem)
+
+/* What the debugger did */
+#define INPUT_STATE             0 /* Set registers and I/O lines */
+#define INPUT_POKE              1 /* Wrote a byte */
+
+typedef struct _rw_point {
+  uint64_t at;
+  uint64_t cycles;
+  int full; /* Holds every page, so doesn't depend on the one before */
+  int pages;
+  uint8_t *data;
+  uint8_t head[HEAD_BYTES];
+} rw_point;
+
+typedef struct _rw_input {
+  uint64_t at;
+  int kind;
+  uint16_t addr;
+  uint8_t data;
+  cpu_regs r;
+  cpu_io io;
+} rw_input;
+
+int rewind_on;
+uint64_t rewind_now;
+size_t rewind_bytes;
+
+static size_t budget;
+
+/* Checkpoints, oldest first */
+static rw_point *points;
+static int n_points, max_points;
+
+/* The log, in order; those before next have been applied */
+static rw_input *inputs;
+static int n_inputs, max_inputs, next;
+
+/* Memory as of the newest checkpoint, which the next one is diffed
+   against, and room to build a snapshot in */
+static uint8_t *shadow;
+static cpu_snapshot *scratch;
+
+
+static void *grow(void *p, int *max, size_t size) {
+  *max = *max ? *max * 2 : 64;
+  p = realloc(p, *max * size);
+  if (p == NULL) {
+    fprintf(stderr, "Couldn't allocate memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+static size_t point_bytes(const rw_point *p) {
+  return sizeof(rw_point) + (size_t)p->pages * PAGE_RECORD;
+}
+
+
+/* Memory as of checkpoint k, from the last whole one before it */
+static void build(int k, uint8_t *image) {
+  const uint8_t *d;
+  int j, i;
+  for (j = k; !points[j].full; j--);
+  for (; j <= k; j++) {
+    d = points[j].data;
+    for (i = 0; i < points[j].pages; i++, d += PAGE_RECORD)
+      memcpy(image + d[0] * REWIND_PAGE, d + 1, REWIND_PAGE);
+  }
+}
+
+
+/* Keep the pages of image that differ from base, or all of them */
+static void encode(rw_point *p, const uint8_t *image, const uint8_t *base) {
+  uint8_t *d;
+  int i;
+  p->pages = 0;
+  for (i = 0; i < PAGES; i++)
+    if (p->full || memcmp(image + i * REWIND_PAGE, base + i * REWIND_PAGE, REWIND_PAGE))
+      p->pages++;
+  p->data = (uint8_t *)malloc((size_t)p->pages * PAGE_RECORD + 1);
+  if (p->data == NULL) {
+    fprintf(stderr, "Couldn't allocate memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  d = p->data;
+  for (i = 0; i < PAGES; i++) {
+    if (!p->full && !memcmp(image + i * REWIND_PAGE, base + i * REWIND_PAGE, REWIND_PAGE))
+      continue;
+    d[0] = i;
+    memcpy(d + 1, image + i * REWIND_PAGE, REWIND_PAGE);
+    d += PAGE_RECORD;
+  }
+}
+
+
+/* Drop the oldest checkpoints, and the log before them, until history
+   fits again */
+static void evict() {
+  rw_point *p;
+  int i;
+  while (rewind_bytes > budget && n_points > 1) {
+    p = &points[1];
+    if (!p->full) {
+      build(1, scratch->mem);
+      rewind_bytes -= point_bytes(p);
+      free(p->data);
+      p->full = 1;
+      encode(p, scratch->mem, NULL);
+      rewind_bytes += point_bytes(p);
+    }
+    rewind_bytes -= point_bytes(&points[0]);
+    free(points[0].data);
+    memmove(points, points + 1, --n_points * sizeof(rw_point));
+  }
+  for (i = 0; i < n_inputs && inputs[i].at < points[0].at; i++);
+  if (!i) return;
+  memmove(inputs, inputs + i, (n_inputs - i) * sizeof(rw_input));
+  n_inputs -= i;
+  next -= i;
+  rewind_bytes -= i * sizeof(rw_input);
+}
+
+
+static void checkpoint() {
+  rw_point *p;
+  int k;
+
+  if (n_points == max_points)
+    points = (rw_point *)grow(points, &max_points, sizeof(rw_point));
+  p = &points[n_points];
+  cpu_save(scratch);
+  p->at = rewind_now;
+  p->cycles = scratch->cycles;
+  memcpy(p->head, scratch, HEAD_BYTES);
+  for (k = n_points - 1; k >= 0 && !points[k].full; k--);
+  p->full = k < 0 || n_points - k >= REWIND_KEY_EVERY;
+  encode(p, scratch->mem, shadow);
+  memcpy(shadow, scratch->mem, MEM_BYTES);
+  n_points++;
+  rewind_bytes += point_bytes(p);
+  evict();
+}
+
+
+static void apply_inputs() {
+  rw_input *in;
+  for (; next < n_inputs && inputs[next].at == rewind_now; next++) {
+    in = &inputs[next];
+    if (in->kind == INPUT_POKE) {
+      mem_poke(in->addr, in->data);
+    } else {
+      r = in->r;
+      io = in->io;
+    }
+  }
+}
+
+
+static void advance() {
+  cpu_cycle();
+  rewind_now++;
+  apply_inputs();
+  if (!(rewind_now % REWIND_EVERY) && rewind_now > points[n_points - 1].at)
+    checkpoint();
+}
+
+
+/* Put the machine back as it was at checkpoint k */
+static void restore(int k) {
+  build(k, scratch->mem);
+  memcpy(scratch, points[k].head, HEAD_BYTES);
+  cpu_restore(scratch);
+  rewind_now = points[k].at;
+  for (next = 0; next < n_inputs && inputs[next].at < rewind_now; next++);
+  apply_inputs();
+}
+
+
+/* The last checkpoint at or before position at */
+static int point_before(uint64_t at) {
+  int lo = 0, hi = n_points - 1, mid;
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (points[mid].at <= at) lo = mid; else hi = mid - 1;
+  }
+  return lo;
+}
+
+
+/* Something is about to change the past: forget the future */
+static void fork_history() {
+  int k = n_points;
+  while (k > 1 && points[k - 1].at > rewind_now) {
+    k--;
+    rewind_bytes -= point_bytes(&points[k]);
+    free(points[k].data);
+  }
+  if (k < n_points) {
+    n_points = k;
+    build(k - 1, shadow);
+  }
+  rewind_bytes -= (n_inputs - next) * sizeof(rw_input);
+  n_inputs = next;
+}
+
+
+static rw_input *log_input(int kind) {
+  rw_input *in;
+  fork_history();
+  if (n_inputs == max_inputs)
+    inputs = (rw_input *)grow(inputs, &max_inputs, sizeof(rw_input));
+  in = &inputs[n_inputs++];
+  next = n_inputs;
+  rewind_bytes += sizeof(rw_input);
+  in->at = rewind_now;
+  in->kind = kind;
+  return in;
+}
+
+
+uint64_t rewind_oldest() {
+  return n_points ? points[0].at : rewind_now;
+}
+
+
+int rewind_start(size_t bytes) {
+  if (bytes < 2 * (sizeof(rw_point) + (size_t)PAGES * PAGE_RECORD)) return -1;
+  shadow = (uint8_t *)malloc(MEM_BYTES);
+  scratch = (cpu_snapshot *)malloc(sizeof(cpu_snapshot));
+  if (shadow == NULL || scratch == NULL) {
+    fprintf(stderr, "Couldn't allocate memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  budget = bytes;
+  rewind_now = 0;
+  rewind_bytes = 0;
+  n_points = n_inputs = next = 0;
+  checkpoint();
+  rewind_on = 1;
+  return 0;
+}
+
+
+void rewind_stop() {
+  int k;
+  if (!rewind_on) return;
+  for (k = 0; k < n_points; k++) free(points[k].data);
+  free(points);
+  free(inputs);
+  free(shadow);
+  free(scratch);
+  points = NULL;
+  inputs = NULL;
+  n_points = max_points = n_inputs = max_inputs = next = 0;
+  rewind_bytes = 0;
+  rewind_on = 0;
+}
+
+
+void rewind_step() {
+  if (rewind_on) advance(); else cpu_cycle();
+}
+
+
+void rewind_input() {
+  rw_input *in;
+  if (!rewind_on) return;
+  in = log_input(INPUT_STATE);
+  in->r = r;
+  in->io = io;
+}
+
+
+void rewind_poke(uint16_t addr, uint8_t data) {
+  rw_input *in;
+  if (rewind_on) {
+    in = log_input(INPUT_POKE);
+    in->addr = addr;
+    in->data = data;
+  }
+  mem_poke(addr, data);
+}
+
+
+int rewind_seek(uint64_t at) {
+  int ret = 0;
+  if (!rewind_on) return -1;
+  if (at < points[0].at) {
+    at = points[0].at;
+    ret = -1;
+  }
+  if (at < rewind_now) restore(point_before(at));
+  while (rewind_now < at) advance();
+  return ret;
+}
+
+
+int rewind_cycles(uint64_t cycles) {
+  uint64_t target, end = rewind_now;
+  int k;
+  if (!rewind_on) return -1;
+  target = cycles > cpu_cycles ? 0 : cpu_cycles - cycles;
+  for (k = n_points - 1; k >= 0 && points[k].cycles > target; k--);
+  if (k < 0) {
+    restore(0);
+    return -1;
+  }
+  /* Find the step that takes the clock past it, then go to just before */
+  restore(k);
+  while (rewind_now < end && cpu_cycles <= target) advance();
+  return rewind_seek(cpu_cycles > target ? rewind_now - 1 : rewind_now);
+}
+
+
+int rewind_back(rewind_hit hit) {
+  uint64_t end = rewind_now, found = 0;
+  int k, h, any = 0;
+
+  if (!rewind_on || rewind_now == points[0].at) return 0;
+  for (k = point_before(end - 1); k >= 0; k--) {
+    /* Replay [checkpoint, end), remembering the last place to stop */
+    restore(k);
+    if (hit(1) == REWIND_HIT_HERE && rewind_now < end) {
+      found = rewind_now;
+      any = 1;
+    }
+    while (rewind_now < end) {
+      advance();
+      h = hit(0);
+      if (h == REWIND_HIT_HERE && rewind_now < end) {
+        found = rewind_now;
+        any = 1;
+      } else if (h == REWIND_HIT_BEFORE) {
+        found = rewind_now - 1;
+        any = 1;
+      }
+    }
+    if (any) {
+      rewind_seek(found);
+      return 1;
+    }
+    end = points[k].at;
+  }
+  restore(0);
+  return 0;
+}
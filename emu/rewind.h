@@ -0,0 +1,77 @@
+#ifndef _rewind_h_
+#define _rewind_h_
+
+#include "mwemu.h"
+
+/*
+  Rewinding, for the debugger to step backwards.
+
+  The machine is deterministic: from the same state, with the same
+  things done to it from outside at the same points, it does the same.
+  So history is kept as checkpoints of the machine every REWIND_EVERY
+  steps, plus a log of what the debugger changed and when: registers,
+  I/O lines and memory it wrote. Going back to any earlier step is
+  restoring the last checkpoint before it and running forward again at
+  full speed, replaying the log on the way.
+
+  Checkpoints are delta-encoded: each one keeps only the 256 byte pages
+  of memory that differ from the one before, and every REWIND_KEY_EVERY
+  th keeps all of them, so restoring one never applies more than that
+  many deltas. When history outgrows its budget the oldest checkpoints
+  go, the next one being made whole first if it was a delta.
+
+  Positions are steps of cpu_cycle() since rewind_start(), so fusion
+  and translation must be off while recording. Going back and changing
+  something starts a new future: checkpoints and log after that point
+  are dropped. Devices outside the snapshot (the serial and audio
+  sinks) see replayed instructions again.
+*/
+
+#define REWIND_EVERY            65536
+#define REWIND_KEY_EVERY        32
+#define REWIND_PAGE             256
+
+/* What a rewind_hit function returns */
+#define REWIND_HIT_HERE         1 /* Stop at this position */
+#define REWIND_HIT_BEFORE       2 /* Stop at the one before it */
+
+/* Called by rewind_back() at each position it replays, first being set
+   straight after a checkpoint is restored (there is no position before
+   that one to stop at) */
+typedef int (*rewind_hit)(int first);
+
+extern int rewind_on;
+
+/* Where the machine is now, and the earliest position it can go back to */
+extern uint64_t rewind_now;
+uint64_t rewind_oldest();
+
+/* Bytes of history held */
+extern size_t rewind_bytes;
+
+/* Starts recording from the machine as it is, keeping up to budget
+   bytes of history. Returns 0, or -1 if budget won't hold a single
+   checkpoint. */
+int rewind_start(size_t budget);
+void rewind_stop();
+
+/* One cpu_cycle(), recorded (or not, when not recording) */
+void rewind_step();
+
+/* The debugger has changed registers or I/O lines, or is to write a
+   byte of memory: log it */
+void rewind_input();
+void rewind_poke(uint16_t addr, uint8_t data);
+
+/* Go back to position at (no later than rewind_now). Returns 0, or -1
+   if it is before the oldest position, in which case it goes there. */
+int rewind_seek(uint64_t at);
+
+/* Go back to the last point at least cycles machine cycles ago */
+int rewind_cycles(uint64_t cycles);
+
+/* Go back to the last position before now at which hit() says to stop.
+   Returns 1 if there was one, or 0 having gone back to the oldest. */
+int rewind_back(rewind_hit hit);
+
+#endif
@@ -0,0 +1,154 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "serial.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+/* Start bit, eight data bits, stop bit */
+#define FRAME_BITS              10
+
+static int fd = -1;
+static int is_pty;
+static char pty_name[64];
+
+static uint8_t ring[SERIAL_RING];
+static uint64_t head, tail;
+
+/* The line, and the frame being received */
+static uint8_t line;
+static int bit = -1;            /* Next bit to sample, -1 between frames */
+static uint64_t frame_start;
+static uint64_t bit_time, given_bit_time;
+static uint8_t shift;
+
+uint64_t serial_bytes;
+uint64_t serial_errors;
+uint64_t serial_dropped;
+
+
+/* Write out as much of the ring as the host takes */
+static void flush() {
+  struct iovec iov[2];
+  uint64_t len;
+  size_t at;
+  ssize_t n;
+  int parts;
+
+  while ((len = head - tail) > 0) {
+    at = tail & (SERIAL_RING - 1);
+    iov[0].iov_base = ring + at;
+    if (at + len <= SERIAL_RING) {
+      iov[0].iov_len = len;
+      parts = 1;
+    } else {
+      iov[0].iov_len = SERIAL_RING - at;
+      iov[1].iov_base = ring;
+      iov[1].iov_len = len - iov[0].iov_len;
+      parts = 2;
+    }
+    n = writev(fd, iov, parts);
+    if (n < 0 && errno == EINTR) continue;
+    /* Nobody reading the terminal: keep it for later */
+    if (n <= 0) return;
+    tail += n;
+  }
+}
+
+
+static void put(uint8_t c) {
+  serial_bytes++;
+  if (head - tail == SERIAL_RING) flush();
+  if (head - tail == SERIAL_RING) {
+    serial_dropped++;
+    return;
+  }
+  ring[head++ & (SERIAL_RING - 1)] = c;
+  if (head - tail >= SERIAL_FLUSH) flush();
+}
+
+
+/* Sample the middle of every bit cell up to now */
+static void advance(uint64_t now) {
+  while (bit >= 0 && bit_time &&
+         frame_start + bit * bit_time + bit_time / 2 <= now) {
+    if (bit == 0) {
+      /* A glitch, not a start bit */
+      if (line) bit = -1;
+      else bit++;
+    } else if (bit < FRAME_BITS - 1) {
+      shift = shift >> 1 | line << 7;
+      bit++;
+    } else {
+      if (line) put(shift);
+      else serial_errors++;
+      bit = -1;
+    }
+  }
+}
+
+
+int serial_open(const char *filename, int bit_cycles) {
+  if (!strcmp(filename, "pty")) {
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) || unlockpt(fd) || ptsname_r(fd, pty_name, sizeof(pty_name))) {
+      if (fd >= 0) close(fd);
+      fd = -1;
+      return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    is_pty = 1;
+  } else if (!strcmp(filename, "-")) {
+    fd = STDOUT_FILENO;
+  } else {
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+  }
+  head = tail = 0;
+  line = 1;
+  bit = -1;
+  given_bit_time = bit_cycles;
+  serial_bytes = serial_errors = serial_dropped = 0;
+  return 0;
+}
+
+
+const char *serial_name() {
+  return is_pty ? pty_name : NULL;
+}
+
+
+void serial_out(uint8_t value) {
+  uint64_t now = totals.cycles;
+  uint8_t level = !(value & SERIAL_TX);
+
+  if (fd < 0) return;
+  /* The first write after the start bit is one bit time on */
+  if (bit == 0 && !bit_time) bit_time = now - frame_start;
+  advance(now);
+  if (bit < 0 && line && !level) {
+    frame_start = now;
+    bit_time = given_bit_time;
+    bit = 0;
+    shift = 0;
+  }
+  line = level;
+}
+
+
+void serial_poll() {
+  if (fd < 0) return;
+  advance(totals.cycles);
+  flush();
+}
+
+
+void serial_close() {
+  if (fd < 0) return;
+  serial_poll();
+  if (fd != STDOUT_FILENO) close(fd);
+  fd = -1;
+  is_pty = 0;
+}
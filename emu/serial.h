@@ -0,0 +1,53 @@
+#ifndef _serial_h_
+#define _serial_h_
+
+#include <stdint.h>
+
+/*
+  Serial output, for the printer or a terminal.
+
+  The firmware bit-bangs it (0248-026C in the listing): it waits for
+  EF3 to go low, then writes each bit cell to OUT 5 (bit 1, inverted:
+  02 is a 0), a start bit, eight data bits LSB first and a stop bit,
+  timed by a delay loop on the baud rate setting in RAM.
+
+  serial_out() gets each write stamped with totals.cycles and decodes
+  the line the way a UART would, sampling the middle of each bit cell.
+  The bit time is measured from the start bit to the next write, which
+  works because the firmware writes every cell; for a driver that only
+  writes when the line changes, give it to serial_open().
+
+  Decoded bytes go into a ring, which is written to the host in large
+  writes straight from the ring with writev(): when SERIAL_FLUSH bytes
+  have built up, when the run loop calls serial_poll(), and at the end.
+  A pseudo-terminal is written without blocking; what it won't take
+  stays in the ring, and bytes that don't fit there are dropped.
+*/
+
+#define SERIAL_PORT             5
+#define SERIAL_TX               0x02
+
+#define SERIAL_RING             65536
+#define SERIAL_FLUSH            4096
+
+extern uint64_t serial_bytes;
+extern uint64_t serial_errors;          /* Framing errors */
+extern uint64_t serial_dropped;
+
+/* Send what is decoded to filename, "-" for stdout, or "pty" for a new
+   pseudo-terminal (see serial_name()). bit_cycles is the bit time in
+   machine cycles, 0 to measure it. Returns 0 on success. */
+int serial_open(const char *filename, int bit_cycles);
+
+/* The pseudo-terminal's name, for a terminal program to open */
+const char *serial_name();
+
+/* Called by out() for SERIAL_PORT */
+void serial_out(uint8_t value);
+
+/* Finish a byte whose stop bit is over, and write out the ring */
+void serial_poll();
+
+void serial_close();
+
+#endif
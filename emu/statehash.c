@@ -0,0 +1,104 @@
+#include "mwemu.h"
+#include "1802.h"
+#include "statehash.h"
+
+#include <string.h>
+
+#define PAGE_BYTES              (1 << MEM_PAGE_SHIFT)
+
+static uint64_t page_hash[MEM_PAGES];
+static uint64_t mem_root;
+static int ready;
+
+
+/* The finalizer of MurmurHash3: every input bit affects every output bit */
+static uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+
+static uint64_t hash_words(const uint8_t *p, int len, uint64_t h) {
+  uint64_t w;
+  int i;
+  for (i = 0; i < len; i += 8) {
+    memcpy(&w, p + i, 8);
+    h = (h ^ w) * 0x100000001B3ULL;
+    h ^= h >> 29;
+  }
+  return mix(h);
+}
+
+
+/* What a page adds to the memory's hash */
+static uint64_t term(int page, uint64_t h) {
+  return mix(h + (uint64_t)page * 0x9E3779B97F4A7C15ULL);
+}
+
+
+static void update() {
+  uint64_t h, any;
+  int i, p;
+
+  if (!ready) {
+    mem_touch_all();
+    mem_root = 0;
+    for (p = 0; p < MEM_PAGES; p++) mem_root += term(p, page_hash[p]);
+    ready = 1;
+  }
+  /* Eight pages at a time, as most are clean */
+  for (i = 0; i < MEM_PAGES; i += 8) {
+    memcpy(&any, mem_dirty + i, 8);
+    if (!any) continue;
+    for (p = i; p < i + 8; p++) {
+      if (!mem_dirty[p]) continue;
+      mem_dirty[p] = 0;
+      h = hash_words(mem + p * PAGE_BYTES, PAGE_BYTES, p);
+      mem_root += term(p, h) - term(p, page_hash[p]);
+      page_hash[p] = h;
+    }
+  }
+}
+
+
+uint64_t state_mem_hash() {
+  update();
+  return mem_root;
+}
+
+
+uint64_t state_page_hash(int page) {
+  update();
+  return page_hash[page & (MEM_PAGES - 1)];
+}
+
+
+void state_hash_save(state_hashes *h) {
+  update();
+  memcpy(h->page, page_hash, sizeof(page_hash));
+  h->mem = mem_root;
+}
+
+
+void state_hash_load(const state_hashes *h) {
+  memcpy(page_hash, h->page, sizeof(page_hash));
+  mem_root = h->mem;
+  memset(mem_dirty, 0, sizeof(mem_dirty));
+  ready = 1;
+}
+
+
+uint64_t state_hash() {
+  /* Zeroed first, so that padding hashes the same every time */
+  union {
+    cpu_regs_packed p;
+    uint8_t bytes[(sizeof(cpu_regs_packed) + 7) & ~7];
+  } regs;
+  memset(&regs, 0, sizeof(regs));
+  cpu_pack(&r, &regs.p);
+  return hash_words(regs.bytes, sizeof(regs.bytes), state_mem_hash());
+}
@@ -0,0 +1,44 @@
+#ifndef _statehash_h_
+#define _statehash_h_
+
+#include "mwemu.h"
+#include "1802.h"
+
+/*
+  A hash of the machine's state, for telling whether two runs are still
+  doing the same thing without comparing their memories.
+
+  Each 256 byte page of memory has a hash, and the memory's is the sum
+  of those, each mixed with its page number. Every write marks its page
+  in mem_dirty (one store, by the core), so bringing the hash up to date
+  only rehashes the pages written since last time, and adjusts the sum
+  for each. state_hash() adds the registers (not I/O or counters). Two
+  runs of the same build give equal hashes exactly when memory and
+  registers are equal, short of a 64 bit collision.
+
+  Snapshot restores, ROM loads and battery-backed RAM mark everything,
+  so the first hash after one of those rehashes all of memory (tens of
+  microseconds); otherwise a hash costs well under a microsecond. A
+  caller that goes back to the same snapshot over and over can keep its
+  hashes with state_hash_save() and put them back after cpu_restore()
+  with state_hash_load(), so that only what changed since is rehashed.
+*/
+
+typedef struct _state_hashes {
+  uint64_t page[MEM_PAGES];
+  uint64_t mem;
+} state_hashes;
+
+/* Memory and registers */
+uint64_t state_hash();
+
+/* Memory alone, and one page of it: where two runs' memories differ */
+uint64_t state_mem_hash();
+uint64_t state_page_hash(int page);
+
+/* The hashes of memory as it is now, and back again once memory is
+   exactly as it was then */
+void state_hash_save(state_hashes *h);
+void state_hash_load(const state_hashes *h);
+
+#endif
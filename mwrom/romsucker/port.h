@@ -0,0 +1,41 @@
+#ifndef _port_h_
+#define _port_h_
+
+#include <stdio.h>
+
+/*
+  A parallel port as romsucker sees it: the control register (STROBE,
+  AUTOFEED, nINIT, SELECTIN bits as written to PPWCONTROL), the data
+  direction, and the data register. Each call is one transaction with
+  the port; romsucker only makes one when the state actually changes.
+*/
+
+/* Control register bits */
+#define STROBE		0x01
+#define AUTOFEED	0x02
+#define nINIT		0x04 /* non-inverted */
+#define SELECTIN	0x08
+#define PCD		0x20
+
+typedef struct _port_ops {
+  const char *name;
+  /* Returns 0 on success */
+  int (*open)(const char *arg);
+  void (*control)(unsigned char bits);
+  void (*data_dir)(int input);
+  void (*data_out)(unsigned char byte);
+  unsigned char (*data_in)();
+  /* Returns the number of protocol errors seen (simulation only) */
+  unsigned long (*close)(FILE *report);
+} port_ops;
+
+/* /dev/parportN through ppdev ioctls */
+extern port_ops ppdev_port;
+
+/* 82C55A with the ROM on ports B/C (address) and A (data), in memory */
+extern port_ops sim8255_port;
+
+/* Chance that a simulated ROM read comes back with one bit flipped */
+extern double sim8255_noise;
+
+#endif
@@ -0,0 +1,63 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/parport.h>
+#include <linux/ppdev.h>
+#include <sys/ioctl.h>
+
+#include "port.h"
+
+static int PortFD = -1;
+
+
+static int ppdev_open(const char *device) {
+  PortFD = open(device, O_RDWR);
+  if (PortFD < 0) return -1;
+  if (ioctl(PortFD, PPCLAIM)) {
+    close(PortFD);
+    PortFD = -1;
+    return -1;
+  }
+  return 0;
+}
+
+
+static void ppdev_control(unsigned char bits) {
+  ioctl(PortFD, PPWCONTROL, &bits);
+}
+
+
+static void ppdev_data_dir(int input) {
+  ioctl(PortFD, PPDATADIR, &input);
+}
+
+
+static void ppdev_data_out(unsigned char byte) {
+  ioctl(PortFD, PPWDATA, &byte);
+}
+
+
+static unsigned char ppdev_data_in() {
+  unsigned char byte = 0xFF;
+  ioctl(PortFD, PPRDATA, &byte);
+  return byte;
+}
+
+
+static unsigned long ppdev_close(FILE *report) {
+  (void)report;
+  ioctl(PortFD, PPRELEASE);
+  close(PortFD);
+  PortFD = -1;
+  return 0;
+}
+
+
+port_ops ppdev_port = {
+  "ppdev",
+  ppdev_open,
+  ppdev_control,
+  ppdev_data_dir,
+  ppdev_data_out,
+  ppdev_data_in,
+  ppdev_close
+};
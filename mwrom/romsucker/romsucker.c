@@ -1,15 +1,12 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <sys/io.h>
+#include <string.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <linux/parport.h>
-#include <linux/ppdev.h>
-#include <sys/ioctl.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-
-/* 
+#include <time.h>
+
+#include "port.h"
+
+/*
    Wiring:
    -------
 
@@ -24,34 +21,32 @@
 /* Size of ROM */
 #define ROM_SIZE        8192
 
-/* PC parallel port address */
-#define port_base       0x0378
-#define port_control    (port_base + 2)
-
-/* Control register bits */
-#define STROBE		0x01
-#define AUTOFEED	0x02
-#define nINIT		0x04 /* non-inverted */
-#define SELECTIN	0x08
-#define PCD		0x20
+/*
+  The macros below only change the wanted state (ctrport, datadir,
+  byte_out). sync() then makes one port transaction per register that
+  actually differs from what the port already holds, so the "no read or
+  write" and register-select steps that repeat the current state cost
+  nothing. Strobe edges get a sync() of their own: the address lines must
+  be stable before and after each strobe.
+*/
 
 /* Chip pin assignments */
-#define nWR_disable     ctrport &= ~STROBE; ioctl(PortFD, PPWCONTROL, &ctrport)
-#define nWR_enable      ctrport |= STROBE; ioctl(PortFD, PPWCONTROL, &ctrport)
-#define nRD_disable     ctrport &= ~AUTOFEED; ioctl(PortFD, PPWCONTROL, &ctrport)
-#define nRD_enable      ctrport |= AUTOFEED; ioctl(PortFD, PPWCONTROL, &ctrport)
-#define A1_high         ctrport &= ~SELECTIN; ioctl(PortFD, PPWCONTROL, &ctrport)
-#define A1_low          ctrport |= SELECTIN; ioctl(PortFD, PPWCONTROL, &ctrport)
-#define A0_low          ctrport &= ~nINIT; ioctl(PortFD, PPWCONTROL, &ctrport) // non-inverted
-#define A0_high         ctrport |= nINIT; ioctl(PortFD, PPWCONTROL, &ctrport)
+#define nWR_disable     ctrport &= ~STROBE
+#define nWR_enable      ctrport |= STROBE
+#define nRD_disable     ctrport &= ~AUTOFEED
+#define nRD_enable      ctrport |= AUTOFEED
+#define A1_high         ctrport &= ~SELECTIN
+#define A1_low          ctrport |= SELECTIN
+#define A0_low          ctrport &= ~nINIT // non-inverted
+#define A0_high         ctrport |= nINIT
 
 /* Parallel port direction control */
-#define port_write      datadir = 0; ioctl(PortFD, PPDATADIR, &datadir)
-#define port_read       datadir = 1; ioctl(PortFD, PPDATADIR, &datadir)
+#define port_write      datadir = 0
+#define port_read       datadir = 1
 
 /* Data byte out/in */
-#define port_out(byte)  byte_out = byte; ioctl(PortFD, PPWDATA, &byte_out)
-#define port_in         ioctl(PortFD, PPRDATA, &byte_in)
+#define port_out(byte)  byte_out = byte
+#define port_in         byte_in = port->data_in(); port_ops_count++
 
 
 /* 8255: Port A = input, Port B, C = output */
@@ -59,17 +54,44 @@
 #define IO8255_CONFIG   0b10010000
 
 
-/* Address of parallel port control register */
+/* Wanted state, and what the port holds (-1: unknown) */
 unsigned char byte_out, byte_in;
 unsigned char ctrport;
 int datadir;
-int PortFD;
+int port_ctrl = -1, port_dir = -1, port_data = -1;
 
+port_ops *port = &ppdev_port;
+unsigned long port_ops_count;
+unsigned int settle_us = 200;
 
-/* Initialize parallel port */
-void init_port() {
-  PortFD = open("/dev/parport0", O_RDWR);
-  ioctl(PortFD, PPCLAIM);
+
+/* Bring the port in line with the wanted state */
+void sync() {
+  if (datadir != port_dir) {
+    port->data_dir(datadir);
+    port_dir = datadir;
+    port_ops_count++;
+  }
+  if (!datadir && byte_out != port_data) {
+    port->data_out(byte_out);
+    port_data = byte_out;
+    port_ops_count++;
+  }
+  if (ctrport != port_ctrl) {
+    port->control(ctrport);
+    port_ctrl = ctrport;
+    port_ops_count++;
+  }
+}
+
+
+/* Pulse nWR around the current register select and data */
+void strobe_write() {
+  sync();
+  nWR_enable;
+  sync();
+  nWR_disable;
+  sync();
 }
 
 
@@ -85,8 +107,7 @@ void init_state() {
   port_write;
   port_out(IO8255_CONFIG);
   /* Strobe write signal */
-  nWR_enable;
-  nWR_disable;
+  strobe_write();
 }
 
 
@@ -101,8 +122,7 @@ void write_portB(unsigned char byte) {
   port_write;
   port_out(byte);
   /* Strobe write signal */
-  nWR_enable;
-  nWR_disable;
+  strobe_write();
 }
 
 
@@ -117,15 +137,18 @@ void write_portC(unsigned char byte) {
   port_write;
   port_out(byte);
   /* Strobe write signal */
-  nWR_enable;
-  nWR_disable;
+  strobe_write();
 }
 
 
-/* Latch an address */
+/* Latch an address. Port C only changes every 256 bytes. */
 void set_addr(unsigned long addr) {
+  static int high = -1;
   write_portB(addr & 0xFF);
-  write_portC((addr >> 8) & 0xFF);
+  if ((int)((addr >> 8) & 0xFF) != high) {
+    high = (addr >> 8) & 0xFF;
+    write_portC(high);
+  }
 }
 
 
@@ -138,39 +161,271 @@ unsigned char read_byte() {
   /* Select "A" register of 8255 */
   A0_low;
   A1_low;
-  /* Write control register contents */
+  /* Release the data lines */
   port_read;
-  /* Strobe write signal */
+  sync();
+  /* Strobe read signal */
   nRD_enable;
+  sync();
   port_in;
   byte = byte_in;
   nRD_disable;
+  sync();
   return byte;
 }
 
 
+/* CRC-32 (IEEE, reflected) and the 16-bit byte sum, as DASMx prints them */
+unsigned long crc_table[256];
+
+void crc_init() {
+  unsigned long c;
+  int i, k;
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+    crc_table[i] = c;
+  }
+}
 
-void readROM(char *filename) {
+#define CRC_UPDATE(crc, byte) \
+  crc = crc_table[((crc) ^ (byte)) & 0xFF] ^ ((crc) >> 8)
+
+
+/* Read [start, end) into buf, with the running CRC/sum over it */
+void read_range(unsigned char *buf, unsigned long start, unsigned long end,
+                unsigned long *crc, unsigned int *sum) {
   unsigned long addr;
-  unsigned char byte;
 
-  FILE *ROMFile;
-  ROMFile = fopen(filename, "w");
+  for (addr = start; addr < end; addr++) {
+    set_addr(addr);
+    if (settle_us) usleep(settle_us);
+    buf[addr] = read_byte();
+    CRC_UPDATE(*crc, buf[addr]);
+    *sum += buf[addr];
+  }
+}
+
+
+/* Every address's first value and read count. Only addresses that ever
+   read differently get a histogram of votes. */
+unsigned char value0[ROM_SIZE];
+unsigned short reads[ROM_SIZE];
+unsigned char unstable[ROM_SIZE];
+unsigned short votes[ROM_SIZE][256];
+
+int vote_winner(unsigned long addr) {
+  int v, best = 0;
+  if (!unstable[addr]) return value0[addr];
+  for (v = 1; v < 256; v++)
+    if (votes[addr][v] > votes[addr][best]) best = v;
+  return best;
+}
+
+
+void tally(const unsigned char *pass, unsigned long start, unsigned long end) {
+  unsigned long addr;
+  for (addr = start; addr < end; addr++) {
+    if (!reads[addr]++) value0[addr] = pass[addr];
+    if (!unstable[addr]) {
+      if (pass[addr] == value0[addr]) continue;
+      unstable[addr] = 1;
+      memset(votes[addr], 0, sizeof(votes[addr]));
+      votes[addr][value0[addr]] = reads[addr] - 1;
+    }
+    votes[addr][pass[addr]]++;
+  }
+}
+
+
+/*
+  Read the whole chip `passes` times, then re-read each run of addresses
+  that disagreed, `passes` times (at least twice) per round, until a
+  round reads it the same every time or `retries` rounds are used up. buf gets the majority
+  vote. Returns the number of addresses that never settled.
+*/
+unsigned long readROM(unsigned char *buf, int passes, int retries) {
+  static unsigned char pass[ROM_SIZE], first[ROM_SIZE];
+  static unsigned char settled[ROM_SIZE];
+  unsigned long addr, start, a, crc, n_unstable = 0, unsettled = 0;
+  unsigned int sum;
+  int i, v, round, reread = passes > 1 ? passes : 2;
+
+  memset(reads, 0, sizeof(reads));
+  memset(unstable, 0, sizeof(unstable));
+
+  for (i = 0; i < passes; i++) {
+    crc = 0xFFFFFFFFUL;
+    sum = 0;
+    read_range(pass, 0, ROM_SIZE, &crc, &sum);
+    tally(pass, 0, ROM_SIZE);
+    if (passes > 1)
+      printf("Pass %d: CRC-32 %.8lX, checksum %.4X\n", i + 1,
+             crc ^ 0xFFFFFFFFUL, sum & 0xFFFF);
+  }
 
   for (addr = 0; addr < ROM_SIZE; addr++) {
-    set_addr(addr);
-    usleep(200);
-    byte = read_byte();
-    fputc(byte, ROMFile);
+    settled[addr] = !unstable[addr];
+    n_unstable += unstable[addr];
+  }
+
+  for (round = 0; round < retries && n_unstable; round++) {
+    for (start = 0; start < ROM_SIZE; start = addr + 1) {
+      for (; start < ROM_SIZE && settled[start]; start++);
+      for (addr = start; addr < ROM_SIZE && !settled[addr]; addr++);
+      if (start == addr) break;
+      /* [start, addr) disagreed: it settles if a fresh set of reads agrees */
+      for (i = 0; i < reread; i++) {
+        read_range(pass, start, addr, &crc, &sum);
+        tally(pass, start, addr);
+        for (a = start; a < addr; a++) {
+          if (i == 0) first[a] = pass[a], settled[a] = 1;
+          else if (pass[a] != first[a]) settled[a] = 0;
+        }
+      }
+    }
+    for (n_unstable = 0, addr = 0; addr < ROM_SIZE; addr++)
+      n_unstable += !settled[addr];
   }
 
-  fclose(ROMFile);
+  for (addr = 0; addr < ROM_SIZE; addr++) {
+    buf[addr] = vote_winner(addr);
+    if (!unstable[addr]) continue;
+    printf("Unstable %.4lX:", addr);
+    for (v = 0; v < 256; v++)
+      if (votes[addr][v]) printf(" %.2X x%u", v, votes[addr][v]);
+    printf(" -> %.2X%s\n", buf[addr], settled[addr] ? "" : " (unsettled)");
+    if (!settled[addr]) unsettled++;
+  }
+  return unsettled;
+}
+
+
+/* Find "Checksum: 35B7" and "CRC-32: B9C01F6B" in a DASMx listing header */
+int listing_sums(const char *filename, unsigned long *crc, unsigned int *sum) {
+  char line[256], *p;
+  int found = 0;
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) return -1;
+  while (fgets(line, sizeof(line), f) && found != 3) {
+    if ((p = strstr(line, "Checksum:")) != NULL) {
+      *sum = strtoul(p + 9, NULL, 16);
+      found |= 1;
+    } else if ((p = strstr(line, "CRC-32:")) != NULL) {
+      *crc = strtoul(p + 7, NULL, 16);
+      found |= 2;
+    }
+  }
+  fclose(f);
+  return found == 3 ? 0 : -1;
+}
+
+
+/* Compare a dump with the image behind the simulated port */
+unsigned long compare(const unsigned char *buf, unsigned long size,
+                      const char *filename) {
+  unsigned char ref[ROM_SIZE];
+  unsigned long i, bad = 0;
+  FILE *f = fopen(filename, "r");
+  if (f == NULL || fread(ref, 1, size, f) != size) {
+    fprintf(stderr, "Cannot read reference image \"%s\".\n", filename);
+    exit(1);
+  }
+  fclose(f);
+  for (i = 0; i < size; i++) {
+    if (buf[i] == ref[i]) continue;
+    if (bad++ < 10)
+      fprintf(stderr, "Mismatch at %.4lx: read %.2x, expected %.2x\n",
+              i, buf[i], ref[i]);
+  }
+  return bad;
+}
+
+
+void usage(char *prog) {
+  fprintf(stderr, "Usage: %s [-p device | -s image [-x noise]] [-d settle_us] "
+          "[-n passes] [-r retries] [-l listing] [-b] [-o out]\n", prog);
+  exit(1);
 }
 
 
 int main(int argc, char **argv) {
-  init_port();
+  unsigned char buf[ROM_SIZE];
+  char *device = "/dev/parport0", *image = NULL, *out = "microwriter.rom";
+  char *listing = NULL;
+  int c, bench = 0, passes = 1, retries = 8;
+  unsigned long errors = 0, crc, want_crc, addr;
+  unsigned int sum, want_sum;
+  struct timespec t0, t1;
+  double secs;
+  FILE *f;
+
+  while ((c = getopt(argc, argv, "p:s:x:d:n:r:l:bo:")) != -1) {
+    switch (c) {
+    case 'p': device = optarg; break;
+    case 's': image = optarg; port = &sim8255_port; break;
+    case 'x': sim8255_noise = atof(optarg); break;
+    case 'd': settle_us = atoi(optarg); break;
+    case 'n': passes = atoi(optarg); break;
+    case 'r': retries = atoi(optarg); break;
+    case 'l': listing = optarg; break;
+    case 'b': bench = 1; break;
+    case 'o': out = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (passes < 1 || passes > 1000) usage(argv[0]);
+  if (listing && listing_sums(listing, &want_crc, &want_sum)) {
+    fprintf(stderr, "No checksum and CRC-32 in listing \"%s\".\n", listing);
+    exit(1);
+  }
+
+  if (port->open(image ? image : device)) {
+    fprintf(stderr, "Cannot open %s port \"%s\".\n", port->name,
+            image ? image : device);
+    exit(1);
+  }
+
+  crc_init();
+  clock_gettime(CLOCK_MONOTONIC, &t0);
   init_state();
-  readROM("microwriter.rom");
-  return 0;
+  errors += readROM(buf, passes, retries);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  errors += port->close(image ? stderr : NULL);
+  if (image && !sim8255_noise) errors += compare(buf, ROM_SIZE, image);
+
+  crc = 0xFFFFFFFFUL;
+  sum = 0;
+  for (addr = 0; addr < ROM_SIZE; addr++) {
+    CRC_UPDATE(crc, buf[addr]);
+    sum += buf[addr];
+  }
+  crc ^= 0xFFFFFFFFUL;
+  sum &= 0xFFFF;
+  printf("Image: CRC-32 %.8lX, checksum %.4X", crc, sum);
+  if (listing) {
+    if (crc == want_crc && sum == want_sum) {
+      printf(" (matches listing)");
+    } else {
+      printf(" (listing: CRC-32 %.8lX, checksum %.4X)", want_crc, want_sum);
+      errors++;
+    }
+  }
+  printf("\n");
+
+  if (bench) {
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("%s: %d bytes x %d in %.3f s (%.0f bytes/s), %lu port ops (%.2f per byte)\n",
+           port->name, ROM_SIZE, passes, secs, ROM_SIZE * passes / secs,
+           port_ops_count, (double)port_ops_count / ROM_SIZE / passes);
+  }
+
+  f = fopen(out, "w");
+  if (f == NULL || fwrite(buf, 1, ROM_SIZE, f) != ROM_SIZE || fclose(f)) {
+    fprintf(stderr, "Cannot write \"%s\".\n", out);
+    exit(1);
+  }
+
+  return errors ? 1 : 0;
 }
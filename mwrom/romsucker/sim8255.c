@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "port.h"
+
+/*
+  Simulated 82C55A wired as in romsucker.c, with a ROM whose address
+  lines hang off ports B (low) and C (high) and whose data lines feed
+  port A. Besides answering reads, it checks the bus protocol: strobes
+  must not overlap, the address must not move under a strobe, the host
+  must drive the bus for writes and release it for reads, and ports are
+  only used in the direction the control word set them up for.
+*/
+
+/* Control word bits */
+#define MODE_SET        0x80
+#define A_INPUT         0x10
+#define CH_INPUT        0x08
+#define B_INPUT         0x02
+#define CL_INPUT        0x01
+
+double sim8255_noise;
+
+static unsigned char *rom;
+static unsigned long rom_size;
+
+static unsigned char ctrl; /* Last control register value */
+static unsigned char data; /* Host data register */
+static int host_input;     /* Host has released the data lines */
+
+static unsigned char config, port_b, port_c;
+static unsigned long errors, reads, writes;
+
+
+/* Line levels as the 8255 sees them. STROBE, AUTOFEED and SELECTIN are
+   inverted by the port hardware, nINIT is not. */
+#define WR_ASSERTED(c)  ((c) & STROBE)
+#define RD_ASSERTED(c)  ((c) & AUTOFEED)
+#define REG_SELECT(c)   ((((c) & SELECTIN) ? 0 : 2) | (((c) & nINIT) ? 1 : 0))
+
+
+static void violation(const char *what) {
+  if (errors++ < 10) fprintf(stderr, "sim8255: %s\n", what);
+}
+
+
+static int sim_open(const char *filename) {
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) return -1;
+  fseek(f, 0, SEEK_END);
+  rom_size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  rom = malloc(rom_size ? rom_size : 1);
+  if (rom == NULL || fread(rom, 1, rom_size, f) != rom_size) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  /* Power-on: mode 0, every port an input, strobes idle */
+  config = MODE_SET | A_INPUT | CH_INPUT | B_INPUT | CL_INPUT;
+  ctrl = 0;
+  host_input = 0;
+  errors = reads = writes = 0;
+  return rom_size ? 0 : -1;
+}
+
+
+/* Rising edge of nWR: the 8255 latches the bus into the selected register */
+static void latch_write(int reg) {
+  int bit;
+  writes++;
+  if (host_input) violation("write strobe with the host bus released");
+  switch (reg) {
+  case 0:
+    violation("write to port A, the ROM data input");
+    break;
+  case 1:
+    if (config & B_INPUT) violation("write to port B while it is an input");
+    port_b = data;
+    break;
+  case 2:
+    if (config & (CH_INPUT | CL_INPUT))
+      violation("write to port C while it is an input");
+    port_c = data;
+    break;
+  case 3:
+    if (data & MODE_SET) {
+      config = data;
+      port_b = port_c = 0; /* Outputs reset on a mode change */
+    } else {
+      /* Port C bit set/reset */
+      bit = (data >> 1) & 7;
+      port_c = (data & 1) ? (port_c | (1 << bit)) : (port_c & ~(1 << bit));
+    }
+    break;
+  }
+}
+
+
+static void sim_control(unsigned char bits) {
+  unsigned char old = ctrl;
+  ctrl = bits;
+
+  if (WR_ASSERTED(bits) && RD_ASSERTED(bits))
+    violation("nRD and nWR asserted together");
+  if ((WR_ASSERTED(old) || RD_ASSERTED(old)) &&
+      (WR_ASSERTED(bits) || RD_ASSERTED(bits)) &&
+      REG_SELECT(old) != REG_SELECT(bits))
+    violation("A0/A1 changed during a strobe");
+  if ((WR_ASSERTED(old) != WR_ASSERTED(bits) ||
+       RD_ASSERTED(old) != RD_ASSERTED(bits)) &&
+      REG_SELECT(old) != REG_SELECT(bits))
+    violation("A0/A1 changed on a strobe edge");
+
+  if (WR_ASSERTED(old) && !WR_ASSERTED(bits)) latch_write(REG_SELECT(old));
+}
+
+
+static void sim_data_dir(int input) {
+  if (!input && RD_ASSERTED(ctrl)) violation("host drives the bus during a read");
+  host_input = input;
+}
+
+
+static void sim_data_out(unsigned char byte) {
+  data = byte;
+}
+
+
+static unsigned char sim_data_in() {
+  unsigned long addr = ((unsigned long)port_c << 8) | port_b;
+  if (!host_input) {
+    violation("data read with the host driving the bus");
+    return data;
+  }
+  if (!RD_ASSERTED(ctrl) || REG_SELECT(ctrl) != 0) {
+    violation("data read without a port A read strobe");
+    return 0xFF;
+  }
+  if (!(config & A_INPUT)) violation("read from port A while it is an output");
+  reads++;
+  /* A marginal read */
+  if (sim8255_noise > 0 && rand() < sim8255_noise * RAND_MAX)
+    return rom[addr % rom_size] ^ (1 << (rand() & 7));
+  return rom[addr % rom_size];
+}
+
+
+static unsigned long sim_close(FILE *report) {
+  if (report != NULL)
+    fprintf(report, "sim8255: %lu register writes, %lu reads, %lu protocol errors\n",
+            writes, reads, errors);
+  free(rom);
+  rom = NULL;
+  return errors;
+}
+
+
+port_ops sim8255_port = {
+  "sim8255",
+  sim_open,
+  sim_control,
+  sim_data_dir,
+  sim_data_out,
+  sim_data_in,
+  sim_close
+};